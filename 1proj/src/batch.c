@@ -0,0 +1,302 @@
+/**
+ * \file batch.c
+ * \brief Batch processing of many files on a work-stealing thread pool
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#define _GNU_SOURCE //getline
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "batch.h"
+
+
+#define RANGE(head, tail) (((uint64_t)(head) << 32) | (uint64_t)(tail))
+#define RANGE_HEAD(range) ((size_t)((range) >> 32))
+#define RANGE_TAIL(range) ((size_t)((range) & 0xFFFFFFFFu))
+
+
+typedef struct { //thread pool shared by all workers
+        batch_item_t *items;
+        batch_func_t func;
+        char *worker_data;
+        size_t worker_size;
+        size_t threads;
+        uint64_t *ranges; //unprocessed items of each worker, head:tail
+} pool_t;
+
+typedef struct {
+        pool_t *pool;
+        size_t id;
+        pthread_t thread;
+} pool_worker_t;
+
+
+/**
+ * \brief Take the first item of the worker's own range.
+ *
+ * \return Item index or -1 if the range is empty.
+ */
+static long pool_take(pool_t *pool, size_t id)
+{
+        uint64_t range = __atomic_load_n(&pool->ranges[id], __ATOMIC_ACQUIRE);
+
+
+        while (RANGE_HEAD(range) < RANGE_TAIL(range)) {
+                if (__atomic_compare_exchange_n(&pool->ranges[id], &range,
+                                        RANGE(RANGE_HEAD(range) + 1,
+                                                RANGE_TAIL(range)),
+                                        0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+                {
+                        return RANGE_HEAD(range);
+                }
+        }
+
+        return -1;
+}
+
+/**
+ * \brief Steal upper half of the remaining items of some other worker.
+ *
+ * Stolen items become the worker's own (empty at that time) range.
+ *
+ * \return 0 on success, -1 if there is nothing left to steal.
+ */
+static int pool_steal(pool_t *pool, size_t id)
+{
+        for (size_t i = 1; i < pool->threads; ++i) {
+                const size_t victim = (id + i) % pool->threads;
+                uint64_t range = __atomic_load_n(&pool->ranges[victim],
+                                __ATOMIC_ACQUIRE);
+
+                while (RANGE_HEAD(range) < RANGE_TAIL(range)) {
+                        const size_t head = RANGE_HEAD(range);
+                        const size_t tail = RANGE_TAIL(range);
+                        const size_t half = (tail - head + 1) / 2;
+
+                        if (__atomic_compare_exchange_n(
+                                                &pool->ranges[victim], &range,
+                                                RANGE(head, tail - half), 0,
+                                                __ATOMIC_ACQ_REL,
+                                                __ATOMIC_ACQUIRE))
+                        {
+                                __atomic_store_n(&pool->ranges[id],
+                                                RANGE(tail - half, tail),
+                                                __ATOMIC_RELEASE);
+                                return 0;
+                        }
+                }
+        }
+
+        return -1;
+}
+
+static void * pool_worker(void *arg)
+{
+        pool_worker_t *worker = arg;
+        pool_t *pool = worker->pool;
+        void *data = pool->worker_data + worker->id * pool->worker_size;
+
+
+        do {
+                long idx;
+
+                while ((idx = pool_take(pool, worker->id)) != -1) {
+                        batch_item_t *item = &pool->items[idx];
+                        const double start = batch_time();
+
+                        item->samples = 0;
+                        item->status = pool->func(item, data);
+                        item->seconds = batch_time() - start;
+                }
+        } while (pool_steal(pool, worker->id) == 0);
+
+        return NULL;
+}
+
+
+char ** batch_manifest_read(const char *file_name, size_t *count)
+{
+        const int stream = (strcmp(file_name, "-") == 0);
+        FILE *file = stream ? stdin : fopen(file_name, "r");
+        size_t size = 0; //allocated names
+        char **names = NULL;
+        char *line = NULL;
+        size_t line_size = 0;
+        ssize_t len;
+
+
+        if (file == NULL) {
+                perror(file_name);
+                return NULL;
+        }
+
+        *count = 0;
+        while ((len = getline(&line, &line_size, file)) != -1) {
+                const char *name = line;
+
+                /* Strip leading and trailing whitespace. */
+                while (len > 0 && isspace((unsigned char)line[len - 1])) {
+                        line[--len] = '\0';
+                }
+                while (isspace((unsigned char)*name)) {
+                        name++;
+                }
+                if (*name == '\0' || *name == '#') {
+                        continue; //empty line or comment
+                }
+
+                if (*count == size) {
+                        char **tmp;
+
+                        size = (size == 0) ? 64 : size * 2;
+                        tmp = realloc(names, size * sizeof (*names));
+                        if (tmp == NULL) {
+                                goto error_lab;
+                        }
+                        names = tmp;
+                }
+                names[*count] = strdup(name);
+                if (names[*count] == NULL) {
+                        goto error_lab;
+                }
+                ++*count;
+        }
+        if (ferror(file)) {
+                perror(file_name);
+                goto free_lab;
+        }
+
+        free(line);
+        if (!stream) {
+                fclose(file);
+        }
+
+        return names;
+
+
+error_lab:
+        perror("malloc");
+free_lab:
+        batch_manifest_free(names, *count);
+        free(line);
+        if (!stream) {
+                fclose(file);
+        }
+
+        return NULL;
+}
+
+void batch_manifest_free(char **names, size_t count)
+{
+        for (size_t i = 0; names != NULL && i < count; ++i) {
+                free(names[i]);
+        }
+        free(names);
+}
+
+size_t batch_run(batch_item_t *items, size_t count, size_t threads,
+                batch_func_t func, void *worker_data, size_t worker_size)
+{
+        pool_t pool = {
+                .items = items,
+                .func = func,
+                .worker_data = worker_data,
+                .worker_size = worker_size,
+                .threads = threads,
+        };
+        pool_worker_t *workers = calloc(threads, sizeof (*workers));
+        size_t failed = 0;
+
+
+        pool.ranges = malloc(threads * sizeof (*pool.ranges));
+        if (workers == NULL || pool.ranges == NULL) {
+                perror("malloc");
+                free(pool.ranges);
+                free(workers);
+                for (size_t i = 0; i < count; ++i) {
+                        items[i].status = -1;
+                }
+                return count;
+        }
+
+        /* Even split, remainder goes to the first workers. */
+        for (size_t i = 0, head = 0; i < threads; ++i) {
+                const size_t len = count / threads + (i < count % threads);
+
+                pool.ranges[i] = RANGE(head, head + len);
+                head += len;
+        }
+
+        /* Calling thread is the worker 0, items of the workers which fail
+         * to start are stolen by the others. */
+        for (size_t i = 0; i < threads; ++i) {
+                workers[i].pool = &pool;
+                workers[i].id = i;
+        }
+        for (size_t i = 1; i < threads; ++i) {
+                if (pthread_create(&workers[i].thread, NULL, pool_worker,
+                                        &workers[i]) != 0)
+                {
+                        fprintf(stderr, "error: thread creation failed\n");
+                        workers[i].pool = NULL;
+                }
+        }
+        pool_worker(&workers[0]);
+        for (size_t i = 1; i < threads; ++i) {
+                if (workers[i].pool != NULL) {
+                        pthread_join(workers[i].thread, NULL);
+                }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+                failed += (items[i].status != 0);
+        }
+        free(pool.ranges);
+        free(workers);
+
+        return failed;
+}
+
+void batch_report(FILE *out, const batch_item_t *items, size_t count,
+                double seconds)
+{
+        size_t failed = 0;
+        size_t samples = 0;
+
+
+        for (size_t i = 0; i < count; ++i) {
+                if (items[i].status == 0) {
+                        fprintf(out, "%s: ok, %zu samples, %.3f s\n",
+                                        items[i].file_name, items[i].samples,
+                                        items[i].seconds);
+                        samples += items[i].samples;
+                } else {
+                        fprintf(out, "%s: failed\n", items[i].file_name);
+                        failed++;
+                }
+        }
+
+        fprintf(out, "batch: %zu files, %zu failed, %zu samples in %.3f s "
+                        "(%.1f files/s, %.0f samples/s)\n", count, failed,
+                        samples, seconds,
+                        (seconds > 0.0) ? count / seconds : 0.0,
+                        (seconds > 0.0) ? samples / seconds : 0.0);
+}
+
+double batch_time(void)
+{
+        struct timespec ts;
+
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,66 @@
+/**
+ * \file batch.h
+ * \brief Batch processing of many files on a work-stealing thread pool
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+
+typedef struct { //one file of the batch
+        const char *file_name;
+        int status; //0 on success, -1 on error
+        size_t samples; //samples written (modulator) or read (demodulator)
+        double seconds; //wall time spent on the file
+} batch_item_t;
+
+/* Process one file. Worker data belongs to the calling thread and survives
+ * across files, so buffers and tables may be reused. */
+typedef int (*batch_func_t)(batch_item_t *item, void *worker_data);
+
+
+/**
+ * \brief Read file names from the manifest, one per line.
+ *
+ * Surrounding whitespace is stripped, empty lines and lines starting with
+ * '#' are skipped. Manifest "-" is stdin.
+ *
+ * \return Array of names (free it by batch_manifest_free()) or NULL on error
+ *         (message is printed).
+ */
+char ** batch_manifest_read(const char *file_name, size_t *count);
+
+/**
+ * \brief Free names returned by batch_manifest_read().
+ */
+void batch_manifest_free(char **names, size_t count);
+
+/**
+ * \brief Process all items using threads workers.
+ *
+ * Items are split evenly into per-worker ranges, a worker which runs out of
+ * its own items steals half of the remaining items of another worker.
+ * worker_data is an array of threads elements, worker_size bytes each.
+ *
+ * \return Number of failed items.
+ */
+size_t batch_run(batch_item_t *items, size_t count, size_t threads,
+                batch_func_t func, void *worker_data, size_t worker_size);
+
+/**
+ * \brief Print per-file status and overall throughput.
+ */
+void batch_report(FILE *out, const batch_item_t *items, size_t count,
+                double seconds);
+
+/**
+ * \brief Monotonic wall clock time in seconds.
+ */
+double batch_time(void);
+
+#endif //BATCH_H
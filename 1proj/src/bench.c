@@ -0,0 +1,513 @@
+/**
+ * \file bench.c
+ * \brief Throughput benchmark of the QPSK modem library
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Synthetic bit stream is modulated and demodulated in memory for every
+ * sample rate, symbol length and instruction set, the best of the repeated
+ * runs is reported as JSON on stdout. No files, no libsndfile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+
+#include "carrier.h"
+#include "kernels.h"
+#include "qpsk.h"
+#include "preamble.h" //PREAMBLE_MIN_SAMPLES
+#include "batch.h" //batch_time
+
+
+#define FREQ 1000 //frequency [Hz]
+#define SYMBOL_LEN_MIN ((PREAMBLE_MIN_SAMPLES + QPSK_SYNC_SYMBOLS - 1) / \
+                QPSK_SYNC_SYMBOLS) //shortest sync the preamble accepts
+#define SYMBOL_LEN_MAX(rate) ((rate) / FREQ * 2) //symbol = 2 periods
+
+#define DEFAULT_BITS (1 << 17) //synthetic bit stream length
+#define DEFAULT_REPEATS 3 //runs of every measurement, the best one counts
+#define DEFAULT_RATES "8000,18000,44100,48000"
+#define DEFAULT_SEED 42
+#define BLOCK_SAMPLES (1 << 16) //samples fed to the demodulator at once
+#define SYNC_REPEATS 1024 //sync sequences per sync measurement
+
+
+typedef struct { //one benchmark configuration
+        unsigned long sample_rate;
+        size_t symbol_len;
+        const char *isa;
+        const kernels_t *kernels;
+        const carrier_t *carrier;
+} config_t;
+
+typedef struct { //everything shared by the measurements
+        size_t symbols; //data symbols of the synthetic stream
+        unsigned char *data; //phase shift indices
+        unsigned char *decoded; //demodulator output
+        int *signal; //modulated stream, sync sequence included
+        void *narrow; //signal converted to a narrow sample format
+        size_t repeats;
+        int first; //no JSON record printed yet
+} bench_t;
+
+
+static const struct {
+        const char *name;
+        kernels_isa_t isa;
+} isas[] = {
+        { "scalar", KERNELS_SCALAR },
+        { "sse2", KERNELS_SSE2 },
+        { "avx2", KERNELS_AVX2 },
+};
+
+static const struct {
+        const char *name;
+        qpsk_decision_t decision;
+} engines[] = {
+        { "hist", QPSK_DECIDE_HIST },
+        { "corr", QPSK_DECIDE_CORR },
+};
+
+static const struct { //demodulator input formats, as read from WAV files
+        const char *stage;
+        qpsk_sample_t format;
+} formats[] = {
+        { "demod_s16", QPSK_S16 },
+        { "demod_u8", QPSK_U8 },
+};
+
+
+/* xorshift64*, reproducible for the seed on every platform. */
+static uint64_t rand_next(uint64_t *state)
+{
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+
+        return *state * 2685821657736338717ull;
+}
+
+static void print_record(bench_t *bench, const config_t *cfg,
+                const char *stage, const char *engine, size_t samples,
+                size_t bits, double seconds, long errors)
+{
+        printf("%s\n    {\"sample_rate\": %lu, \"symbol_len\": %zu, "
+                        "\"isa\": \"%s\", \"stage\": \"%s\", ",
+                        bench->first ? "" : ",", cfg->sample_rate,
+                        cfg->symbol_len, cfg->isa, stage);
+        if (engine != NULL) {
+                printf("\"engine\": \"%s\", ", engine);
+        } else {
+                printf("\"engine\": null, ");
+        }
+        printf("\"samples\": %zu, \"bits\": %zu, \"seconds\": %.9f, "
+                        "\"samples_per_s\": %.1f, \"bits_per_s\": %.1f, "
+                        "\"ns_per_sample\": %.3f, ", samples, bits, seconds,
+                        samples / seconds, bits / seconds,
+                        seconds * 1e9 / samples);
+        if (errors >= 0) {
+                printf("\"bit_errors\": %ld}", errors);
+        } else {
+                printf("\"bit_errors\": null}");
+        }
+        bench->first = 0;
+}
+
+/**
+ * \brief Modulate the whole synthetic stream into bench->signal.
+ *
+ * \return Number of samples.
+ */
+static size_t run_mod(const bench_t *bench, const config_t *cfg)
+{
+        qpsk_mod_t mod;
+        size_t len;
+
+
+        qpsk_mod_init(&mod, cfg->carrier, cfg->symbol_len);
+        mod.kernels = cfg->kernels;
+        len = qpsk_mod_sync(&mod, bench->signal);
+        len += qpsk_mod_process(&mod, bench->data, bench->symbols,
+                        bench->signal + len);
+
+        return len;
+}
+
+/**
+ * \brief Convert bench->signal to the narrow format in bench->narrow.
+ *
+ * Rounded to nearest like 16 and 8 bit PCM WAV files, 8 bit is unsigned.
+ */
+static void run_narrow(const bench_t *bench, qpsk_sample_t format,
+                size_t samples)
+{
+        int16_t *s16 = bench->narrow;
+        uint8_t *u8 = bench->narrow;
+
+
+        for (size_t i = 0; i < samples; ++i) {
+                if (format == QPSK_S16) {
+                        s16[i] = (bench->signal[i] + 0x8000) >> 16;
+                } else {
+                        u8[i] = ((bench->signal[i] + 0x800000) >> 24) + 128;
+                }
+        }
+}
+
+/**
+ * \brief Demodulate signal in the format in blocks into bench->decoded.
+ *
+ * \return Number of wrong bits (lost symbols count as two), -1 on error.
+ */
+static long run_demod(const bench_t *bench, qpsk_demod_t *demod,
+                const void *signal, qpsk_sample_t format, size_t samples)
+{
+        const unsigned char *in = signal;
+        const size_t size = qpsk_sample_size(format);
+        size_t count = 0;
+        ssize_t flushed;
+        long errors = 0;
+
+
+        qpsk_demod_reset(demod);
+        for (size_t i = 0; i < samples; i += BLOCK_SAMPLES) {
+                const size_t len = (samples - i < BLOCK_SAMPLES) ?
+                        samples - i : BLOCK_SAMPLES;
+                const ssize_t ret = qpsk_demod_decode(demod, in + i * size,
+                                format, len, bench->decoded + count);
+
+                if (ret == -1) {
+                        return -1;
+                }
+                count += ret;
+        }
+        flushed = qpsk_demod_flush(demod, bench->decoded + count,
+                        bench->symbols + BLOCK_SAMPLES - count);
+        if (flushed == -1) {
+                return -1;
+        }
+        count += flushed;
+
+        for (size_t i = 0; i < bench->symbols; ++i) {
+                const unsigned diff = (i < count) ?
+                        bench->data[i] ^ bench->decoded[i] : 3;
+
+                errors += (diff & 1) + (diff >> 1);
+        }
+
+        return errors;
+}
+
+/**
+ * \brief Modulate and demodulate block by block, as a streaming tool would.
+ *
+ * \return Number of samples, 0 on error.
+ */
+static size_t run_round_trip(const bench_t *bench, const config_t *cfg,
+                qpsk_demod_t *demod)
+{
+        const size_t block_symbols = BLOCK_SAMPLES / cfg->symbol_len;
+        qpsk_mod_t mod;
+        size_t samples;
+        size_t decoded; //symbols come later than sent, search buffers
+        ssize_t ret;
+
+
+        qpsk_mod_init(&mod, cfg->carrier, cfg->symbol_len);
+        mod.kernels = cfg->kernels;
+        qpsk_demod_reset(demod);
+
+        samples = qpsk_mod_sync(&mod, bench->signal);
+        ret = qpsk_demod_process(demod, bench->signal, samples,
+                        bench->decoded);
+        if (ret == -1) {
+                return 0;
+        }
+        decoded = ret;
+        for (size_t i = 0; i < bench->symbols; i += block_symbols) {
+                const size_t count = (bench->symbols - i < block_symbols) ?
+                        bench->symbols - i : block_symbols;
+                const size_t len = qpsk_mod_process(&mod, bench->data + i,
+                                count, bench->signal);
+
+                ret = qpsk_demod_process(demod, bench->signal, len,
+                                bench->decoded + decoded);
+                if (ret == -1) {
+                        return 0;
+                }
+                decoded += ret;
+                samples += len;
+        }
+        if (qpsk_demod_flush(demod, bench->decoded + decoded,
+                                bench->symbols + BLOCK_SAMPLES - decoded) == -1)
+        {
+                return 0;
+        }
+
+        return samples;
+}
+
+static void bench_config(bench_t *bench, const config_t *cfg)
+{
+        const size_t bits = bench->symbols * 2;
+        const size_t sync_len = QPSK_SYNC_SYMBOLS * cfg->symbol_len;
+        size_t samples = 0;
+        double best;
+
+
+        /* Modulation. */
+        best = 1e300;
+        for (size_t r = 0; r < bench->repeats; ++r) {
+                const double start = batch_time();
+                double t;
+
+                samples = run_mod(bench, cfg);
+                t = batch_time() - start;
+                best = (t < best) ? t : best;
+        }
+        print_record(bench, cfg, "mod", NULL, samples, bits, best, -1);
+
+        for (size_t e = 0; e < sizeof (engines) / sizeof (*engines); ++e) {
+                qpsk_demod_t demod;
+                long errors = 0;
+
+                if (qpsk_demod_init(&demod, cfg->carrier,
+                                        engines[e].decision) != 0)
+                {
+                        perror("malloc");
+                        exit(EXIT_FAILURE);
+                }
+                demod.kernels = cfg->kernels;
+
+                /* Synchronization only, sync sequence over and over. */
+                best = 1e300;
+                for (size_t r = 0; r < bench->repeats; ++r) {
+                        const double start = batch_time();
+                        double t;
+
+                        for (size_t i = 0; i < SYNC_REPEATS; ++i) {
+                                qpsk_demod_reset(&demod);
+                                qpsk_demod_process(&demod, bench->signal,
+                                                sync_len, bench->decoded);
+                                qpsk_demod_flush(&demod, bench->decoded, 0);
+                        }
+                        t = batch_time() - start;
+                        best = (t < best) ? t : best;
+                }
+                print_record(bench, cfg, "sync", engines[e].name,
+                                sync_len * SYNC_REPEATS,
+                                QPSK_SYNC_SYMBOLS * 2 * SYNC_REPEATS, best,
+                                qpsk_demod_synced(&demod) ? 0 : -1);
+
+                /* Demodulation of the whole stream, sync included. */
+                best = 1e300;
+                for (size_t r = 0; r < bench->repeats; ++r) {
+                        const double start = batch_time();
+                        double t;
+
+                        errors = run_demod(bench, &demod, bench->signal,
+                                        QPSK_S32, samples);
+                        t = batch_time() - start;
+                        best = (t < best) ? t : best;
+                }
+                print_record(bench, cfg, "demod", engines[e].name, samples,
+                                bits, best, errors);
+
+                /* Narrow samples decided by the integer kernels. */
+                for (size_t f = 0; f < sizeof (formats) / sizeof (*formats);
+                                ++f)
+                {
+                        run_narrow(bench, formats[f].format, samples);
+                        best = 1e300;
+                        for (size_t r = 0; r < bench->repeats; ++r) {
+                                const double start = batch_time();
+                                double t;
+
+                                errors = run_demod(bench, &demod,
+                                                bench->narrow,
+                                                formats[f].format, samples);
+                                t = batch_time() - start;
+                                best = (t < best) ? t : best;
+                        }
+                        print_record(bench, cfg, formats[f].stage,
+                                        engines[e].name, samples, bits, best,
+                                        errors);
+                }
+
+                /* Round trip, the signal is consumed block by block. */
+                best = 1e300;
+                for (size_t r = 0; r < bench->repeats; ++r) {
+                        const double start = batch_time();
+                        double t;
+
+                        run_round_trip(bench, cfg, &demod);
+                        t = batch_time() - start;
+                        best = (t < best) ? t : best;
+                }
+                errors = 0;
+                for (size_t i = 0; i < bench->symbols; ++i) {
+                        const unsigned diff = bench->data[i] ^
+                                bench->decoded[i];
+
+                        errors += (diff & 1) + (diff >> 1);
+                }
+                print_record(bench, cfg, "round_trip", engines[e].name,
+                                samples, bits, best,
+                                qpsk_demod_synced(&demod) ? errors : -1);
+
+                /* Stream in bench->signal is overwritten by the round trip. */
+                run_mod(bench, cfg);
+                qpsk_demod_free(&demod);
+        }
+}
+
+int main(int argc, char **argv)
+{
+        size_t bits = DEFAULT_BITS;
+        size_t step = 1; //symbol length step
+        const char *rates = DEFAULT_RATES;
+        uint64_t seed = DEFAULT_SEED;
+        unsigned long max_rate = 0;
+        bench_t bench = { .repeats = DEFAULT_REPEATS, .first = 1 };
+        char *rates_copy;
+        char *endptr;
+        int ret;
+
+
+        /* Options parsing. */
+        while ((ret = getopt(argc, argv, "l:n:r:R:S:")) != -1) {
+                unsigned long long val = 0;
+
+                if (ret != 'R' && ret != '?') {
+                        val = strtoull(optarg, &endptr, 10);
+                        if (*optarg == '\0' || *endptr != '\0') {
+                                fprintf(stderr, "error: bad number\n");
+                                return EXIT_FAILURE;
+                        }
+                }
+
+                switch (ret) {
+                case 'l': //symbol length step
+                        step = (val == 0) ? 1 : val;
+                        break;
+
+                case 'n': //bits of the synthetic stream
+                        bits = val;
+                        break;
+
+                case 'r': //repeats of every measurement
+                        bench.repeats = (val == 0) ? 1 : val;
+                        break;
+
+                case 'R': //comma separated sample rates
+                        rates = optarg;
+                        break;
+
+                case 'S': //random generator seed, xorshift needs nonzero
+                        seed = (val == 0) ? DEFAULT_SEED : val;
+                        break;
+
+                default:
+                        return EXIT_FAILURE; //getopt already printed error
+                }
+        }
+        if (argc - optind != 0) {
+                fprintf(stderr, "error: bad argument count\n");
+                return EXIT_FAILURE;
+        }
+
+        /* Synthetic bit stream. */
+        bench.symbols = (bits + 1) / 2;
+        rates_copy = strdup(rates);
+        bench.data = malloc(bench.symbols + 1);
+        bench.decoded = malloc(bench.symbols + BLOCK_SAMPLES);
+        if (rates_copy == NULL || bench.data == NULL ||
+                        bench.decoded == NULL)
+        {
+                perror("malloc");
+                return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < bench.symbols; ++i) {
+                bench.data[i] = rand_next(&seed) >> 62;
+        }
+        for (char *r = strtok(rates_copy, ","); r != NULL;
+                        r = strtok(NULL, ","))
+        {
+                const unsigned long rate = strtoul(r, &endptr, 10);
+
+                if (*endptr != '\0' || rate < FREQ) {
+                        fprintf(stderr, "error: bad sample rate %s\n", r);
+                        return EXIT_FAILURE;
+                }
+                max_rate = (rate > max_rate) ? rate : max_rate;
+        }
+        bench.signal = malloc((bench.symbols + QPSK_SYNC_SYMBOLS) *
+                        SYMBOL_LEN_MAX(max_rate) * sizeof (*bench.signal));
+        bench.narrow = malloc((bench.symbols + QPSK_SYNC_SYMBOLS) *
+                        SYMBOL_LEN_MAX(max_rate) * sizeof (int16_t));
+        if (bench.signal == NULL || bench.narrow == NULL) {
+                perror("malloc");
+                return EXIT_FAILURE;
+        }
+
+        printf("{\n  \"freq\": %d, \"bits\": %zu, \"repeats\": %zu, "
+                        "\"results\": [", FREQ, bench.symbols * 2,
+                        bench.repeats);
+
+        strcpy(rates_copy, rates);
+        for (char *r = strtok(rates_copy, ","); r != NULL;
+                        r = strtok(NULL, ","))
+        {
+                config_t cfg = { .sample_rate = strtoul(r, NULL, 10) };
+                carrier_t carrier;
+
+                if (carrier_init(&carrier, cfg.sample_rate, FREQ) != 0) {
+                        fprintf(stderr, "error: carrier tables allocation "
+                                        "failed\n");
+                        return EXIT_FAILURE;
+                }
+                cfg.carrier = &carrier;
+
+                for (cfg.symbol_len = SYMBOL_LEN_MIN;
+                                cfg.symbol_len <=
+                                SYMBOL_LEN_MAX(cfg.sample_rate);
+                                cfg.symbol_len += step)
+                {
+                        qpsk_params_t params;
+
+                        qpsk_params_default(&params);
+                        params.sample_rate = cfg.sample_rate;
+                        params.freq = FREQ;
+                        params.symbol_len = cfg.symbol_len;
+                        if (qpsk_params_check(&params) != NULL) {
+                                continue; //not a valid modem
+                        }
+
+                        for (size_t i = 0; i < sizeof (isas) / sizeof (*isas);
+                                        ++i)
+                        {
+                                cfg.isa = isas[i].name;
+                                cfg.kernels = kernels_get(isas[i].isa);
+                                if (cfg.kernels == NULL) {
+                                        continue; //not supported here
+                                }
+                                bench_config(&bench, &cfg);
+                                fflush(stdout);
+                        }
+                }
+
+                carrier_free(&carrier);
+        }
+        printf("\n  ]\n}\n");
+
+        free(bench.narrow);
+        free(bench.signal);
+        free(bench.decoded);
+        free(bench.data);
+        free(rates_copy);
+
+        return EXIT_SUCCESS;
+}
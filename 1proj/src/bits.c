@@ -0,0 +1,654 @@
+/**
+ * \file bits.c
+ * \brief Bit stream input parsing and output formatting
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#define _GNU_SOURCE //O_DIRECT
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bits.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+#define WIDE_BATCH 256 //pairs of wide symbols written at once
+
+
+static const char *res_sym[4] = {
+        "00", //00 -> 45 degrees
+        "01", //01 -> 315 degrees
+        "10", //10 -> 135 degrees
+        "11", //11 -> 225 degrees
+};
+
+
+static int is_space(char c)
+{
+        return c == '\n' || c == '\r' || c == ' ' || c == '\t';
+}
+
+/**
+ * \brief Validate and pack pairs of characters, 32 at a time.
+ *
+ * Stops at the first 32 byte chunk containing anything else than '0' and
+ * '1', the rest is left for the scalar code.
+ *
+ * \return Number of consumed characters, stored indices are half of that.
+ */
+static size_t pack_pairs(const char *in, size_t len, unsigned char *out)
+{
+        size_t i = 0;
+
+#ifdef __SSE2__
+        const __m128i digit_mask = _mm_set1_epi8(~1);
+        const __m128i zero_char = _mm_set1_epi8('0');
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i low_byte = _mm_set1_epi16(0x00FF);
+
+
+        for (; i + 32 <= len; i += 32) {
+                const __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+                const __m128i b = _mm_loadu_si128((const __m128i *)(in +
+                                        i + 16));
+                __m128i valid;
+
+                /* '0' is 0x30, '1' is 0x31, so (c & ~1) == '0' */
+                valid = _mm_and_si128(
+                                _mm_cmpeq_epi8(_mm_and_si128(a, digit_mask),
+                                        zero_char),
+                                _mm_cmpeq_epi8(_mm_and_si128(b, digit_mask),
+                                        zero_char));
+                if (_mm_movemask_epi8(valid) != 0xFFFF) {
+                        break;
+                }
+
+                /* First bit of the pair is in the low byte of 16 bit lane. */
+                __m128i bits_a = _mm_and_si128(a, one);
+                __m128i bits_b = _mm_and_si128(b, one);
+
+                bits_a = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(bits_a,
+                                                low_byte), 1),
+                                _mm_srli_epi16(bits_a, 8));
+                bits_b = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(bits_b,
+                                                low_byte), 1),
+                                _mm_srli_epi16(bits_b, 8));
+                _mm_storeu_si128((__m128i *)(out + i / 2),
+                                _mm_packus_epi16(bits_a, bits_b));
+        }
+#else
+        (void)in;
+        (void)len;
+        (void)out;
+#endif
+
+        return i;
+}
+
+
+/**
+ * \brief Read packed bytes, every byte holds 4 indices, MSB first.
+ *
+ * Indices of a byte that don't fit are kept for the next call.
+ */
+static ssize_t bits_read_packed(bits_reader_t *reader, unsigned char *symbols,
+                size_t max)
+{
+        size_t count = 0;
+
+
+        while (reader->carry_count > 0 && count < max) {
+                symbols[count++] = reader->carry[0];
+                memmove(reader->carry, reader->carry + 1,
+                                --reader->carry_count);
+        }
+
+        while (count < max) {
+                size_t len;
+
+                if (reader->pos == reader->len) { //refill the block
+                        reader->offset += reader->len;
+                        reader->pos = 0;
+                        reader->len = fread(reader->buf, 1, BITS_BLOCK,
+                                        reader->file);
+                        if (reader->len == 0) {
+                                break; //end of input
+                        }
+                }
+
+                len = reader->len - reader->pos;
+                if (len > (max - count) / 4) {
+                        len = (max - count) / 4;
+                }
+                for (size_t i = 0; i < len; ++i) {
+                        const unsigned char byte = reader->buf[reader->pos + i];
+
+                        symbols[count++] = byte >> 6;
+                        symbols[count++] = (byte >> 4) & 0x3;
+                        symbols[count++] = (byte >> 2) & 0x3;
+                        symbols[count++] = byte & 0x3;
+                }
+                reader->pos += len;
+
+                if (len == 0 && count < max) { //split byte, rest is kept
+                        const unsigned char byte = reader->buf[reader->pos++];
+                        const unsigned char split[4] = { byte >> 6,
+                                (byte >> 4) & 0x3, (byte >> 2) & 0x3,
+                                byte & 0x3 };
+                        const size_t fit = max - count;
+
+                        memcpy(symbols + count, split, fit);
+                        count += fit;
+                        reader->carry_count = 4 - fit;
+                        memcpy(reader->carry, split + fit,
+                                        reader->carry_count);
+                }
+        }
+
+        if (ferror(reader->file)) {
+                perror("error: input");
+                return -1;
+        }
+
+        return count;
+}
+
+/**
+ * \brief Read bit pairs, see bits_read().
+ */
+static ssize_t read_pairs(bits_reader_t *reader, unsigned char *symbols,
+                size_t max)
+{
+        size_t count = 0;
+
+
+        if (reader->format == BITS_PACKED) {
+                return bits_read_packed(reader, symbols, max);
+        }
+
+        while (count < max) {
+                if (reader->pos == reader->len) { //refill the block
+                        reader->offset += reader->len;
+                        reader->pos = 0;
+                        reader->len = fread(reader->buf, 1, BITS_BLOCK,
+                                        reader->file);
+                        if (reader->len == 0) {
+                                break; //end of input
+                        }
+                }
+
+                /* Fast path for pair aligned digits. */
+                if (reader->pending == -1 && !reader->trailing) {
+                        size_t len = reader->len - reader->pos;
+
+                        if (len > 2 * (max - count)) {
+                                len = 2 * (max - count);
+                        }
+                        len = pack_pairs(reader->buf + reader->pos, len,
+                                        symbols + count);
+                        reader->pos += len;
+                        count += len / 2;
+                }
+
+                /* Slow path, up to the end of the block. */
+                for (; reader->pos < reader->len && count < max;
+                                ++reader->pos)
+                {
+                        const char c = reader->buf[reader->pos];
+
+                        if (is_space(c)) {
+                                reader->trailing = 1;
+                        } else if (reader->trailing) {
+                                fprintf(stderr, "error: data after whitespace "
+                                                "at offset %zu of the input\n",
+                                                reader->offset + reader->pos);
+                                return -1;
+                        } else if (c != '0' && c != '1') {
+                                fprintf(stderr, "error: unexpected character "
+                                                "0x%02x at offset %zu of the "
+                                                "input\n", (unsigned char)c,
+                                                reader->offset + reader->pos);
+                                return -1;
+                        } else if (reader->pending == -1) {
+                                reader->pending = c - '0';
+                        } else {
+                                symbols[count++] = 2 * reader->pending +
+                                        (c - '0');
+                                reader->pending = -1;
+                        }
+
+                        if (reader->pending == -1 && !reader->trailing &&
+                                        reader->len - reader->pos > 32)
+                        {
+                                ++reader->pos;
+                                break; //back to the fast path
+                        }
+                }
+        }
+
+        if (ferror(reader->file)) {
+                perror("error: input");
+                return -1;
+        } else if (count == 0 && reader->pending != -1) {
+                fprintf(stderr, "error: odd number of bits in the input\n");
+                return -1;
+        }
+
+        return count;
+}
+
+/**
+ * \brief Read wide symbols, built in place from the pairs.
+ *
+ * Symbol is stored only after the pair completing it is taken, so the
+ * symbols never overtake the pairs they are built from.
+ */
+static ssize_t read_wide(bits_reader_t *reader, unsigned char *symbols,
+                size_t max)
+{
+        const unsigned width = reader->width;
+        const unsigned mask = (1u << width) - 1;
+        size_t count = 0;
+        ssize_t pairs;
+
+
+        assert(max >= 2); //room for the padded symbol and the trailer
+        if (reader->ended) {
+                return 0;
+        }
+
+        /* Pairs may not complete a symbol, 0 would be taken for the end. */
+        do {
+                pairs = read_pairs(reader, symbols, max); //fewer come out
+                if (pairs == -1) {
+                        return -1;
+                }
+                for (ssize_t i = 0; i < pairs; ++i) {
+                        reader->acc = (reader->acc << 2) | symbols[i];
+                        reader->acc_bits += 2;
+                        if (reader->acc_bits >= width) {
+                                reader->acc_bits -= width;
+                                symbols[count++] = (reader->acc >>
+                                                reader->acc_bits) & mask;
+                                reader->acc &= (1u << reader->acc_bits) - 1;
+                        }
+                }
+        } while (count == 0 && pairs > 0);
+
+        if (pairs == 0) { //padded last symbol and the trailer
+                const unsigned pad = (reader->acc_bits == 0) ? 0 :
+                        width - reader->acc_bits;
+
+                if (pad != 0) {
+                        symbols[count++] = (reader->acc << pad) & mask;
+                }
+                symbols[count++] = pad;
+                reader->acc = 0;
+                reader->acc_bits = 0;
+                reader->ended = 1;
+        }
+
+        return count;
+}
+
+
+int bits_reader_init(bits_reader_t *reader, FILE *file, bits_format_t format)
+{
+        memset(reader, 0, sizeof (*reader));
+        reader->file = file;
+        reader->format = format;
+        reader->pending = -1;
+        reader->width = 2;
+        reader->buf = malloc(BITS_BLOCK);
+
+        return (reader->buf == NULL) ? -1 : 0;
+}
+
+void bits_reader_reset(bits_reader_t *reader, FILE *file)
+{
+        reader->file = file;
+        reader->len = 0;
+        reader->pos = 0;
+        reader->offset = 0;
+        reader->pending = -1;
+        reader->trailing = 0;
+        reader->carry_count = 0;
+        reader->acc = 0;
+        reader->acc_bits = 0;
+        reader->ended = 0;
+}
+
+void bits_reader_free(bits_reader_t *reader)
+{
+        free(reader->buf);
+        reader->buf = NULL;
+}
+
+void bits_reader_width(bits_reader_t *reader, unsigned width)
+{
+        assert(width >= 2 && width <= 4);
+
+        reader->width = width;
+}
+
+ssize_t bits_read(bits_reader_t *reader, unsigned char *symbols, size_t max)
+{
+        return (reader->width == 2) ? read_pairs(reader, symbols, max) :
+                read_wide(reader, symbols, max);
+}
+
+
+/**
+ * \brief Write len bytes of the buffer, retry on partial writes.
+ */
+static int write_all(bits_writer_t *writer, size_t len)
+{
+        size_t done = 0;
+
+
+        while (done < len) {
+                const ssize_t ret = write(writer->fd, writer->buf + done,
+                                len - done);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                }
+                done += ret;
+        }
+
+        writer->bytes_written += len;
+        writer->flushes++;
+
+        return 0;
+}
+
+/**
+ * \brief Write the whole buffer out, it is always aligned when full.
+ */
+static int flush_full(bits_writer_t *writer)
+{
+        if (writer->len > 0 && write_all(writer, writer->len) != 0) {
+                return -1;
+        }
+        writer->len = 0;
+
+        return 0;
+}
+
+/**
+ * \brief Write bit pairs, see bits_write().
+ */
+static int write_pairs(bits_writer_t *writer, const unsigned char *symbols,
+                size_t count)
+{
+        if (writer->format == BITS_TEXT) {
+                while (count > 0) {
+                        size_t batch = (BITS_OUT_BUFFER - writer->len) / 2;
+                        unsigned char *out = writer->buf + writer->len;
+
+                        if (batch == 0) {
+                                if (flush_full(writer) != 0) {
+                                        return -1;
+                                }
+                                continue;
+                        } else if (batch > count) {
+                                batch = count;
+                        }
+
+                        for (size_t i = 0; i < batch; ++i) {
+                                memcpy(out + 2 * i, res_sym[symbols[i]], 2);
+                        }
+                        writer->len += 2 * batch;
+                        symbols += batch;
+                        count -= batch;
+                }
+
+                return 0;
+        }
+
+        /* Complete the partial byte first. */
+        for (; count > 0 && writer->partial_symbols > 0; --count, ++symbols) {
+                writer->partial = (writer->partial << 2) | *symbols;
+                if (++writer->partial_symbols == 4) {
+                        if (writer->len == BITS_OUT_BUFFER &&
+                                        flush_full(writer) != 0)
+                        {
+                                return -1;
+                        }
+                        writer->buf[writer->len++] = writer->partial;
+                        writer->partial = 0;
+                        writer->partial_symbols = 0;
+                }
+        }
+
+        /* Whole bytes. */
+        while (count >= 4) {
+                size_t batch = BITS_OUT_BUFFER - writer->len;
+                unsigned char *out = writer->buf + writer->len;
+
+                if (batch == 0) {
+                        if (flush_full(writer) != 0) {
+                                return -1;
+                        }
+                        continue;
+                } else if (batch > count / 4) {
+                        batch = count / 4;
+                }
+
+                for (size_t i = 0; i < batch; ++i, symbols += 4) {
+                        out[i] = symbols[0] << 6 | symbols[1] << 4 |
+                                symbols[2] << 2 | symbols[3];
+                }
+                writer->len += batch;
+                count -= 4 * batch;
+        }
+
+        /* Start of the next partial byte. */
+        for (; count > 0; --count, ++symbols) {
+                writer->partial = (writer->partial << 2) | *symbols;
+                writer->partial_symbols++;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief Append bits to the accumulator, complete pairs are stored.
+ *
+ * \return Number of stored pairs.
+ */
+static size_t unpack_bits(bits_writer_t *writer, unsigned value,
+                unsigned bits, unsigned char *pairs)
+{
+        size_t len = 0;
+
+
+        writer->acc = (writer->acc << bits) | value;
+        writer->acc_bits += bits;
+        while (writer->acc_bits >= 2) {
+                writer->acc_bits -= 2;
+                pairs[len++] = (writer->acc >> writer->acc_bits) & 0x3;
+        }
+        writer->acc &= (1u << writer->acc_bits) - 1;
+
+        return len;
+}
+
+/**
+ * \brief Write wide symbols as pairs, the last two are held back for the
+ *        trailer.
+ */
+static int write_wide(bits_writer_t *writer, const unsigned char *symbols,
+                size_t count)
+{
+        unsigned char pairs[WIDE_BATCH];
+        size_t len = 0;
+
+
+        for (size_t i = 0; i < count; ++i) {
+                unsigned char symbol = symbols[i];
+
+                if (writer->trailer) {
+                        if (writer->held_count < 2) {
+                                writer->held[writer->held_count++] = symbol;
+                                continue;
+                        }
+                        symbol = writer->held[0];
+                        writer->held[0] = writer->held[1];
+                        writer->held[1] = symbols[i];
+                }
+                len += unpack_bits(writer, symbol, writer->width, pairs + len);
+                if (len + 2 > WIDE_BATCH) { //room for the next symbol
+                        if (write_pairs(writer, pairs, len) != 0) {
+                                return -1;
+                        }
+                        len = 0;
+                }
+        }
+
+        return write_pairs(writer, pairs, len);
+}
+
+/**
+ * \brief Write the symbol held before the trailer without its padding.
+ */
+static int finish_wide(bits_writer_t *writer)
+{
+        unsigned char pairs[2];
+        size_t len = 0;
+
+
+        if (writer->trailer && writer->held_count == 2) {
+                const unsigned pad = (writer->held[1] < writer->width) ?
+                        writer->held[1] : 0; //damaged trailer drops none
+
+                len = unpack_bits(writer, writer->held[0] >> pad,
+                                writer->width - pad, pairs);
+        }
+        writer->held_count = 0;
+        writer->acc = 0; //odd bit is dropped
+        writer->acc_bits = 0;
+
+        return write_pairs(writer, pairs, len);
+}
+
+
+int bits_writer_init(bits_writer_t *writer, int fd, bits_format_t format,
+                int direct)
+{
+        memset(writer, 0, sizeof (*writer));
+        writer->fd = fd;
+        writer->format = format;
+        writer->direct = direct;
+        writer->width = 2;
+
+        if (posix_memalign((void **)&writer->buf, BITS_DIRECT_ALIGN,
+                                BITS_OUT_BUFFER) != 0)
+        {
+                writer->buf = NULL;
+                return -1;
+        }
+
+        return 0;
+}
+
+void bits_writer_reset(bits_writer_t *writer, int fd, int direct)
+{
+        writer->fd = fd;
+        writer->direct = direct;
+        writer->len = 0;
+        writer->partial = 0;
+        writer->partial_symbols = 0;
+        writer->bytes_written = 0;
+        writer->flushes = 0;
+        writer->acc = 0;
+        writer->acc_bits = 0;
+        writer->held_count = 0;
+}
+
+void bits_writer_free(bits_writer_t *writer)
+{
+        free(writer->buf);
+        writer->buf = NULL;
+}
+
+void bits_writer_width(bits_writer_t *writer, unsigned width, int trailer)
+{
+        assert(width >= 2 && width <= 4);
+
+        writer->width = width;
+        writer->trailer = trailer;
+}
+
+int bits_write(bits_writer_t *writer, const unsigned char *symbols,
+                size_t count)
+{
+        return (writer->width == 2) ? write_pairs(writer, symbols, count) :
+                write_wide(writer, symbols, count);
+}
+
+
+int bits_writer_finish(bits_writer_t *writer)
+{
+        unsigned char last;
+        size_t aligned;
+
+
+        if (writer->width != 2 && finish_wide(writer) != 0) {
+                return -1;
+        }
+
+        /* Terminate text by EOL, pad incomplete byte by zero bits. */
+        if (writer->format == BITS_TEXT) {
+                last = '\n';
+        } else if (writer->partial_symbols > 0) {
+                last = writer->partial << (2 * (4 - writer->partial_symbols));
+                writer->partial = 0;
+                writer->partial_symbols = 0;
+        } else {
+                goto flush_lab;
+        }
+        if (writer->len == BITS_OUT_BUFFER && flush_full(writer) != 0) {
+                return -1;
+        }
+        writer->buf[writer->len++] = last;
+
+
+flush_lab:
+        if (!writer->direct) {
+                return flush_full(writer);
+        }
+
+        /* Direct I/O: aligned part first, then the tail without O_DIRECT. */
+        aligned = writer->len / BITS_DIRECT_ALIGN * BITS_DIRECT_ALIGN;
+        if (aligned > 0 && write_all(writer, aligned) != 0) {
+                return -1;
+        }
+        memmove(writer->buf, writer->buf + aligned, writer->len - aligned);
+        writer->len -= aligned;
+
+        if (writer->len > 0) {
+                const int flags = fcntl(writer->fd, F_GETFL);
+
+                if (flags == -1 || fcntl(writer->fd, F_SETFL,
+                                        flags & ~O_DIRECT) == -1)
+                {
+                        return -1;
+                }
+                writer->direct = 0;
+        }
+
+        return flush_full(writer);
+}
@@ -0,0 +1,154 @@
+/**
+ * \file bits.h
+ * \brief Bit stream input parsing and output formatting
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#ifndef BITS_H
+#define BITS_H
+
+#include <stdio.h>
+#include <sys/types.h> //ssize_t
+
+
+#define BITS_BLOCK (1 << 16) //input bytes read at once
+#define BITS_OUT_BUFFER (1 << 20) //output bytes written at once
+#define BITS_DIRECT_ALIGN 4096 //buffer and size alignment for direct I/O
+
+
+typedef enum { //bit stream file formats
+        BITS_TEXT, //one '0' or '1' character per bit
+        BITS_PACKED, //raw bytes, MSB first, 4 symbols per byte
+} bits_format_t;
+
+typedef struct { //bit stream reader
+        FILE *file;
+        bits_format_t format;
+        char *buf; //input block
+        size_t len; //valid bytes in the block
+        size_t pos; //first unprocessed byte in the block
+        size_t offset; //stream offset of the block
+        int pending; //first bit of an incomplete pair, -1 if none
+        int trailing; //whitespace seen, nothing but whitespace may follow
+        unsigned char carry[3]; //packed indices of a byte split by max
+        unsigned carry_count;
+        unsigned width; //bits per symbol, 2 for pairs
+        unsigned acc; //bits of the next wide symbol read so far
+        unsigned acc_bits;
+        int ended; //trailer of the wide symbols returned
+} bits_reader_t;
+
+typedef struct { //buffered bit stream writer
+        int fd;
+        bits_format_t format;
+        int direct; //fd is opened with O_DIRECT
+        unsigned char *buf; //output buffer, BITS_OUT_BUFFER bytes
+        size_t len; //valid bytes in the buffer
+        unsigned char partial; //packed symbols of an incomplete byte
+        unsigned partial_symbols; //number of symbols in the partial byte
+        size_t bytes_written; //total bytes written to the fd
+        size_t flushes; //number of buffer flushes
+        unsigned width; //bits per symbol, 2 for pairs
+        int trailer; //last wide symbol is the padding of the one before
+        unsigned acc; //bits of wide symbols not yet written as a pair
+        unsigned acc_bits;
+        unsigned char held[2]; //last two wide symbols, held back for trailer
+        unsigned held_count;
+} bits_writer_t;
+
+
+/**
+ * \brief Initialize reader of the file in the format.
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+int bits_reader_init(bits_reader_t *reader, FILE *file,
+                bits_format_t format);
+
+/**
+ * \brief Start reading another file, the input block is reused.
+ */
+void bits_reader_reset(bits_reader_t *reader, FILE *file);
+
+/**
+ * \brief Free reader resources (the file is not closed).
+ */
+void bits_reader_free(bits_reader_t *reader);
+
+/**
+ * \brief Read symbols of width bits (2 to 4) instead of bit pairs.
+ *
+ * Wide symbols are built from the bit pairs, MSB first. The input may end
+ * in the middle of a symbol, so the last symbol is padded by zero bits and
+ * one more symbol, the trailer, holds the number of the padding bits (see
+ * bits_writer_width()). The width survives bits_reader_reset().
+ */
+void bits_reader_width(bits_reader_t *reader, unsigned width);
+
+/**
+ * \brief Read bit pairs as phase shift indices (2 * first_bit + second_bit).
+ *
+ * Text: whitespace (e.g. trailing newline) may only end the input. Any other
+ * character or odd number of bits is an error, nothing is silently dropped.
+ * Packed: every byte gives 4 indices, indices of a byte split by max are
+ * returned by the next call.
+ * Wide symbols are returned instead of the pairs if set, see
+ * bits_reader_width().
+ *
+ * \return Number of stored indices (at most max), 0 at the end of input or
+ *         -1 on error (message is printed to stderr).
+ */
+ssize_t bits_read(bits_reader_t *reader, unsigned char *symbols, size_t max);
+
+/**
+ * \brief Initialize writer of the file descriptor in the format.
+ *
+ * Output is collected in a large buffer and written by big write() calls.
+ * If the fd is opened with O_DIRECT, direct has to be set, the buffer is
+ * then aligned and only whole aligned blocks are written until the finish.
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+int bits_writer_init(bits_writer_t *writer, int fd, bits_format_t format,
+                int direct);
+
+/**
+ * \brief Start writing another file descriptor, the buffer is reused.
+ */
+void bits_writer_reset(bits_writer_t *writer, int fd, int direct);
+
+/**
+ * \brief Free writer resources (the fd is not closed).
+ */
+void bits_writer_free(bits_writer_t *writer);
+
+/**
+ * \brief Write symbols of width bits (2 to 4) instead of bit pairs.
+ *
+ * With trailer the symbols end as read by bits_read() of the same width,
+ * the padding bits announced by the trailer are dropped (a damaged trailer
+ * drops none). Without it every symbol is written whole. Odd bit left at the
+ * end is dropped. Call after bits_writer_reset(), before the first write.
+ */
+void bits_writer_width(bits_writer_t *writer, unsigned width, int trailer);
+
+/**
+ * \brief Write phase shift indices.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int bits_write(bits_writer_t *writer, const unsigned char *symbols,
+                size_t count);
+
+/**
+ * \brief Finish the output and flush the buffer (the fd is not closed).
+ *
+ * Text output is terminated by a newline, incomplete packed byte is padded
+ * by zero bits.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int bits_writer_finish(bits_writer_t *writer);
+
+#endif //BITS_H
@@ -8,128 +8,1203 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
-#include <assert.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/sysinfo.h> //get_nprocs
 
-#include "sndfile.h"
+#include "carrier.h"
+#include "qpsk.h"
+#include "frame.h"
+#include "seek.h"
+#include "wav.h"
+#include "bits.h"
+#include "batch.h"
+#include "stats.h"
+#include "spsc.h"
 
 
-#define SAMPLE_RATE 18000
 #define CHANNELS 1
-#define FORMAT (SF_FORMAT_WAV | SF_FORMAT_PCM_32) //major and minor
-#define AMPLITUDE 0x7F000000u
 
-#define FREQ 1000 //frequency [Hz]
-#define NORM_FREQ ((double)FREQ / SAMPLE_RATE) //normalized f, cycles per sample
+/* Sample rate, frequency, symbol length and sync sequence are set by the
+ * options, qpsk_params_check() limits the symbol to 2 periods and the framed
+ * sync to PREAMBLE_MIN_SAMPLES. */
+/* symbol_rate = sample_rate / symbol_len */
+/* bit_rate = symbol_rate * bits per symbol of the constellation */
+#define PARAMS_CHUNK_MAX 256 //"qpsk" chunk with the parameters
 
-#define SYMBOL_LEN_MIN 1 //symbol = 1 sample (SAMPLE_RATE bps)
-#define SYMBOL_LEN_MAX (SAMPLE_RATE / FREQ * 2) //symbol = 2 periods (1000 bps)
-#define SYMBOL_LEN 30 //symbol = SYMBOL_LEN samples
-/* symbol_rate = SAMPLE_RATE / SYMBOL_LEN */
-/* bit_rate = symbol_rate * 2 */
+#define BATCH_SYMBOLS 4096 //symbols parsed and synthesized at once
+#define TASK_SYMBOLS 4096 //symbols synthesized by one parallel task
+#define PIPE_SLOTS 8 //batches in flight between two pipeline stages
 
-#define SYNCH_SEQ "00110011"
 
+typedef struct { //output sample format selectable by -f
+        const char *name;
+        unsigned format; //WAV_FORMAT_*
+        unsigned bits; //sample width
+} sample_format_t;
 
-static const double phase_shift[4] = {
-        1.0 / 4.0 * M_PI, //00 -> 45 degrees
-        7.0 / 4.0 * M_PI, //01 -> 315 degrees
-        3.0 / 4.0 * M_PI, //10 -> 135 degrees
-        5.0 / 4.0 * M_PI, //11 -> 225 degrees
+typedef struct { //parallel modulation context shared by all threads
+        wav_map_t *map; //preallocated output file, written in place
+        const unsigned char *symbols; //phase shift indices, sync seq included
+        size_t count; //number of symbols
+        const carrier_t *carrier;
+        const qpsk_params_t *params;
+        size_t next_task; //next TASK_SYMBOLS task, atomic
+        int error; //atomic
+        stats_t *stats; //statistics of each thread, NULL if not collected
+        size_t next_stats; //next unused stats, atomic
+} par_ctx_t;
+
+typedef struct { //modulation worker, resources survive across files
+        const carrier_t *carrier;
+        const qpsk_params_t *params; //modem parameters
+        unsigned char chunk[PARAMS_CHUNK_MAX]; //parameters in the header
+        bits_format_t in_format; //input bit stream format
+        int raw; //write headerless samples
+        wav_info_t out_info; //output file parameters
+        size_t threads; //modulation threads for one file
+        int pipeline; //parse, synthesize and write in three threads
+        int index; //write the seek index sidecar
+        bits_reader_t reader; //input parser
+        unsigned char *frame; //current frame, NULL if not framed
+        size_t frame_len; //symbols of the current frame
+        size_t frame_pos; //symbols of the current frame already taken
+        size_t frame_seq; //frames built from the current file
+        int *buffer; //samples buffer, BATCH_SYMBOLS symbols
+        stats_t *stats; //NULL if not collected
+} mod_worker_t;
+
+typedef struct { //pipelined modulation of one file
+        mod_worker_t *worker; //input parser and framing
+        qpsk_mod_t *mod; //owned by the synth stage
+        spsc_t symbols; //parser -> synth, BATCH_SYMBOLS symbols per slot
+        spsc_t samples; //synth -> writer, BATCH_SYMBOLS symbols per slot
+        int error; //parse error
+        stats_t *parse_stats; //of the parse stage, NULL if not collected
+        stats_t *synth_stats; //of the synth stage, NULL if not collected
+} pipe_ctx_t;
+
+
+static const sample_format_t sample_formats[] = {
+        { "pcm8", WAV_FORMAT_PCM, 8 },
+        { "pcm16", WAV_FORMAT_PCM, 16 },
+        { "pcm24", WAV_FORMAT_PCM, 24 },
+        { "pcm32", WAV_FORMAT_PCM, 32 },
+        { "float", WAV_FORMAT_FLOAT, 32 },
+        { NULL, 0, 0 },
+};
+
+static const struct option long_options[] = {
+        { "stats", optional_argument, NULL, 'S' },
+        { "rate", required_argument, NULL, 'R' },
+        { "freq", required_argument, NULL, 'F' },
+        { "symbol-len", required_argument, NULL, 'L' },
+        { "sync", required_argument, NULL, 's' },
+        { "frame", required_argument, NULL, 'M' },
+        { "constellation", required_argument, NULL, 'C' },
+        { NULL, 0, NULL, 0 },
 };
 
 
-static void mod_symbols(char sym1, char sym2, size_t *time, int *buffer)
+static int parse_ulong(const char *str, unsigned long *val)
 {
-        size_t phase_shift_idx = 2 * (sym1 - '0') + (sym2 - '0');
+        char *endptr;
 
 
-        assert(phase_shift_idx < 4);
+        *val = strtoul(str, &endptr, 10);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
+        }
 
-        for (size_t i = 0; i < SYMBOL_LEN; ++i) {
-                buffer[i] = AMPLITUDE * cos(2.0 * M_PI * NORM_FREQ * *time +
-                                phase_shift[phase_shift_idx]);
+        return 0;
+}
+
+static int parse_size(const char *str, size_t *val)
+{
+        char *endptr;
 
-                (*time)++;
+
+        *val = strtoull(str, &endptr, 10);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
         }
+
+        return 0;
 }
 
-int main(int argc, char **argv)
+/**
+ * \brief Buffer for count samples starting at frame of the output.
+ *
+ * Samples of the mapped output file are synthesized right in the mapping if
+ * its format allows it.
+ *
+ * \return Buffer or NULL on error.
+ */
+static int * samples_buffer(wav_map_t *out_map, size_t frame, size_t count,
+                int *buffer)
 {
-        FILE *in_file; //input text file with zeroes '0' and ones '1'
-        size_t file_name_len;
-        size_t time = 0; //discrete time
-        int ret;
+        if (out_map == NULL) {
+                return buffer;
+        }
+        if (wav_map_reserve(out_map, frame + count) != 0) {
+                perror("error: output");
+                return NULL;
+        }
+
+        return wav_map_samples(out_map, frame, count, buffer);
+}
+
+/**
+ * \brief Store samples at frame of the mapped file or write them to the
+ *        stream fd.
+ *
+ * Stream samples are converted to the output format in place, so the buffer
+ * is overwritten.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int write_samples(const wav_info_t *out_info, wav_map_t *out_map,
+                int out_fd, size_t frame, int *buffer, size_t count)
+{
+        if (out_map != NULL) {
+                if (wav_map_reserve(out_map, frame + count) != 0) {
+                        perror("error: output");
+                        return -1;
+                }
+                wav_map_store(out_map, frame, buffer, count);
+
+                return 0;
+        }
+
+        if (out_info->format == WAV_FORMAT_PCM && out_info->bits == 32) {
+                wav_le32((int32_t *)buffer, count);
+        } else {
+                wav_from_int(out_info, (int32_t *)buffer, count,
+                                (unsigned char *)buffer);
+        }
+        if (wav_write(out_fd, buffer, count * (out_info->bits / 8)) != 0) {
+                perror("error: output");
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief Convert the sync sequence to phase shift indices.
+ *
+ * \return Number of stored indices.
+ */
+static size_t sync_symbols(const char *sync_seq, unsigned char *symbols)
+{
+        size_t count = 0;
+
+
+        for (size_t i = 0; sync_seq[i] != '\0'; i += 2) {
+                symbols[count++] = 2 * (sync_seq[i] - '0') +
+                        (sync_seq[i + 1] - '0');
+        }
+
+        return count;
+}
+
+/**
+ * \brief Read the payload of the next frame and build the frame.
+ *
+ * The whole payload is read first, the header carries its CRC. Empty input
+ * still makes one empty frame, so the receiver finds a sync sequence.
+ *
+ * \return Number of symbols of the frame, 0 at EOF, -1 on error.
+ */
+static ssize_t next_frame(mod_worker_t *worker)
+{
+        const size_t frame = worker->params->frame;
+        const size_t sync_len = qpsk_sync_symbols(worker->params->sync_seq);
+        unsigned char *payload = worker->frame + sync_len +
+                FRAME_HEADER_SYMBOLS;
+        frame_header_t header = { .seq = worker->frame_seq };
+        ssize_t ret = 0;
+
+
+        header.len = 0;
+        while (header.len < frame && (ret = bits_read(&worker->reader,
+                                        payload + header.len,
+                                        frame - header.len)) > 0)
+        {
+                header.len += ret;
+        }
+        if (ret == -1) {
+                return -1;
+        } else if (header.len == 0 && worker->frame_seq > 0) {
+                return 0;
+        }
+
+        /* Sync sequence is already in front of the header. */
+        header.crc = frame_crc(payload, header.len);
+        frame_header_pack(&header, worker->frame + sync_len);
+        worker->frame_len = frame_symbols(sync_len, header.len);
+        worker->frame_pos = 0;
+        worker->frame_seq++;
+
+        return worker->frame_len;
+}
+
+/**
+ * \brief Read up to count symbols to be synthesized.
+ *
+ * Framed input is read in whole frames, sync sequences and headers included
+ * (see frame.h). Unframed input is the bit stream as is.
+ *
+ * \return Number of symbols, 0 at EOF, -1 on error (as bits_read()).
+ */
+static ssize_t read_framed(mod_worker_t *worker, unsigned char *symbols,
+                size_t count)
+{
+        size_t left;
+
+
+        if (worker->frame == NULL) {
+                return bits_read(&worker->reader, symbols, count);
+        }
+        if (worker->frame_pos == worker->frame_len) {
+                const ssize_t ret = next_frame(worker);
+
+                if (ret <= 0) {
+                        return ret;
+                }
+        }
+
+        left = worker->frame_len - worker->frame_pos;
+        if (count > left) {
+                count = left;
+        }
+        memcpy(symbols, worker->frame + worker->frame_pos, count);
+        worker->frame_pos += count;
+
+        return count;
+}
+
+/**
+ * \brief Read the whole input and convert it to phase shift indices.
+ *
+ * The sync sequence is prepended (framed input has one in every frame).
+ *
+ * \return Array of indices (free it) or NULL on error (message is printed).
+ */
+static unsigned char * read_symbols(mod_worker_t *worker, size_t *count)
+{
+        size_t size = BATCH_SYMBOLS; //allocated symbols
+        unsigned char *symbols = malloc(size);
+        ssize_t ret;
+
+
+        if (symbols == NULL) {
+                perror("malloc");
+                return NULL;
+        }
+
+        *count = 0;
+        if (worker->frame == NULL) {
+                *count = sync_symbols(worker->params->sync_seq, symbols);
+        }
+
+        while ((ret = read_framed(worker, symbols + *count,
+                                        size - *count)) > 0)
+        {
+                *count += ret;
+                if (size - *count < BATCH_SYMBOLS) { //room for a batch
+                        unsigned char *tmp = realloc(symbols, size * 2);
+
+                        if (tmp == NULL) {
+                                perror("realloc");
+                                free(symbols);
+                                return NULL;
+                        }
+                        symbols = tmp;
+                        size *= 2;
+                }
+        }
+        if (ret == -1) {
+                free(symbols);
+                return NULL;
+        }
+
+        return symbols;
+}
+
+/**
+ * \brief Worker thread, synthesizes tasks and writes them at their offsets.
+ */
+static void * par_worker(void *arg)
+{
+        par_ctx_t *ctx = arg;
+        const size_t symbol_len = ctx->params->symbol_len;
+        int *buffer = malloc(TASK_SYMBOLS * symbol_len * sizeof (*buffer));
+        int *samples; //in the buffer or in place in the mapped output
+        stats_t *stats = NULL;
+        qpsk_mod_t mod;
+        double start;
+
+
+        if (ctx->stats != NULL) {
+                stats = &ctx->stats[__atomic_fetch_add(&ctx->next_stats, 1,
+                                __ATOMIC_RELAXED)];
+        }
+        qpsk_mod_init(&mod, ctx->carrier, symbol_len);
+        qpsk_mod_configure(&mod, ctx->params);
+        if (buffer == NULL) {
+                __atomic_store_n(&ctx->error, 1, __ATOMIC_RELAXED);
+                return NULL;
+        }
+
+        while (!__atomic_load_n(&ctx->error, __ATOMIC_RELAXED)) {
+                const size_t first = TASK_SYMBOLS * __atomic_fetch_add(
+                                &ctx->next_task, 1, __ATOMIC_RELAXED);
+                size_t last = first + TASK_SYMBOLS;
+
+                if (first >= ctx->count) {
+                        break; //no more tasks
+                } else if (last > ctx->count) {
+                        last = ctx->count;
+                }
+
+                start = stats_start(stats);
+                samples = wav_map_samples(ctx->map, first * symbol_len,
+                                (last - first) * symbol_len, buffer);
+                qpsk_mod_seek(&mod, first);
+                qpsk_mod_process(&mod, ctx->symbols + first, last - first,
+                                samples);
+                stats_stop(stats, STATS_DSP, start);
 
-        SNDFILE *out_file; //output WAW file
-        SF_INFO sf_info = { //output WAW file parameters
-                .samplerate = SAMPLE_RATE,
-                .channels = CHANNELS,
-                .format = FORMAT,
+                start = stats_start(stats);
+                wav_map_store(ctx->map, first * symbol_len, samples,
+                                (last - first) * symbol_len);
+                stats_stop(stats, STATS_WRITE, start);
+        }
+
+        free(buffer);
+
+        return NULL;
+}
+
+/**
+ * \brief Modulate the input using multiple threads.
+ *
+ * Waveform of every symbol depends only on its phase shift and position, so
+ * the output is mapped and preallocated in advance and the workers
+ * synthesize disjoint sample ranges straight into the mapping. Output of a
+ * failed run is removed.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int mod_parallel(mod_worker_t *worker, const char *out_file_name,
+                const wav_info_t *out_info, size_t *samples)
+{
+        const size_t threads = worker->threads;
+        wav_map_t out_map;
+        par_ctx_t ctx = {
+                .map = &out_map,
+                .carrier = worker->carrier,
+                .params = worker->params,
         };
-        sf_count_t items_written; //successfully written items
+        pthread_t *workers = malloc(threads * sizeof (*workers));
+        size_t started = 0;
+        unsigned char *symbols;
+        size_t frames;
+        double start;
 
-        int buffer[SYMBOL_LEN]; //samples buffer
 
+        if (worker->stats != NULL) {
+                ctx.stats = calloc(threads, sizeof (*ctx.stats));
+        }
+        if (workers == NULL || (worker->stats != NULL && ctx.stats == NULL)) {
+                perror("malloc");
+                free(workers);
+                return -1;
+        }
+        start = stats_start(worker->stats);
+        symbols = read_symbols(worker, &ctx.count);
+        stats_stop(worker->stats, STATS_READ, start);
+        if (symbols == NULL) {
+                free(ctx.stats);
+                free(workers);
+                return -1;
+        }
+        ctx.symbols = symbols;
+        frames = ctx.count * worker->params->symbol_len;
+        *samples = frames;
+        if (worker->stats != NULL) {
+                worker->stats->symbols += ctx.count -
+                        qpsk_sync_symbols(worker->params->sync_seq);
+        }
 
-        if (argc != 2) {
-                fprintf(stderr, "error: bad argument count\n");
-                return EXIT_FAILURE;
+        /* Preallocate and map the output file. */
+        if (wav_map_create(&out_map, out_file_name, out_info, frames) != 0) {
+                perror(out_file_name);
+                ctx.error = 1;
+                goto free_lab;
         }
 
-        file_name_len = strlen(argv[1]);
-        if (file_name_len < 3 ||
-                        strcmp(argv[1] + (file_name_len - 3), "txt") != 0) {
-                fprintf(stderr, "error: bad input file name\n");
-                return EXIT_FAILURE;
+        for (; started < threads; ++started) {
+                if (pthread_create(&workers[started], NULL, par_worker,
+                                        &ctx) != 0)
+                {
+                        fprintf(stderr, "error: thread creation failed\n");
+                        __atomic_store_n(&ctx.error, 1, __ATOMIC_RELAXED);
+                        break;
+                }
+        }
+        for (size_t i = 0; i < started; ++i) {
+                pthread_join(workers[i], NULL);
+                if (worker->stats != NULL) {
+                        stats_merge(worker->stats, &ctx.stats[i]);
+                }
         }
 
 
-        /* Input and output file opening. */
-        in_file = fopen(argv[1], "r");
-        if (in_file == NULL) {
-                perror(argv[1]);
-                return EXIT_FAILURE;
+        if (wav_map_close(&out_map) != 0) {
+                perror(out_file_name);
+                ctx.error = 1;
+        }
+        if (ctx.error) {
+                unlink(out_file_name); //preallocated, would look valid
         }
+free_lab:
+        free(symbols);
+        free(ctx.stats);
+        free(workers);
 
-        argv[1][file_name_len - 3] = 'w';
-        argv[1][file_name_len - 2] = 'a';
-        argv[1][file_name_len - 1] = 'v';
-        out_file = sf_open(argv[1], SFM_WRITE, &sf_info);
-        if (out_file == NULL) {
-                fprintf(stderr, "%s\n", sf_strerror(out_file));
-                return EXIT_FAILURE;
+        return ctx.error ? -1 : 0;
+}
+
+/**
+ * \brief Parse stage, fills symbol batches until EOF.
+ */
+static void * pipe_parser(void *arg)
+{
+        pipe_ctx_t *ctx = arg;
+        unsigned char *symbols;
+
+
+        while ((symbols = spsc_produce_begin(&ctx->symbols)) != NULL) {
+                const double start = stats_start(ctx->parse_stats);
+                const ssize_t count = read_framed(ctx->worker, symbols,
+                                BATCH_SYMBOLS);
+
+                stats_stop(ctx->parse_stats, STATS_READ, start);
+                if (count <= 0) {
+                        ctx->error = (count == -1);
+                        break;
+                }
+                if (ctx->parse_stats != NULL) {
+                        ctx->parse_stats->symbols += count;
+                }
+                spsc_produce_end(&ctx->symbols, count);
         }
+        spsc_close(&ctx->symbols);
+
+        return NULL;
+}
+
+/**
+ * \brief Synth stage, modulates symbol batches into sample batches.
+ *
+ * Aborted sample ring (writer failure) is propagated to the parser.
+ */
+static void * pipe_synth(void *arg)
+{
+        pipe_ctx_t *ctx = arg;
+        const unsigned char *symbols;
+        size_t count;
+
 
+        while ((symbols = spsc_consume_begin(&ctx->symbols, &count)) !=
+                        NULL)
+        {
+                int *samples = spsc_produce_begin(&ctx->samples);
+                double start;
+                size_t len;
 
-        /* Modulate and write synchronization sequence. */
-        for (size_t i = 0; i < (sizeof (SYNCH_SEQ) - 1); i += 2) {
-                mod_symbols(SYNCH_SEQ[i], SYNCH_SEQ[i + 1], &time, buffer);
+                if (samples == NULL) {
+                        spsc_abort(&ctx->symbols);
+                        break;
+                }
+                start = stats_start(ctx->synth_stats);
+                len = qpsk_mod_process(ctx->mod, symbols, count, samples);
+                stats_stop(ctx->synth_stats, STATS_DSP, start);
 
-                items_written = sf_write_int(out_file, buffer, SYMBOL_LEN);
-                assert(items_written == SYMBOL_LEN);
+                spsc_consume_end(&ctx->symbols);
+                spsc_produce_end(&ctx->samples, len * sizeof (int));
         }
+        spsc_close(&ctx->samples);
+
+        return NULL;
+}
+
+/**
+ * \brief Modulate the rest of the input in a three stage pipeline.
+ *
+ * Parse and synth stages run in their own threads, the calling thread
+ * writes. Stages are connected by lock-free rings of PIPE_SLOTS batches,
+ * so a slow stage stalls the previous ones.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int modulate_pipeline(mod_worker_t *worker, qpsk_mod_t *mod,
+                wav_map_t *out_map, int out_fd, size_t *samples)
+{
+        pipe_ctx_t ctx = {
+                .worker = worker,
+                .mod = mod,
+        };
+        stats_t parse_stats, synth_stats;
+        pthread_t parser, synth;
+        int *buffer;
+        size_t len;
+        int ret = 0;
+
 
-        /* Modulate and write input data file. */
-        for (int sym1 = fgetc(in_file), sym2 = fgetc(in_file);
-                        (sym1 == '0' || sym1 == '1') &&
-                        (sym2 == '0' || sym2 == '1');
-                        sym1 = fgetc(in_file), sym2 = fgetc(in_file))
+        memset(&parse_stats, 0, sizeof (parse_stats));
+        memset(&synth_stats, 0, sizeof (synth_stats));
+        if (worker->stats != NULL) {
+                ctx.parse_stats = &parse_stats;
+                ctx.synth_stats = &synth_stats;
+        }
+        if (spsc_init(&ctx.symbols, PIPE_SLOTS, BATCH_SYMBOLS) != 0) {
+                perror("malloc");
+                return -1;
+        }
+        if (spsc_init(&ctx.samples, PIPE_SLOTS, BATCH_SYMBOLS *
+                                worker->params->symbol_len * sizeof (int)) !=
+                        0)
         {
-                mod_symbols(sym1, sym2, &time, buffer);
+                perror("malloc");
+                ret = -1;
+                goto free_symbols_lab;
+        }
 
-                items_written = sf_write_int(out_file, buffer, SYMBOL_LEN);
-                assert(items_written == SYMBOL_LEN);
+        if (pthread_create(&parser, NULL, pipe_parser, &ctx) != 0) {
+                fprintf(stderr, "error: thread creation failed\n");
+                ret = -1;
+                goto free_samples_lab;
         }
+        if (pthread_create(&synth, NULL, pipe_synth, &ctx) != 0) {
+                fprintf(stderr, "error: thread creation failed\n");
+                spsc_abort(&ctx.symbols);
+                pthread_join(parser, NULL);
+                ret = -1;
+                goto free_samples_lab;
+        }
+
+        /* Write stage. */
+        while ((buffer = spsc_consume_begin(&ctx.samples, &len)) != NULL) {
+                const double start = stats_start(worker->stats);
 
+                len /= sizeof (int);
+                ret = write_samples(&worker->out_info, out_map, out_fd,
+                                *samples, buffer, len);
+                stats_stop(worker->stats, STATS_WRITE, start);
+                spsc_consume_end(&ctx.samples);
+                if (ret != 0) {
+                        spsc_abort(&ctx.samples);
+                        break;
+                }
+                *samples += len;
+        }
+
+        pthread_join(synth, NULL);
+        pthread_join(parser, NULL);
+        if (ctx.error) {
+                ret = -1;
+        }
+        if (worker->stats != NULL) {
+                stats_merge(worker->stats, &parse_stats);
+                stats_merge(worker->stats, &synth_stats);
+        }
 
-        /* Close input and output filess. */
-        ret = sf_close(out_file);
+
+free_samples_lab:
+        spsc_free(&ctx.samples);
+free_symbols_lab:
+        spsc_free(&ctx.symbols);
+
+        return ret;
+}
+
+/**
+ * \brief Modulate the whole input and write it to out_map or out_fd.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int modulate(mod_worker_t *worker, wav_map_t *out_map, int out_fd,
+                size_t *samples)
+{
+        const size_t symbol_len = worker->params->symbol_len;
+        unsigned char symbols[BATCH_SYMBOLS]; //parsed phase shift indices
+        ssize_t count = 0; //parsed symbols in the batch
+        qpsk_mod_t mod; //modulator context
+        stats_t *stats = worker->stats;
+        int *buffer; //worker's buffer or place in the mapped output
+        size_t len;
+        double start;
+        int ret;
+
+
+        qpsk_mod_init(&mod, worker->carrier, symbol_len);
+        qpsk_mod_configure(&mod, worker->params);
+        *samples = 0;
+        ret = 0;
+
+        /* Modulate and write synchronization sequence (frames carry their
+         * own). */
+        if (worker->frame == NULL) {
+                start = stats_start(stats);
+                buffer = samples_buffer(out_map, 0, symbol_len *
+                                qpsk_sync_symbols(worker->params->sync_seq),
+                                worker->buffer);
+                if (buffer == NULL) {
+                        return -1;
+                }
+                len = qpsk_mod_sync(&mod, buffer);
+                stats_stop(stats, STATS_SYNC, start);
+
+                start = stats_start(stats);
+                ret = write_samples(&worker->out_info, out_map, out_fd, 0,
+                                buffer, len);
+                stats_stop(stats, STATS_WRITE, start);
+                *samples = len;
+        }
+        if (worker->pipeline && ret == 0) {
+                return modulate_pipeline(worker, &mod, out_map, out_fd,
+                                samples);
+        }
+
+        /* Modulate and write input data file in batches. */
+        while (ret == 0) {
+                start = stats_start(stats);
+                count = read_framed(worker, symbols, BATCH_SYMBOLS);
+                stats_stop(stats, STATS_READ, start);
+                if (count <= 0) {
+                        break;
+                }
+
+                start = stats_start(stats);
+                buffer = samples_buffer(out_map, *samples,
+                                count * symbol_len, worker->buffer);
+                if (buffer == NULL) {
+                        ret = -1;
+                        break;
+                }
+                len = qpsk_mod_process(&mod, symbols, count, buffer);
+                stats_stop(stats, STATS_DSP, start);
+
+                start = stats_start(stats);
+                ret = write_samples(&worker->out_info, out_map, out_fd,
+                                *samples, buffer, len);
+                stats_stop(stats, STATS_WRITE, start);
+                *samples += len;
+                if (stats != NULL) {
+                        stats->symbols += count;
+                }
+        }
+        if (count == -1) {
+                ret = -1;
+        }
+
+        return ret;
+}
+
+/**
+ * \brief Write the seek index of the output file of samples samples.
+ *
+ * Sidecar file name is the output file name with the extension replaced.
+ *
+ * \return 0 on success, -1 on error (message is printed).
+ */
+static int write_index(const qpsk_params_t *params, const char *out_file_name,
+                size_t samples)
+{
+        char *index_name = strdup(out_file_name);
+        seek_index_t index;
+        int ret = -1;
+
+
+        if (index_name == NULL) {
+                perror("strdup");
+                return -1;
+        }
+        strcpy(index_name + strlen(index_name) - 3, "idx");
+
+        if (seek_index_layout(&index, params, 0, samples) != 0) {
+                perror("malloc");
+                goto free_lab;
+        }
+        ret = seek_index_save(&index, index_name);
         if (ret != 0) {
-                fprintf(stderr, "%s\n", sf_error_number(ret));
+                perror(index_name);
+                unlink(index_name); //incomplete
         }
+        seek_index_free(&index);
+
+
+free_lab:
+        free(index_name);
+
+        return ret;
+}
+
+/**
+ * \brief Modulate one input file ("-" for stdin to stdout stream).
+ *
+ * Output file name is the input file name with the extension replaced. Output
+ * of a failed run (e.g. bad input) is removed, so no bogus file is left.
+ *
+ * \return 0 on success, -1 on error (message is printed).
+ */
+static int mod_file(batch_item_t *item, void *worker_data)
+{
+        mod_worker_t *worker = worker_data;
+        const char *file_name = item->file_name;
+        const size_t file_name_len = strlen(file_name);
+        const int stream = (strcmp(file_name, "-") == 0);
+        FILE *in_file; //input text file with zeroes '0' and ones '1' or binary
+        char *out_file_name;
+        wav_map_t out_map; //output WAW file
+        int ret = -1;
+
+
+        if (!stream && (file_name_len < 3 ||
+                                strcmp(file_name + (file_name_len - 3),
+                                        (worker->in_format == BITS_PACKED) ?
+                                        "bin" : "txt") != 0))
+        {
+                fprintf(stderr, "error: bad input file name\n");
+                return -1;
+        }
+
+        in_file = stream ? stdin : fopen(file_name, "r");
+        if (in_file == NULL) {
+                perror(file_name);
+                return -1;
+        }
+        bits_reader_reset(&worker->reader, in_file);
+        worker->frame_len = worker->frame_pos = worker->frame_seq = 0;
+
+        if (stream) { //header of unknown length, samples follow
+                if (!worker->raw && wav_write_stream_header(STDOUT_FILENO,
+                                        &worker->out_info) != 0)
+                {
+                        perror("error: output");
+                        return -1;
+                }
+
+                if (worker->index) {
+                        fprintf(stderr, "warning: stream output has no "
+                                        "index\n");
+                }
+                ret = modulate(worker, NULL, STDOUT_FILENO, &item->samples);
+                goto stats_lab; //stdin is not closed
+        }
+
+        out_file_name = strdup(file_name);
+        if (out_file_name == NULL) {
+                perror("strdup");
+                goto close_lab;
+        }
+        strcpy(out_file_name + file_name_len - 3, worker->raw ? "raw" : "wav");
+
+        if (worker->threads > 1) {
+                ret = mod_parallel(worker, out_file_name, &worker->out_info,
+                                &item->samples);
+                goto index_lab;
+        }
+
+        /* Output grows in the mapping, its size is unknown in advance. */
+        if (wav_map_create(&out_map, out_file_name, &worker->out_info, 0) !=
+                        0)
+        {
+                perror(out_file_name);
+                goto free_lab;
+        }
+        ret = modulate(worker, &out_map, -1, &item->samples);
+
+        if (wav_map_close(&out_map) != 0) {
+                perror(out_file_name);
+                ret = -1;
+        }
+        if (ret != 0) {
+                unlink(out_file_name);
+        }
+
+index_lab:
+        if (ret == 0 && worker->index &&
+                        write_index(worker->params, out_file_name,
+                                item->samples) != 0)
+        {
+                unlink(out_file_name);
+                ret = -1;
+        }
+
+
+free_lab:
+        free(out_file_name);
+close_lab:
         fclose(in_file);
+stats_lab:
+        if (worker->stats != NULL) {
+                worker->stats->files++;
+                worker->stats->samples += item->samples;
+        }
+
+        return ret;
+}
+
+/**
+ * \brief Parameters as the "qpsk" chunk of the output header.
+ *
+ * \return Size of the chunk, 0 if it doesn't fit.
+ */
+static size_t params_chunk(const qpsk_params_t *params,
+                unsigned char chunk[PARAMS_CHUNK_MAX])
+{
+        char text[PARAMS_CHUNK_MAX - 8 - 1]; //chunk head and padding
+        const int len = qpsk_params_format(params, text, sizeof (text));
+
+
+        if (len < 0 || (size_t)len >= sizeof (text)) {
+                return 0;
+        }
+
+        return wav_chunk(chunk, QPSK_PARAMS_CHUNK, text, len);
+}
+
+static int mod_worker_init(mod_worker_t *worker, const carrier_t *carrier,
+                const qpsk_params_t *params, bits_format_t in_format,
+                int raw, const sample_format_t *out_format, size_t threads,
+                int pipeline, int index, stats_t *stats)
+{
+        worker->carrier = carrier;
+        worker->params = params;
+        worker->pipeline = pipeline;
+        worker->index = index;
+        worker->stats = stats;
+        worker->in_format = in_format;
+        worker->raw = raw;
+        worker->out_info.format = out_format->format;
+        worker->out_info.channels = CHANNELS;
+        worker->out_info.sample_rate = params->sample_rate;
+        worker->out_info.bits = out_format->bits;
+        worker->out_info.extra = worker->chunk;
+        worker->out_info.extra_size = params_chunk(params, worker->chunk);
+        worker->out_info.data_offset = raw ? 0 :
+                wav_header_size(&worker->out_info);
+        worker->threads = threads;
+        worker->frame = NULL;
+        worker->buffer = malloc(BATCH_SYMBOLS * params->symbol_len *
+                        sizeof (*worker->buffer));
+        if (worker->buffer == NULL) {
+                return -1;
+        }
+        if (params->frame != 0) { //sync sequence leads every frame
+                worker->frame = malloc(frame_symbols(
+                                        qpsk_sync_symbols(params->sync_seq),
+                                        params->frame));
+                if (worker->frame == NULL) {
+                        free(worker->buffer);
+                        return -1;
+                }
+                sync_symbols(params->sync_seq, worker->frame);
+        }
+        if (bits_reader_init(&worker->reader, NULL, in_format) != 0) {
+                free(worker->frame);
+                free(worker->buffer);
+                return -1;
+        }
+        bits_reader_width(&worker->reader,
+                        constellation_get(params->constellation)->bits);
+
+        return 0;
+}
+
+static void mod_worker_free(mod_worker_t *worker)
+{
+        bits_reader_free(&worker->reader);
+        free(worker->frame);
+        free(worker->buffer);
+}
+
+/**
+ * \brief Modulate all the files on a thread pool, print report to stdout.
+ *
+ * \return 0 if all files succeeded, -1 otherwise.
+ */
+static int mod_batch(char **names, size_t count, size_t threads,
+                const carrier_t *carrier, const qpsk_params_t *params,
+                bits_format_t in_format, int raw,
+                const sample_format_t *out_format, int pipeline, int index,
+                stats_t *stats)
+{
+        batch_item_t *items = calloc(count, sizeof (*items));
+        mod_worker_t *workers;
+        stats_t *worker_stats = NULL; //merged into stats at the end
+        size_t ready = 0; //initialized workers
+        size_t failed = count;
+        double start;
+
+
+        if (threads > count) { //no use for idle workers
+                threads = (count == 0) ? 1 : count;
+        }
+        workers = calloc(threads, sizeof (*workers));
+        if (stats != NULL) {
+                worker_stats = calloc(threads, sizeof (*worker_stats));
+        }
+        if (items == NULL || workers == NULL ||
+                        (stats != NULL && worker_stats == NULL))
+        {
+                perror("malloc");
+                goto free_lab;
+        }
+        for (size_t i = 0; i < count; ++i) {
+                if (strcmp(names[i], "-") == 0) {
+                        fprintf(stderr, "error: stream can't be batched\n");
+                        goto free_lab;
+                }
+                items[i].file_name = names[i];
+        }
+        for (; ready < threads; ++ready) {
+                if (mod_worker_init(&workers[ready], carrier, params,
+                                        in_format, raw, out_format, 1,
+                                        pipeline, index,
+                                        (stats == NULL) ? NULL :
+                                        &worker_stats[ready]) != 0)
+                {
+                        perror("malloc");
+                        goto free_lab;
+                }
+        }
+
+        start = batch_time();
+        failed = batch_run(items, count, threads, mod_file, workers,
+                        sizeof (*workers));
+        batch_report(stdout, items, count, batch_time() - start);
+
+
+free_lab:
+        for (size_t i = 0; i < ready; ++i) {
+                if (stats != NULL) {
+                        stats_merge(stats, &worker_stats[i]);
+                }
+                mod_worker_free(&workers[i]);
+        }
+        free(worker_stats);
+        free(workers);
+        free(items);
+
+        return (failed == 0) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+        size_t threads = 1; //modulation threads
+        bits_format_t in_format = BITS_TEXT; //input bit stream format
+        int raw = 0; //write headerless samples
+        const sample_format_t *out_format = &sample_formats[3]; //pcm32
+        int pipeline = 0; //parse, synthesize and write in three threads
+        int index = 0; //write seek index sidecars
+        const char *manifest = NULL; //file with input file names
+        char **names; //batch of input files
+        size_t count; //number of input files
+        int stats_on = 0; //collect statistics, 2 with hardware counters
+        stats_t stats; //statistics summary
+        qpsk_params_t params; //modem parameters
+        const constellation_t *constellation;
+        const char *bad_params;
+        char *endptr;
+        int ret;
+
+        carrier_t carrier; //precomputed carrier tables
+        mod_worker_t worker; //single file modulation
+
+
+        /* Options parsing. */
+        qpsk_params_default(&params);
+        while ((ret = getopt_long(argc, argv, "bf:ij:l:pr", long_options,
+                                        NULL)) != -1)
+        {
+                switch (ret) {
+                case 'b': //packed binary input
+                        in_format = BITS_PACKED;
+                        break;
+
+                case 'f': //output sample format
+                        for (out_format = sample_formats;
+                                        out_format->name != NULL &&
+                                        strcmp(out_format->name, optarg) != 0;
+                                        ++out_format)
+                                ;
+                        if (out_format->name == NULL) {
+                                fprintf(stderr, "error: bad sample format "
+                                                "(pcm8, pcm16, pcm24, pcm32 "
+                                                "or float)\n");
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                case 'i': //seek index sidecar of every output
+                        index = 1;
+                        break;
+
+                case 'j': //number of threads, 0 for all CPUs
+                        threads = strtoul(optarg, &endptr, 10);
+                        if (*optarg == '\0' || *endptr != '\0') {
+                                fprintf(stderr, "error: bad thread count\n");
+                                return EXIT_FAILURE;
+                        } else if (threads == 0) {
+                                threads = get_nprocs();
+                        }
+                        break;
+
+                case 'l': //batch mode, manifest with one file name per line
+                        manifest = optarg;
+                        break;
+
+                case 'p': //pipelined parse, synthesis and write
+                        pipeline = 1;
+                        break;
+
+                case 'r': //raw output, no WAV header
+                        raw = 1;
+                        break;
+
+                case 'R': //--rate, sample rate [Hz]
+                        if (parse_ulong(optarg, &params.sample_rate) != 0) {
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                case 'F': //--freq, carrier frequency [Hz]
+                        if (parse_ulong(optarg, &params.freq) != 0) {
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                case 'L': //--symbol-len, samples per symbol
+                        if (parse_size(optarg, &params.symbol_len) != 0) {
+                                return EXIT_FAILURE;
+                        } else if (params.symbol_len == 0) {
+                                fprintf(stderr, "error: bad symbol length\n");
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                case 's': //--sync, sequence of bit pairs
+                        if (strlen(optarg) >= sizeof (params.sync_seq)) {
+                                fprintf(stderr, "error: sync sequence too "
+                                                "long\n");
+                                return EXIT_FAILURE;
+                        }
+                        strcpy(params.sync_seq, optarg);
+                        break;
+
+                case 'M': //--frame, payload symbols per frame
+                        if (parse_size(optarg, &params.frame) != 0) {
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                case 'C': //--constellation, of the payload symbols
+                        constellation = constellation_find(optarg);
+                        if (constellation == NULL) {
+                                fprintf(stderr, "error: bad constellation "
+                                                "(qpsk, 8psk or 16qam)\n");
+                                return EXIT_FAILURE;
+                        }
+                        params.constellation = constellation->id;
+                        break;
+
+                case 'S': //--stats[=hw], JSON summary to stderr
+                        if (optarg == NULL) {
+                                stats_on = 1;
+                        } else if (strcmp(optarg, "hw") == 0) {
+                                stats_on = 2;
+                        } else {
+                                fprintf(stderr, "error: bad stats mode "
+                                                "(hw)\n");
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                default:
+                        return EXIT_FAILURE; //getopt already printed error
+                }
+        }
+
+        if ((manifest == NULL && argc - optind < 1) ||
+                        (manifest != NULL && argc - optind != 0))
+        {
+                fprintf(stderr, "error: bad argument count\n");
+                return EXIT_FAILURE;
+        } else if ((bad_params = qpsk_params_check(&params)) != NULL) {
+                fprintf(stderr, "error: %s\n", bad_params);
+                return EXIT_FAILURE;
+        } else if (threads > 1 && manifest == NULL &&
+                        argc - optind == 1 && strcmp(argv[optind], "-") == 0)
+        { //stream symbols can't be mapped in advance
+                fprintf(stderr, "error: stream can't be modulated in "
+                                "parallel (use -p instead of -j)\n");
+                return EXIT_FAILURE;
+        }
+
+
+        if (carrier_init(&carrier, params.sample_rate, params.freq) != 0) {
+                fprintf(stderr, "error: carrier tables allocation failed\n");
+                return EXIT_FAILURE;
+        }
+        if (stats_on) {
+                stats_init(&stats, stats_on == 2);
+        }
+
+        if (manifest != NULL || argc - optind > 1) {
+                /* Batch mode, threads process whole files. */
+                if (manifest != NULL) {
+                        names = batch_manifest_read(manifest, &count);
+                        if (names == NULL) {
+                                return EXIT_FAILURE;
+                        }
+                } else {
+                        names = argv + optind;
+                        count = argc - optind;
+                }
+
+                ret = mod_batch(names, count, threads, &carrier, &params,
+                                in_format, raw, out_format, pipeline, index,
+                                stats_on ? &stats : NULL);
+                if (manifest != NULL) {
+                        batch_manifest_free(names, count);
+                }
+        } else {
+                batch_item_t item = { .file_name = argv[optind] };
+
+                if (mod_worker_init(&worker, &carrier, &params, in_format,
+                                        raw, out_format, threads, pipeline,
+                                        index, stats_on ? &stats : NULL)
+                                != 0)
+                {
+                        perror("malloc");
+                        return EXIT_FAILURE;
+                }
+                ret = mod_file(&item, &worker);
+                mod_worker_free(&worker);
+        }
+        if (stats_on) {
+                stats_print(&stats, stderr);
+        }
+        carrier_free(&carrier);
 
 
-        return EXIT_SUCCESS;
+        return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -5,264 +5,1998 @@
  * \date 2015
  */
 
+#define _GNU_SOURCE //O_DIRECT
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
-#include <assert.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h> //get_nprocs
 
 #include "sndfile.h"
+#include "carrier.h"
+#include "qpsk.h"
+#include "frame.h"
+#include "constellation.h"
+#include "seek.h"
+#include "bits.h"
+#include "wav.h"
+#include "uring.h"
+#include "batch.h"
+#include "stats.h"
+#include "spsc.h"
 
 
-#define AMPLITUDE 0x7F000000u
-#define FREQ 1000 //frequency [Hz]
-#define THRESHOLD 0.1 //god knows why this number
+#define RAW_FORMAT (SF_FORMAT_RAW | SF_FORMAT_PCM_32) //headerless input
 
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE (1 << 16) //samples read at once
+#define CHUNK_SYMBOLS (1 << 16) //symbols decoded by one parallel task
+#define CHUNK_SLOTS 2 //decoded chunks waiting for writing, per thread
+#define FRAME_SLACK 2 //symbols around the nominal frame start searched
+#define PIPE_SLOTS 8 //blocks in flight between two pipeline stages
+#define URING_BLOCK (1 << 20) //bytes of one io_uring read
+#define URING_DEPTH 8 //io_uring reads in flight
+#define STREAM_BLOCK (1 << 20) //bytes of one stdin read
+#define PARAMS_CHUNK_MAX 256 //"qpsk" chunk with the parameters
 
+/* Parameters set on the command line, they win over the input header. */
+#define PARAM_RATE 0x1
+#define PARAM_FREQ 0x2
+#define PARAM_SYNC 0x4
+#define PARAM_THRESHOLD 0x8
+#define PARAM_FRAME 0x10
+#define PARAM_CONSTELLATION 0x20
 
-typedef enum { //syncing FSM states
-        SYNC_STATE_INIT,
-        SYNC_STATE_FIRST_00,
-        SYNC_STATE_FIRST_11,
-        SYNC_STATE_SECOND_00,
-        SYNC_STATE_SECOND_11,
-} sync_state_t;
 
+typedef enum { //state of a decoded frame
+        FRAME_OK,
+        FRAME_BAD_PAYLOAD, //payload CRC mismatch or truncated, written anyway
+        FRAME_BAD_HEADER, //header CRC mismatch, full payload written
+        FRAME_BAD_SEQ, //sequence number of another frame, written anyway
+        FRAME_LOST, //sync sequence not found, nothing written
+} frame_state_t;
+
+typedef struct { //parallel decoding context shared by all threads
+        const char *file_name; //input WAV file
+        const SF_INFO *sf_info; //input file parameters (needed for raw)
+        size_t origin; //first sample of the sync sequence in the file
+        size_t data_start; //time of the first data sample (after sync seq.)
+        size_t symbol_len; //in samples
+        size_t symbols; //complete data symbols in the file
+        size_t frame; //payload symbols per frame, 0 if not framed
+        size_t frame_len; //samples per frame
+        size_t chunks; //number of CHUNK_SYMBOLS tasks (or frames)
+        const carrier_t *carrier;
+        const qpsk_params_t *params; //of the file
+        qpsk_decision_t decision;
+        double gain; //measured on the sync sequence
+
+        pthread_mutex_t mutex; //protects everything below
+        pthread_cond_t cond; //signaled on every chunk state change
+        size_t next_chunk; //next chunk to be taken by a worker
+        size_t written; //chunks already written by the main thread
+        size_t slots; //result slots, limits memory consumption
+        size_t slot_size; //symbols of one slot
+        unsigned char **slot_symbols; //decoded symbol indices
+        size_t *slot_chunk; //chunk stored in the slot, SIZE_MAX if none
+        size_t *slot_count; //number of symbols in the slot
+        frame_state_t *slot_state; //of the frame in the slot
+        int error;
+        stats_t *stats; //summary of all threads, NULL if not collected
+        const wav_map_t *map; //mapped input shared by all, NULL if not used
+        qpsk_sample_t format; //of the mapped samples handed to the demod
+} par_ctx_t;
+
+typedef struct { //parallel decoding worker
+        par_ctx_t *ctx;
+        SNDFILE *in_file; //own file handle, NULL for the mapped input
+        pthread_t thread;
+        stats_t *stats; //own statistics, NULL if not collected
+} par_worker_t;
+
+typedef struct { //demodulation worker, resources survive across files
+        qpsk_decision_t decision; //decision engine
+        bits_format_t out_format; //output bit stream format
+        int out_flags; //output file open() flags
+        int raw; //headerless input
+        size_t threads; //decoding threads for one file
+        int pipeline; //read, decode and write in three threads
+        int uring; //native WAV reader on io_uring, libsndfile as fallback
+        size_t range_start; //first payload bit to decode
+        size_t range_len; //payload bits to decode, 0 for the whole file
+        seek_index_t index; //of the current file, for the range
+        qpsk_params_t cli; //parameters from the command line or defaults
+        unsigned cli_set; //PARAM_* set on the command line
+        qpsk_params_t params; //of the current file
+        unsigned long sample_rate; //of the carrier tables, 0 if none yet
+        unsigned long freq; //of the carrier tables
+        carrier_t carrier; //precomputed carrier tables
+        qpsk_demod_t demod; //demodulator context
+        bits_writer_t writer; //output formatter
+        int *buffer; //samples buffer, BUFFER_SIZE
+        unsigned char *symbols; //decoded symbol indices of one block
+        stats_t *stats; //NULL if not collected
+} demod_worker_t;
+
+typedef struct { //input samples: mapped WAV, WAV read natively or libsndfile
+        const char *file_name;
+        SNDFILE *sf; //libsndfile handle, NULL for the native readers
+        wav_map_t map; //mapped input, map.map is NULL if not used
+        size_t pos; //next frame of the mapped input
+        int fd; //native reader input file, -1 if not used
+        wav_info_t wav; //native reader sample format
+        qpsk_sample_t format; //of the samples returned by input_read()
+        uring_reader_t uring;
+        unsigned char *block; //stdin block, STREAM_BLOCK, NULL if not used
+        const unsigned char *data; //unconverted part of the current block
+        size_t len; //bytes
+        int error; //native read failed
+        char chunk[PARAMS_CHUNK_MAX]; //"qpsk" chunk of the stdin header
+        size_t chunk_len; //SIZE_MAX if there is none
+} input_t;
+
+typedef struct { //pipelined demodulation of one file
+        input_t *input;
+        qpsk_demod_t *demod; //synchronized, owned by the DSP stage
+        spsc_t samples; //reader -> DSP, BUFFER_SIZE samples per slot
+        spsc_t symbols; //DSP -> writer, BUFFER_SIZE symbols per slot
+        size_t items; //samples read
+        stats_t *read_stats; //of the reader stage, NULL if not collected
+        stats_t *dsp_stats; //of the DSP stage, NULL if not collected
+} pipe_ctx_t;
 
-static const double phase_shift[4] = {
-        1.0 / 4.0 * M_PI, //00 -> 45 degrees
-        7.0 / 4.0 * M_PI, //01 -> 315 degrees
-        3.0 / 4.0 * M_PI, //10 -> 135 degrees
-        5.0 / 4.0 * M_PI, //11 -> 225 degrees
-};
 
-static const char *res_sym[4] = {
-        "00", //00 -> 45 degrees
-        "01", //01 -> 315 degrees
-        "10", //10 -> 135 degrees
-        "11", //11 -> 225 degrees
+static const struct option long_options[] = {
+        { "stats", optional_argument, NULL, 'S' },
+        { "rate", required_argument, NULL, 'R' },
+        { "freq", required_argument, NULL, 'F' },
+        { "sync", required_argument, NULL, 's' },
+        { "threshold", required_argument, NULL, 'T' },
+        { "frame", required_argument, NULL, 'M' },
+        { "range", required_argument, NULL, 'G' },
+        { "constellation", required_argument, NULL, 'C' },
+        { NULL, 0, NULL, 0 },
 };
 
 
-static int sync(double key, size_t *symbol_len, size_t time, double norm_freq)
+static int parse_ulong(const char *str, unsigned long *val)
+{
+        char *endptr;
+
+
+        *val = strtoul(str, &endptr, 10);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
+        }
+
+        return 0;
+}
+
+static int parse_size(const char *str, size_t *val)
+{
+        char *endptr;
+
+
+        *val = strtoull(str, &endptr, 10);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
+        }
+
+        return 0;
+}
+
+static int parse_double(const char *str, double *val)
+{
+        char *endptr;
+
+
+        *val = strtod(str, &endptr);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* "start:len" in payload bits, whole symbols of the file's constellation
+ * are checked by demod_file(). */
+static int parse_range(const char *str, size_t *start, size_t *len)
+{
+        char *endptr;
+
+
+        *start = strtoull(str, &endptr, 10);
+        if (endptr == str || *endptr != ':') {
+                goto bad_lab;
+        }
+        str = endptr + 1;
+        *len = strtoull(str, &endptr, 10);
+        if (*str == '\0' || *endptr != '\0' || *len == 0) {
+                goto bad_lab;
+        }
+
+        return 0;
+
+
+bad_lab:
+        fprintf(stderr, "error: bad range (start:len)\n");
+        return -1;
+}
+
+/**
+ * \brief Decode remaining samples starting at the file frame.
+ *
+ * Samples are read independently using the worker's own file handle (or
+ * straight from the mapped input).
+ *
+ * \return Number of decoded symbols, -1 on read or allocation error.
+ */
+static ssize_t par_decode_range(par_worker_t *worker, qpsk_demod_t *demod,
+                size_t frame, size_t remaining, int *buffer,
+                unsigned char *symbols)
 {
-        static sync_state_t sync_state = SYNC_STATE_INIT;
-        static size_t rem_items;
-
-        const double res = key / AMPLITUDE; //received cosinus value
-        double ref; //reference cosinus value
-
-
-        switch (sync_state) {
-        /* First sample always has to conform to "00" phase shift. */
-        case SYNC_STATE_INIT:
-                ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[0]);
-                if (fabs(ref - res) < THRESHOLD) { //found first "00"
-                        (*symbol_len)++;
-                        sync_state = SYNC_STATE_FIRST_00;
-                } else { //found nothing or  some other symbol
-                        fprintf(stderr, "error: bad initialization sequence\n");
+        const par_ctx_t *ctx = worker->ctx;
+        size_t count = 0;
+
+
+        if (ctx->map == NULL &&
+                        sf_seek(worker->in_file, frame, SEEK_SET) == -1)
+        {
+                return -1;
+        }
+
+        for (size_t done = 0; remaining > 0; done += BUFFER_SIZE) {
+                const size_t want = (remaining < BUFFER_SIZE) ?
+                        remaining : BUFFER_SIZE;
+                const void *samples = buffer;
+                double start = stats_start(worker->stats);
+                ssize_t ret;
+
+                if (ctx->format != QPSK_S32) { //narrow, used in place
+                        samples = wav_map_frame(ctx->map, frame + done);
+                } else if (ctx->map != NULL) {
+                        samples = wav_map_read(ctx->map, frame + done, want,
+                                        buffer);
+                } else if (sf_read_int(worker->in_file, buffer, want) !=
+                                (sf_count_t)want)
+                {
                         return -1;
                 }
-                break;
+                stats_stop(worker->stats, STATS_READ, start);
 
-        /* We can read another "00" sample or first "01" sample. */
-        case SYNC_STATE_FIRST_00:
-                ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[0]);
-                if (fabs(ref - res) < THRESHOLD) { //found another "00"
-                        (*symbol_len)++;
-                        break; //don't change state
+                start = stats_start(worker->stats);
+                ret = qpsk_demod_decode(demod, samples, ctx->format, want,
+                                symbols + count);
+                stats_stop(worker->stats, STATS_DSP, start);
+                if (ret == -1) {
+                        return -1;
                 }
+                count += ret;
+                remaining -= want;
+        }
+
+        return count;
+}
+
+/**
+ * \brief Decode one chunk of symbols.
+ *
+ * Position of every symbol after the sync sequence is known, so the chunk is
+ * decoded independently of the others.
+ *
+ * \return 0 on success, -1 on read error.
+ */
+static int par_decode_chunk(par_worker_t *worker, qpsk_demod_t *demod,
+                size_t chunk, int *buffer, unsigned char *symbols,
+                size_t *count)
+{
+        const par_ctx_t *ctx = worker->ctx;
+        const size_t first = chunk * CHUNK_SYMBOLS; //first symbol of chunk
+        const size_t chunk_symbols = (ctx->symbols - first < CHUNK_SYMBOLS) ?
+                ctx->symbols - first : CHUNK_SYMBOLS;
+        const size_t time = ctx->data_start + first * ctx->symbol_len;
+        ssize_t ret;
+
+
+        qpsk_demod_start(demod, ctx->symbol_len, time);
+        ret = par_decode_range(worker, demod, ctx->origin + time,
+                        chunk_symbols * ctx->symbol_len, buffer, symbols);
+        *count = (ret == -1) ? 0 : ret;
+
+        return (ret == -1) ? -1 : 0;
+}
+
+/**
+ * \brief Decode one frame, its payload is stored to symbols.
+ *
+ * Frame starts at a known position (origin + frame_len * index), its own
+ * sync sequence is searched for up to FRAME_SLACK symbols around it, so
+ * a few lost or extra samples are tolerated. Header and payload are checked
+ * by their CRCs, see frame_state_t.
+ *
+ * \return 0 on success, -1 on read or allocation error.
+ */
+static int par_decode_frame(par_worker_t *worker, qpsk_demod_t *demod,
+                size_t chunk, int *buffer, unsigned char *symbols,
+                size_t *count, frame_state_t *state)
+{
+        const par_ctx_t *ctx = worker->ctx;
+        const size_t frames = ctx->sf_info->frames;
+        const size_t slack = FRAME_SLACK * ctx->symbol_len;
+        const size_t nominal = ctx->origin + chunk * ctx->frame_len;
+        const size_t first = (nominal > slack) ? nominal - slack : 0;
+        const size_t data = FRAME_HEADER_SYMBOLS + ctx->frame; //after sync
+        /* Search is over two sync sequence lengths after the last offset. */
+        size_t last = nominal + slack + 2 * ctx->data_start;
+        size_t lock, end;
+        frame_header_t header;
+        ssize_t ret;
+        size_t len;
 
-                ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[3]);
-                if (fabs(ref - res) < THRESHOLD) { //found "11"
-                        sync_state = SYNC_STATE_FIRST_11;
-                        rem_items = *symbol_len - 1;
-                } else { //found nothing or "01" or "10"
-                        fprintf(stderr, "error: bad initialization sequence\n");
+
+        *count = 0;
+        *state = FRAME_LOST;
+        if (last > frames) {
+                last = frames;
+        }
+
+        qpsk_demod_resync(demod);
+        ret = par_decode_range(worker, demod, first, last - first, buffer,
+                        symbols);
+        if (ret == -1) {
+                return -1;
+        } else if (!qpsk_demod_synced(demod) &&
+                        qpsk_demod_flush(demod, symbols, 0) == -1)
+        {
+                return 0;
+        }
+        lock = first + demod->origin;
+        if (lock + slack < nominal || lock > nominal + slack) {
+                return 0; //another frame or a false match
+        }
+        len = ret;
+
+        /* Rest of the frame, then the samples still buffered by the
+         * search. */
+        end = lock + ctx->frame_len;
+        if (end > frames) {
+                end = frames;
+        }
+        if (end > last) {
+                ret = par_decode_range(worker, demod, last, end - last,
+                                buffer, symbols + len);
+                if (ret == -1) {
                         return -1;
                 }
-                break;
-
-        /* Now we know, how long (in samples) one symbol should be. */
-        /* We can read another "01" sample or first "00" sample. */
-        case SYNC_STATE_FIRST_11:
-                if (rem_items == 0) { //expecting first "00" sample
-                        sync_state = SYNC_STATE_SECOND_00; //switch state
-                        rem_items = *symbol_len;
-                        //pass through to the next state
-                } else { //expecting another "01" sample
-                        ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[3]);
-                        if (fabs(ref - res) < THRESHOLD) { //found "11"
-                                rem_items--;
-                                break;
-                        } else { //found nothing or some other symbol
-                                fprintf(stderr, "error: bad initialization sequence\n");
-                                return -1;
+                len += ret;
+        }
+        while (len < data && (ret = qpsk_demod_flush(demod, symbols + len,
+                                        data - len)) > 0)
+        {
+                len += ret;
+        }
+        if (len > data) {
+                len = data;
+        }
+        if (len < FRAME_HEADER_SYMBOLS) {
+                return 0;
+        }
+        len -= FRAME_HEADER_SYMBOLS;
+
+        *state = FRAME_OK;
+        if (frame_header_unpack(&header, symbols) != 0 ||
+                        header.len > ctx->frame)
+        {
+                *state = FRAME_BAD_HEADER; //all the decoded payload
+        } else if (header.len > len) {
+                *state = FRAME_BAD_PAYLOAD; //truncated
+        } else {
+                len = header.len;
+                if (frame_crc(symbols + FRAME_HEADER_SYMBOLS, len) !=
+                                header.crc)
+                {
+                        *state = FRAME_BAD_PAYLOAD;
+                } else if (header.seq != (chunk & FRAME_SEQ_MASK)) {
+                        *state = FRAME_BAD_SEQ;
+                }
+        }
+        memmove(symbols, symbols + FRAME_HEADER_SYMBOLS, len);
+        *count = len;
+
+        return 0;
+}
+
+/**
+ * \brief Report a damaged frame to stderr.
+ */
+static void frame_report(const par_ctx_t *ctx, size_t chunk,
+                frame_state_t state)
+{
+        static const char *const reasons[] = {
+                [FRAME_BAD_PAYLOAD] = "payload CRC mismatch",
+                [FRAME_BAD_HEADER] = "header CRC mismatch",
+                [FRAME_BAD_SEQ] = "wrong sequence number",
+                [FRAME_LOST] = "sync sequence not found, frame skipped",
+        };
+
+
+        if (state != FRAME_OK) {
+                fprintf(stderr, "warning: %s: frame %zu: %s\n",
+                                ctx->file_name, chunk, reasons[state]);
+        }
+}
+
+/**
+ * \brief Number of frames following the origin.
+ *
+ * Trailing samples too short for a sync sequence and a header are not
+ * a frame.
+ */
+static size_t frame_count(const par_ctx_t *ctx)
+{
+        const size_t rest = ctx->sf_info->frames - ctx->origin;
+        const size_t head = ctx->data_start +
+                FRAME_HEADER_SYMBOLS * ctx->symbol_len;
+
+
+        return rest / ctx->frame_len + (rest % ctx->frame_len >= head);
+}
+
+/**
+ * \brief Worker thread, takes chunks in order and decodes them into slots.
+ */
+static void * par_worker(void *arg)
+{
+        par_worker_t *worker = arg;
+        par_ctx_t *ctx = worker->ctx;
+        int *buffer = malloc(BUFFER_SIZE * sizeof (*buffer));
+        qpsk_demod_t demod;
+        const int demod_ret = qpsk_demod_init(&demod, ctx->carrier,
+                        ctx->decision);
+
+
+        qpsk_demod_configure(&demod, ctx->params);
+        demod.gain = ctx->gain; //chunks have no sync sequence of their own
+        pthread_mutex_lock(&ctx->mutex);
+        if (buffer == NULL || demod_ret != 0) {
+                ctx->error = 1;
+        }
+
+        while (!ctx->error && ctx->next_chunk < ctx->chunks) {
+                const size_t chunk = ctx->next_chunk++;
+                const size_t slot = chunk % ctx->slots;
+                frame_state_t state = FRAME_OK;
+                size_t count;
+                int ret;
+
+                /* Wait until the slot is written out by the main thread. */
+                while (!ctx->error && chunk >= ctx->written + ctx->slots) {
+                        pthread_cond_wait(&ctx->cond, &ctx->mutex);
+                }
+                if (ctx->error) {
+                        break;
+                }
+
+                pthread_mutex_unlock(&ctx->mutex);
+                if (ctx->frame != 0) {
+                        ret = par_decode_frame(worker, &demod, chunk, buffer,
+                                        ctx->slot_symbols[slot], &count,
+                                        &state);
+                } else {
+                        ret = par_decode_chunk(worker, &demod, chunk, buffer,
+                                        ctx->slot_symbols[slot], &count);
+                }
+                pthread_mutex_lock(&ctx->mutex);
+
+                if (ret != 0) {
+                        ctx->error = 1;
+                } else {
+                        ctx->slot_chunk[slot] = chunk;
+                        ctx->slot_count[slot] = count;
+                        ctx->slot_state[slot] = state;
+                }
+                pthread_cond_broadcast(&ctx->cond);
+        }
+        if (ctx->stats != NULL) {
+                worker->stats->symbols += demod.symbols;
+                worker->stats->ties += demod.ties;
+                worker->stats->low_margin += demod.low_margin;
+                stats_merge(ctx->stats, worker->stats);
+        }
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->mutex);
+
+        qpsk_demod_free(&demod);
+        free(buffer);
+
+        return NULL;
+}
+
+/**
+ * \brief Decode all data symbols using multiple threads.
+ *
+ * The file is split into chunks of CHUNK_SYMBOLS symbols (or into frames),
+ * workers decode them using their own file handles and the calling thread
+ * writes the results in the original order. Damaged frames are reported and
+ * skipped or written as decoded.
+ *
+ * \return 0 on success, -1 on error.
+ */
+static int decode_parallel(par_ctx_t *ctx, size_t threads,
+                bits_writer_t *writer)
+{
+        par_worker_t *workers = calloc(threads, sizeof (*workers));
+        stats_t *worker_stats = NULL; //merged into ctx->stats by workers
+        stats_t write_stats; //of the calling thread
+        size_t started = 0;
+        int ret = 0;
+
+
+        memset(&write_stats, 0, sizeof (write_stats));
+        if (ctx->frame != 0) { //payload and header, sync may reach further
+                ctx->chunks = frame_count(ctx);
+                ctx->slot_size = FRAME_HEADER_SYMBOLS + ctx->frame +
+                        ctx->data_start / ctx->symbol_len + 2 * FRAME_SLACK;
+        } else {
+                ctx->chunks = (ctx->symbols + CHUNK_SYMBOLS - 1) /
+                        CHUNK_SYMBOLS;
+                ctx->slot_size = CHUNK_SYMBOLS;
+        }
+        ctx->next_chunk = 0;
+        ctx->written = 0;
+        ctx->slots = threads * CHUNK_SLOTS;
+        ctx->error = 0;
+        ctx->slot_symbols = calloc(ctx->slots, sizeof (*ctx->slot_symbols));
+        ctx->slot_chunk = malloc(ctx->slots * sizeof (*ctx->slot_chunk));
+        ctx->slot_count = malloc(ctx->slots * sizeof (*ctx->slot_count));
+        ctx->slot_state = malloc(ctx->slots * sizeof (*ctx->slot_state));
+        if (ctx->stats != NULL) {
+                worker_stats = calloc(threads, sizeof (*worker_stats));
+        }
+        if (workers == NULL || ctx->slot_symbols == NULL ||
+                        ctx->slot_chunk == NULL || ctx->slot_count == NULL ||
+                        ctx->slot_state == NULL ||
+                        (ctx->stats != NULL && worker_stats == NULL))
+        {
+                perror("malloc");
+                ret = -1;
+                goto free_lab;
+        }
+        for (size_t i = 0; i < ctx->slots; ++i) {
+                ctx->slot_symbols[i] = malloc(ctx->slot_size);
+                ctx->slot_chunk[i] = SIZE_MAX;
+                if (ctx->slot_symbols[i] == NULL) {
+                        perror("malloc");
+                        ret = -1;
+                        goto free_lab;
+                }
+        }
+
+        pthread_mutex_init(&ctx->mutex, NULL);
+        pthread_cond_init(&ctx->cond, NULL);
+
+        /* Open file handles and start workers. */
+        for (; started < threads; ++started) {
+                SF_INFO sf_info = *ctx->sf_info;
+
+                workers[started].ctx = ctx;
+                workers[started].stats = (ctx->stats == NULL) ? NULL :
+                        &worker_stats[started];
+                workers[started].in_file = (ctx->map != NULL) ? NULL :
+                        sf_open(ctx->file_name, SFM_READ, &sf_info);
+                if (ctx->map == NULL && workers[started].in_file == NULL) {
+                        fprintf(stderr, "%s\n", sf_strerror(NULL));
+                        break;
+                }
+                if (pthread_create(&workers[started].thread, NULL, par_worker,
+                                        &workers[started]) != 0)
+                {
+                        fprintf(stderr, "error: thread creation failed\n");
+                        if (workers[started].in_file != NULL) {
+                                sf_close(workers[started].in_file);
                         }
+                        break;
                 }
+        }
 
-        /* We can read "00" sample or first "01" sample. */
-        case SYNC_STATE_SECOND_00:
-                if (rem_items == 0) { //expecting first "01" sample
-                        sync_state = SYNC_STATE_SECOND_11; //switch state
-                        rem_items = *symbol_len;
-                        //pass through to the next state
-                } else { //expecting another "00" sample
-                        ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[0]);
-                        if (fabs(ref - res) < THRESHOLD) { //found "00"
-                                rem_items--;
-                                break;
-                        } else { //found nothing or some other symbol
-                                fprintf(stderr, "error: bad initialization sequence\n");
+        /* Write decoded chunks in order. */
+        pthread_mutex_lock(&ctx->mutex);
+        if (started < threads) { //stop already started workers
+                ctx->error = 1;
+        }
+        for (size_t chunk = 0; chunk < ctx->chunks; ++chunk) {
+                const size_t slot = chunk % ctx->slots;
+                double start;
+
+                while (!ctx->error && ctx->slot_chunk[slot] != chunk) {
+                        pthread_cond_wait(&ctx->cond, &ctx->mutex);
+                }
+                if (ctx->error) {
+                        break;
+                }
+
+                pthread_mutex_unlock(&ctx->mutex);
+                frame_report(ctx, chunk, ctx->slot_state[slot]);
+                start = stats_start(ctx->stats);
+                if (bits_write(writer, ctx->slot_symbols[slot],
+                                        ctx->slot_count[slot]) != 0)
+                {
+                        perror("error: output");
+                        pthread_mutex_lock(&ctx->mutex);
+                        ctx->error = 1;
+                        break;
+                }
+                stats_stop(&write_stats, STATS_WRITE, start);
+                pthread_mutex_lock(&ctx->mutex);
+
+                ctx->written++;
+                pthread_cond_broadcast(&ctx->cond);
+        }
+        if (ctx->error) {
+                fprintf(stderr, "error: parallel decoding failed\n");
+                ret = -1;
+        }
+        pthread_cond_broadcast(&ctx->cond);
+        pthread_mutex_unlock(&ctx->mutex);
+
+        for (size_t i = 0; i < started; ++i) {
+                pthread_join(workers[i].thread, NULL);
+                if (workers[i].in_file != NULL) {
+                        sf_close(workers[i].in_file);
+                }
+        }
+        pthread_cond_destroy(&ctx->cond);
+        pthread_mutex_destroy(&ctx->mutex);
+        if (ctx->stats != NULL) {
+                stats_merge(ctx->stats, &write_stats);
+        }
+
+
+free_lab:
+        for (size_t i = 0; ctx->slot_symbols != NULL && i < ctx->slots; ++i) {
+                free(ctx->slot_symbols[i]);
+        }
+        free(ctx->slot_symbols);
+        free(ctx->slot_chunk);
+        free(ctx->slot_count);
+        free(ctx->slot_state);
+        free(worker_stats);
+        free(workers);
+
+        return ret;
+}
+
+
+/**
+ * \brief Sample format the native input is handed to the demodulator in.
+ *
+ * Narrow PCM is decided by the integer kernels right from the file blocks.
+ */
+static qpsk_sample_t input_format(const wav_info_t *info)
+{
+        if (!wav_native(info)) {
+                return QPSK_S32;
+        }
+
+        return (info->bits == 8) ? QPSK_U8 :
+                (info->bits == 16) ? QPSK_S16 : QPSK_S32;
+}
+
+/**
+ * \brief Open the input, native readers are tried first.
+ *
+ * Mono PCM and float WAV files are read natively: memory mapped and decoded
+ * straight from the mapping, or (with -u) streamed through io_uring with
+ * URING_DEPTH reads in flight. WAV stream on stdin is read natively too, so
+ * the "qpsk" chunk of its header is kept (a pipe can't be read twice).
+ * Anything else (raw input, exotic formats) goes through libsndfile, on
+ * stdin only if it is seekable. sf_info is filled in all cases.
+ *
+ * \return 0 on success, -1 on error (message is printed).
+ */
+static int input_open(input_t *input, const demod_worker_t *worker,
+                const char *file_name, int stream, SF_INFO *sf_info)
+{
+        struct stat st;
+
+
+        memset(input, 0, sizeof (*input));
+        input->file_name = file_name;
+        input->fd = -1;
+        input->chunk_len = SIZE_MAX;
+
+        if (stream && !worker->raw) {
+                input->chunk_len = sizeof (input->chunk);
+                if (wav_read_stream_header(STDIN_FILENO, &input->wav,
+                                        QPSK_PARAMS_CHUNK, input->chunk,
+                                        &input->chunk_len) == 0 &&
+                                wav_supported(&input->wav))
+                {
+                        input->block = malloc(STREAM_BLOCK);
+                        if (input->block == NULL) {
+                                perror("error: malloc");
                                 return -1;
                         }
+                        input->fd = STDIN_FILENO;
+                        input->format = input_format(&input->wav);
+                        sf_info->samplerate = input->wav.sample_rate;
+                        sf_info->channels = 1;
+                        sf_info->frames = SF_COUNT_MAX;
+                        sf_info->seekable = 0;
+                        return 0;
                 }
+                input->chunk_len = SIZE_MAX;
+                if (lseek(STDIN_FILENO, 0, SEEK_SET) != 0) { //header eaten
+                        fprintf(stderr, "error: stdin: not a mono PCM or "
+                                        "float WAV stream\n");
+                        return -1;
+                }
+        }
 
-        /* Last sync symbol, we have to read all the "01" samples. */
-        case SYNC_STATE_SECOND_11:
-                if (rem_items > 1) { //not all "01" samples read yet
-                        ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[3]);
-                        if (fabs(ref - res) < THRESHOLD) { //found "11"
-                                rem_items--;
-                                break;
-                        } else { //found nothing or some other symbol
-                                fprintf(stderr, "error: bad initialization sequence\n");
-                                return -1;
+        if (!stream && !worker->raw && !worker->uring &&
+                        wav_map_open(&input->map, file_name) == 0)
+        {
+                input->format = input_format(&input->map.info);
+                sf_info->samplerate = input->map.info.sample_rate;
+                sf_info->channels = 1;
+                sf_info->frames = input->map.frames;
+                sf_info->seekable = 1;
+                return 0;
+        }
+
+        if (!stream && !worker->raw && worker->uring) {
+                input->fd = open(file_name, O_RDONLY);
+                if (input->fd == -1) {
+                        perror(file_name);
+                        return -1;
+                }
+                if (wav_read_header(input->fd, &input->wav) == 0 &&
+                                wav_supported(&input->wav))
+                {
+                        const size_t width = input->wav.bits / 8;
+
+                        if (fstat(input->fd, &st) == 0 &&
+                                        (size_t)st.st_size >=
+                                        input->wav.data_offset &&
+                                        input->wav.data_size > st.st_size -
+                                        input->wav.data_offset)
+                        { //stream header, samples up to EOF
+                                input->wav.data_size = st.st_size -
+                                        input->wav.data_offset;
                         }
-                } else if (rem_items == 1) { //last "01" sample expected
-                        ref = cos(2.0 * M_PI * norm_freq * time + phase_shift[3]);
-                        if (fabs(ref - res) < THRESHOLD) { //found last "11"
-                                rem_items--;
-                                return 0; //whole synchronization sequence read
-                        } else { //found nothing or some other symbol
-                                fprintf(stderr, "error: bad initialization sequence\n");
-                                return -1;
+                        if (uring_reader_init(&input->uring, input->fd,
+                                                input->wav.data_offset,
+                                                input->wav.data_size,
+                                                URING_BLOCK / width * width,
+                                                URING_DEPTH) == 0)
+                        {
+                                input->format = input_format(&input->wav);
+                                sf_info->samplerate = input->wav.sample_rate;
+                                sf_info->channels = 1;
+                                sf_info->frames = input->wav.data_size / width;
+                                sf_info->seekable = 1;
+                                return 0;
                         }
-                } else { //rem_items == 0
-                        assert(!"NOOOOO, this is not synchronization sequence");
+                        fprintf(stderr, "warning: %s: io_uring: %s\n",
+                                        file_name, strerror(errno));
                 }
-                break;
+                close(input->fd); //libsndfile fallback
+                input->fd = -1;
+        }
+
+        if (stream) {
+                input->sf = sf_open_fd(STDIN_FILENO, SFM_READ, sf_info, 0);
+        } else {
+                input->sf = sf_open(file_name, SFM_READ, sf_info);
+        }
+        if (input->sf == NULL) {
+                fprintf(stderr, "%s\n", sf_strerror(NULL));
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * \brief Parse the "qpsk" chunk of the input header into params.
+ *
+ * Inputs without the chunk leave params untouched. Chunk of the stdin header
+ * was kept by input_open(), seekable stdin is read once more.
+ *
+ * \return 0 on success, -1 on a malformed chunk (message is printed).
+ */
+static int input_chunk(const input_t *input, int stream,
+                qpsk_params_t *params)
+{
+        int fd = (input->map.map != NULL) ? input->map.fd : input->fd;
+        const int own_fd = (fd == -1 && !stream); //open it once more
+        char text[PARAMS_CHUNK_MAX];
+        ssize_t len;
+
 
-        default:
-                assert(!"unknown sync FSM state");
+        if (input->block != NULL) {
+                if (input->chunk_len == SIZE_MAX) {
+                        return 0;
+                }
+                memcpy(text, input->chunk, input->chunk_len);
+                len = input->chunk_len;
+        } else {
+                if (stream) {
+                        fd = STDIN_FILENO; //libsndfile on seekable stdin
+                } else if (own_fd &&
+                                (fd = open(input->file_name, O_RDONLY)) == -1)
+                {
+                        return 0; //libsndfile will complain
+                }
+                len = wav_read_chunk(fd, QPSK_PARAMS_CHUNK, text,
+                                sizeof (text));
+                if (own_fd) {
+                        close(fd);
+                }
         }
 
+        if (len != -1 && qpsk_params_parse(params, text, len) != 0) {
+                fprintf(stderr, "error: %s: bad %s chunk\n", input->file_name,
+                                QPSK_PARAMS_CHUNK);
+                return -1;
+        }
 
-        return 1; //synchronization sequence not completely read
+        return 0;
 }
 
+/**
+ * \brief Parameters of the file: the input header, the command line wins.
+ *
+ * Sample rate is always the one of the samples (--rate for raw input).
+ *
+ * \return 0 on success, -1 on bad parameters (message is printed).
+ */
+static int file_params(demod_worker_t *worker, const input_t *input,
+                int stream, const SF_INFO *sf_info)
+{
+        qpsk_params_t *params = &worker->params;
+        const qpsk_params_t *cli = &worker->cli;
+        const char *bad_params;
+
 
-int main(int argc, char **argv)
+        qpsk_params_default(params);
+        params->symbol_len = 0; //unknown unless the header says
+        if (!worker->raw && input_chunk(input, stream, params) != 0) {
+                return -1;
+        }
+
+        params->sample_rate = sf_info->samplerate;
+        if (worker->cli_set & PARAM_FREQ) {
+                params->freq = cli->freq;
+        }
+        if (worker->cli_set & PARAM_SYNC) {
+                strcpy(params->sync_seq, cli->sync_seq);
+        }
+        if (worker->cli_set & PARAM_THRESHOLD) {
+                params->threshold = cli->threshold;
+        }
+        if (worker->cli_set & PARAM_FRAME) {
+                params->frame = cli->frame;
+        }
+        if (worker->cli_set & PARAM_CONSTELLATION) {
+                params->constellation = cli->constellation;
+        }
+
+        bad_params = qpsk_params_check(params);
+        if (bad_params != NULL) {
+                fprintf(stderr, "error: %s: %s\n", input->file_name,
+                                bad_params);
+                return -1;
+        }
+        qpsk_demod_configure(&worker->demod, params);
+
+        return 0;
+}
+
+/**
+ * \brief Refill the stdin block, incomplete sample is moved to its start.
+ *
+ * \return 1 on success, 0 at EOF, -1 on error (errno is set).
+ */
+static int stream_fill(input_t *input)
 {
-        int ret; //return code
+        ssize_t ret;
 
-        SNDFILE *in_file; //input WAW file
-        SF_INFO sf_info = { 0 }; //input WAW file parameters
-        size_t file_name_len;
-        int buffer; //sample buffer
 
-        double norm_freq;
-        size_t time = 0; //discrete time
-        size_t symbol_len = 0; //in samples
+        memmove(input->block, input->data, input->len);
+        input->data = input->block;
+        do {
+                ret = read(input->fd, input->block + input->len,
+                                STREAM_BLOCK - input->len);
+        } while (ret == -1 && errno == EINTR);
+        if (ret <= 0) {
+                return ret;
+        }
+        input->len += ret;
+
+        return 1;
+}
 
-        FILE *out_file;
+/**
+ * \brief Read up to count samples in input->format.
+ *
+ * QPSK_S32 samples are scaled to 32 bits like sf_read_int(). Mapped 32 bit
+ * PCM input is not copied, *samples points into the mapping. Narrow samples
+ * are not converted at all, *samples points into the mapping or the io_uring
+ * block and stays valid until the next read. Otherwise the samples are
+ * stored into the buffer and *samples is buffer.
+ *
+ * \return Number of read samples, 0 at EOF or on error (input->error is set
+ *         for the native readers).
+ */
+static sf_count_t input_read(input_t *input, int *buffer, size_t count,
+                const void **samples)
+{
+        const size_t width = input->wav.bits / 8;
+        size_t done = 0;
 
 
-        if (argc != 2) {
-                fprintf(stderr, "error: bad argument count\n");
-                return EXIT_FAILURE;
+        *samples = buffer;
+        if (input->sf != NULL) {
+                return sf_read_int(input->sf, buffer, count);
+        } else if (input->map.map != NULL) {
+                if (count > input->map.frames - input->pos) {
+                        count = input->map.frames - input->pos;
+                }
+                if (input->format != QPSK_S32) {
+                        *samples = wav_map_frame(&input->map, input->pos);
+                } else {
+                        *samples = wav_map_read(&input->map, input->pos,
+                                        count, buffer);
+                }
+                input->pos += count;
+                return count;
         }
 
-        file_name_len = strlen(argv[1]);
-        if (file_name_len < 3 ||
-                        strcmp(argv[1] + (file_name_len - 3), "wav") != 0) {
-                fprintf(stderr, "error: bad input file name\n");
-                return EXIT_FAILURE;
+        while (done < count) {
+                size_t n;
+
+                if (input->len < width) { //block exhausted, take the next
+                        int ret;
+
+                        if (input->block != NULL) {
+                                ret = stream_fill(input);
+                                if (ret <= 0) {
+                                        if (ret == -1) {
+                                                perror(input->file_name);
+                                                input->error = 1;
+                                        }
+                                        break;
+                                }
+                                continue;
+                        } else if (input->data != NULL) {
+                                uring_reader_release(&input->uring);
+                        }
+                        ret = uring_reader_next(&input->uring, &input->data,
+                                        &input->len);
+                        if (ret <= 0) {
+                                if (ret == -1) {
+                                        perror(input->file_name);
+                                        input->error = 1;
+                                }
+                                input->data = NULL;
+                                input->len = 0;
+                                break;
+                        }
+                        continue;
+                }
+
+                n = input->len / width;
+                if (n > count - done) {
+                        n = count - done;
+                }
+                if (input->format != QPSK_S32) { //rest of the block as is
+                        *samples = input->data;
+                        input->data += n * width;
+                        input->len -= n * width;
+                        return n;
+                }
+                wav_to_int(&input->wav, input->data, n, buffer + done);
+                input->data += n * width;
+                input->len -= n * width;
+                done += n;
         }
 
+        return done;
+}
 
-        /* Initializations, file opening. */
-        in_file = sf_open(argv[1], SFM_READ, &sf_info);
-        if (in_file == NULL) {
-                fprintf(stderr, "%s\n", sf_strerror(in_file));
-                return EXIT_FAILURE;
+/**
+ * \brief Close the input.
+ *
+ * \return 0 on success, -1 on error (message is printed).
+ */
+static int input_close(input_t *input)
+{
+        int err;
+
+
+        if (input->sf != NULL) {
+                err = sf_close(input->sf);
+                if (err != 0) {
+                        fprintf(stderr, "%s\n", sf_error_number(err));
+                        return -1;
+                }
+                return 0;
+        } else if (input->map.map != NULL) {
+                if (wav_map_close(&input->map) != 0) {
+                        perror(input->file_name);
+                        return -1;
+                }
+                return 0;
+        } else if (input->block != NULL) { //stdin stays open
+                free(input->block);
+                return input->error ? -1 : 0;
         }
 
+        uring_reader_free(&input->uring);
+        close(input->fd);
 
-        /* Calculate normalized frequency. */
-        norm_freq = (double)FREQ / sf_info.samplerate;
+        return input->error ? -1 : 0;
+}
 
-        /* Read synchronization sequence and determine symbol length. */
-        while (sf_read_int(in_file, &buffer, 1) != 0) {
-                ret = sync((double)buffer, &symbol_len, time++, norm_freq);
-                if (ret == -1) { //some error during synchronization
-                        return EXIT_FAILURE;
-                } else if (ret == 0) { //all sync sequence successfully read
+/**
+ * \brief Reader stage, fills sample blocks until EOF.
+ */
+static void * pipe_reader(void *arg)
+{
+        pipe_ctx_t *ctx = arg;
+        const size_t size = qpsk_sample_size(ctx->input->format);
+        int *slot;
+
+
+        while ((slot = spsc_produce_begin(&ctx->samples)) != NULL) {
+                const double start = stats_start(ctx->read_stats);
+                const void *samples;
+                const sf_count_t items_read = input_read(ctx->input, slot,
+                                BUFFER_SIZE, &samples);
+
+                if (items_read > 0 && samples != slot) { //native input
+                        memcpy(slot, samples, items_read * size);
+                }
+                stats_stop(ctx->read_stats, STATS_READ, start);
+                if (items_read <= 0) {
                         break;
                 }
+                ctx->items += items_read;
+                spsc_produce_end(&ctx->samples, items_read * size);
         }
+        spsc_close(&ctx->samples);
 
-        //printf("bit rate = %zu\n", sf_info.samplerate / symbol_len * 2);
+        return NULL;
+}
 
-        /* Open output text file. */
-        argv[1][file_name_len - 3] = 't';
-        argv[1][file_name_len - 2] = 'x';
-        argv[1][file_name_len - 1] = 't';
-        out_file = fopen(argv[1], "w");
-        if (out_file == NULL) {
-                perror(argv[1]);
-                return EXIT_FAILURE;
+/**
+ * \brief DSP stage, decides symbols from sample blocks into symbol blocks.
+ *
+ * Demodulator is already synchronized, so no error may occur here. Aborted
+ * symbol ring (writer failure) is propagated to the reader.
+ */
+static void * pipe_dsp(void *arg)
+{
+        pipe_ctx_t *ctx = arg;
+        const qpsk_sample_t format = ctx->input->format;
+        const void *samples;
+        size_t len;
+
+
+        while ((samples = spsc_consume_begin(&ctx->samples, &len)) != NULL) {
+                unsigned char *symbols = spsc_produce_begin(&ctx->symbols);
+                double start;
+                ssize_t count;
+
+                if (symbols == NULL) {
+                        spsc_abort(&ctx->samples);
+                        break;
+                }
+                start = stats_start(ctx->dsp_stats);
+                count = qpsk_demod_decode(ctx->demod, samples, format,
+                                len / qpsk_sample_size(format), symbols);
+                stats_stop(ctx->dsp_stats, STATS_DSP, start);
+
+                spsc_consume_end(&ctx->samples);
+                spsc_produce_end(&ctx->symbols, count);
+        }
+        spsc_close(&ctx->symbols);
+
+        return NULL;
+}
+
+/**
+ * \brief Decode the rest of the file in a three stage pipeline.
+ *
+ * Reader and DSP stages run in their own threads, the calling thread writes.
+ * Stages are connected by lock-free rings of PIPE_SLOTS blocks, so a slow
+ * stage stalls the previous ones instead of buffering the whole file.
+ *
+ * \return 0 on success, -1 on error (errno of the failed write is kept).
+ */
+static int decode_pipeline(demod_worker_t *worker, input_t *input,
+                batch_item_t *item)
+{
+        pipe_ctx_t ctx = {
+                .input = input,
+                .demod = &worker->demod,
+        };
+        stats_t read_stats, dsp_stats;
+        pthread_t reader, dsp;
+        const unsigned char *symbols;
+        size_t len;
+        int ret = 0;
+        int err = 0;
+
+
+        memset(&read_stats, 0, sizeof (read_stats));
+        memset(&dsp_stats, 0, sizeof (dsp_stats));
+        if (worker->stats != NULL) {
+                ctx.read_stats = &read_stats;
+                ctx.dsp_stats = &dsp_stats;
+        }
+        if (spsc_init(&ctx.samples, PIPE_SLOTS,
+                                BUFFER_SIZE * sizeof (int)) != 0)
+        {
+                perror("malloc");
+                return -1;
+        }
+        if (spsc_init(&ctx.symbols, PIPE_SLOTS, BUFFER_SIZE) != 0) {
+                perror("malloc");
+                ret = -1;
+                goto free_samples_lab;
+        }
+
+        if (pthread_create(&reader, NULL, pipe_reader, &ctx) != 0) {
+                fprintf(stderr, "error: thread creation failed\n");
+                ret = -1;
+                goto free_symbols_lab;
+        }
+        if (pthread_create(&dsp, NULL, pipe_dsp, &ctx) != 0) {
+                fprintf(stderr, "error: thread creation failed\n");
+                spsc_abort(&ctx.samples);
+                pthread_join(reader, NULL);
+                ret = -1;
+                goto free_symbols_lab;
+        }
+
+        /* Writer stage. */
+        while ((symbols = spsc_consume_begin(&ctx.symbols, &len)) != NULL) {
+                const double start = stats_start(worker->stats);
+
+                ret = bits_write(&worker->writer, symbols, len);
+                stats_stop(worker->stats, STATS_WRITE, start);
+                spsc_consume_end(&ctx.symbols);
+                if (ret != 0) {
+                        err = errno;
+                        spsc_abort(&ctx.symbols);
+                        break;
+                }
+        }
+
+        pthread_join(dsp, NULL);
+        pthread_join(reader, NULL);
+        item->samples += ctx.items;
+        if (worker->stats != NULL) {
+                stats_merge(worker->stats, &read_stats);
+                stats_merge(worker->stats, &dsp_stats);
+        }
+
+
+free_symbols_lab:
+        spsc_free(&ctx.symbols);
+free_samples_lab:
+        spsc_free(&ctx.samples);
+        if (err != 0) {
+                errno = err;
+        }
+
+        return ret;
+}
+
+
+/**
+ * \brief Load the seek index sidecar of the input.
+ *
+ * Sidecar file name is the input file name with the extension replaced.
+ * Index not matching the parameters and the length of the input (e.g. left
+ * over from another transmission) is dropped.
+ *
+ * \return 0 on success, -1 if there is none (or a bad one, warning is
+ *         printed).
+ */
+static int range_index(demod_worker_t *worker, const char *file_name,
+                const SF_INFO *sf_info)
+{
+        char *index_name = strdup(file_name);
+        int ret = -1;
+
+
+        if (index_name == NULL) {
+                perror("strdup");
+                return -1;
+        }
+        strcpy(index_name + strlen(index_name) - 3, "idx");
+
+        ret = seek_index_load(&worker->index, index_name);
+        if (ret != 0 && errno != ENOENT) {
+                fprintf(stderr, "warning: %s: %s, searching for the sync "
+                                "sequence\n", index_name, (errno == EINVAL) ?
+                                "malformed index" : strerror(errno));
+        } else if (ret == 0) {
+                const int match = seek_index_match(&worker->index,
+                                &worker->params, sf_info->frames);
+
+                if (match != 1) {
+                        fprintf(stderr, "warning: %s: %s, searching for the "
+                                        "sync sequence\n", index_name,
+                                        (match == 0) ? "index does not match "
+                                        "the input" : strerror(errno));
+                        seek_index_free(&worker->index);
+                        ret = -1;
+                }
+        }
+        free(index_name);
+
+        return ret;
+}
+
+/**
+ * \brief Bits of the smallest range, whole symbols of whole bit pairs.
+ */
+static unsigned range_unit(const qpsk_params_t *params)
+{
+        const unsigned bits = constellation_get(params->constellation)->bits;
+
+
+        return (bits % 2 == 0) ? bits : 2 * bits;
+}
+
+/**
+ * \brief Decode only the payload bits of the range.
+ *
+ * Runs of the seek index overlapping the range are decoded from their known
+ * positions and carrier times, nothing else is read. Range reaching the end
+ * of the wide symbols takes the trailer too, so the padding is dropped.
+ *
+ * \return 0 on success, -1 on error (message is printed).
+ */
+static int decode_range(demod_worker_t *worker, input_t *input,
+                const SF_INFO *sf_info, batch_item_t *item)
+{
+        const seek_index_t *index = &worker->index;
+        const size_t symbol_len = index->symbol_len;
+        par_ctx_t ctx = {
+                .file_name = input->file_name,
+                .sf_info = sf_info,
+                .stats = worker->stats,
+                .map = (input->map.map != NULL) ? &input->map : NULL,
+                .format = (input->map.map != NULL) ? input->format :
+                        QPSK_S32, //libsndfile for io_uring input
+        };
+        par_worker_t reader = {
+                .ctx = &ctx,
+                .in_file = input->sf,
+                .stats = worker->stats,
+        };
+        const unsigned bits = constellation_get(
+                        worker->params.constellation)->bits;
+        size_t bit = worker->range_start;
+        size_t end = worker->range_start + worker->range_len;
+        int trailer = 0; //decode the trailer after the last symbol
+        int ret = 0;
+
+
+        if (bit >= index->bits) {
+                fprintf(stderr, "error: %s: range beyond the payload (%zu "
+                                "bits)\n", input->file_name, index->bits);
+                return -1;
+        } else if (end >= index->bits) {
+                end = index->bits;
+                trailer = (bits != 2);
         }
+        bits_writer_width(&worker->writer, bits, trailer);
+        if (ctx.map == NULL && reader.in_file == NULL) { //io_uring input
+                SF_INFO info = *sf_info;
 
-        while (1) {
-                size_t res_histogram[4] = { 0 }; //result histogram
-                size_t max_val = 0; //maximum value in histogram (one of them)
-                size_t max_idx = 0; //index of maximum value in histogram
+                reader.in_file = sf_open(input->file_name, SFM_READ, &info);
+                if (reader.in_file == NULL) {
+                        fprintf(stderr, "%s\n", sf_strerror(NULL));
+                        return -1;
+                }
+        }
+
+        for (size_t i = seek_index_find(index, bit); ret == 0 && bit < end;
+                        ++i)
+        {
+                const seek_point_t *point = &index->points[i];
+                const size_t run_end = (i + 1 < index->count &&
+                                index->points[i + 1].bit < end) ?
+                        index->points[i + 1].bit : end;
+                size_t offset = (bit - point->bit) / bits * symbol_len;
+                /* Trailer follows the last run right away. */
+                size_t left = (run_end - bit) / bits +
+                        (trailer && run_end == end);
 
-                /* Read all samples for one symbol. */
-                for (size_t i = 0; i < symbol_len; ++i) {
-                        double res;
+                qpsk_demod_start(&worker->demod, symbol_len,
+                                point->time + offset);
+                while (left > 0) {
+                        const size_t symbols = (left < BUFFER_SIZE) ? left :
+                                BUFFER_SIZE;
+                        const size_t samples = symbols * symbol_len;
+                        ssize_t count;
+                        double start;
+
+                        if (point->sample + offset + samples >
+                                        (size_t)sf_info->frames)
+                        {
+                                fprintf(stderr, "error: %s: index does not "
+                                                "match the input\n",
+                                                input->file_name);
+                                ret = -1;
+                                break;
+                        }
+                        count = par_decode_range(&reader, &worker->demod,
+                                        point->sample + offset, samples,
+                                        worker->buffer, worker->symbols);
+                        if (count == -1) {
+                                fprintf(stderr, "error: %s: read failed\n",
+                                                input->file_name);
+                                ret = -1;
+                                break;
+                        }
 
-                        if (sf_read_int(in_file, &buffer, 1) == 0) {
-                                goto all_read_lab;
+                        start = stats_start(worker->stats);
+                        if (bits_write(&worker->writer, worker->symbols,
+                                                count) != 0)
+                        {
+                                perror("error: output");
+                                ret = -1;
+                                break;
                         }
-                        res = (double)buffer / AMPLITUDE;
+                        stats_stop(worker->stats, STATS_WRITE, start);
+                        item->samples += samples;
+                        offset += samples;
+                        bit += bits * symbols;
+                        left -= symbols;
+                }
+        }
+
+        if (reader.in_file != NULL && reader.in_file != input->sf) {
+                sf_close(reader.in_file);
+        }
+        if (worker->stats != NULL) {
+                worker->stats->symbols += worker->demod.symbols;
+                worker->stats->ties += worker->demod.ties;
+                worker->stats->low_margin += worker->demod.low_margin;
+        }
+
+        return ret;
+}
 
-                        /* Compare with all four possible phase shifts. */
-                        /* It is stupid, but working. */
-                        for (size_t j = 0; j < 4; ++j) {
-                                double ref = cos(2.0 * M_PI * norm_freq * time +
-                                                phase_shift[j]);
+/**
+ * \brief Demodulate one input file ("-" for stdin to stdout stream).
+ *
+ * Output file name is the input file name with the extension replaced.
+ * Carrier tables are recomputed only if the sample rate or frequency
+ * changes.
+ *
+ * \return 0 on success, -1 on error (message is printed).
+ */
+static int demod_file(batch_item_t *item, void *worker_data)
+{
+        demod_worker_t *worker = worker_data;
+        const char *file_name = item->file_name;
+        const size_t file_name_len = strlen(file_name);
+        const int stream = (strcmp(file_name, "-") == 0);
+        input_t input; //input WAW file
+        SF_INFO sf_info = { 0 }; //input WAW file parameters
+        char *out_file_name;
+        int out_fd; //output file descriptor
+        int out_flags = worker->out_flags;
+        sf_count_t items_read; //successfully read items
+        const void *samples; //read items, in the buffer or in place
+        ssize_t count = 0; //decoded symbols in the block
+        stats_t *stats = worker->stats;
+        int indexed = 0; //range positions from the seek index sidecar
+        double start;
+        int ret = -1;
+
+
+        if (worker->raw) {
+                sf_info.samplerate = worker->cli.sample_rate;
+                sf_info.channels = 1;
+                sf_info.format = RAW_FORMAT;
+        }
+        if (!stream && (file_name_len < 3 ||
+                                strcmp(file_name + (file_name_len - 3),
+                                        worker->raw ? "raw" : "wav") != 0))
+        {
+                fprintf(stderr, "error: bad input file name\n");
+                return -1;
+        }
+
+        if (input_open(&input, worker, file_name, stream, &sf_info) != 0) {
+                return -1;
+        }
+        if (file_params(worker, &input, stream, &sf_info) != 0) {
+                goto close_in_lab;
+        } else if (worker->params.frame != 0 && !sf_info.seekable) {
+                fprintf(stderr, "error: framed input has to be seekable\n");
+                goto close_in_lab;
+        } else if (worker->range_len != 0 && !sf_info.seekable) {
+                fprintf(stderr, "error: range needs a seekable input\n");
+                goto close_in_lab;
+        } else if (worker->range_start % range_unit(&worker->params) != 0 ||
+                        worker->range_len % range_unit(&worker->params) != 0)
+        {
+                fprintf(stderr, "error: %s: range has to be whole symbols "
+                                "(multiples of %u bits)\n", file_name,
+                                range_unit(&worker->params));
+                goto close_in_lab;
+        }
 
-                                res_histogram[j] += fabs(ref - res) < THRESHOLD;
+
+        /* Precompute carrier for the file sample rate and frequency. */
+        if (worker->sample_rate != worker->params.sample_rate ||
+                        worker->freq != worker->params.freq)
+        {
+                if (worker->sample_rate != 0) {
+                        carrier_free(&worker->carrier);
+                        worker->sample_rate = 0;
+                }
+                if (carrier_init(&worker->carrier, worker->params.sample_rate,
+                                        worker->params.freq) != 0)
+                {
+                        fprintf(stderr, "error: carrier tables allocation "
+                                        "failed\n");
+                        goto close_in_lab;
+                }
+                worker->sample_rate = worker->params.sample_rate;
+                worker->freq = worker->params.freq;
+        }
+
+        /* Search for the synchronization sequence and the symbol length. */
+        /* Symbols following the sync sequence in the same block are kept. */
+        /* Indexed range needs no search at all. */
+        if (worker->range_len != 0) {
+                indexed = (range_index(worker, file_name, &sf_info) == 0);
+        }
+        qpsk_demod_reset(&worker->demod);
+        while (!indexed && !qpsk_demod_synced(&worker->demod)) {
+                start = stats_start(stats);
+                items_read = input_read(&input, worker->buffer,
+                                BUFFER_SIZE, &samples);
+                stats_stop(stats, STATS_READ, start);
+                if (items_read <= 0) {
+                        break;
+                }
+
+                item->samples += items_read;
+                start = stats_start(stats);
+                count = qpsk_demod_decode(&worker->demod, samples,
+                                input.format, items_read, worker->symbols);
+                stats_stop(stats, STATS_SYNC, start);
+                if (count == -1) {
+                        fprintf(stderr, "error: sync search buffer "
+                                        "allocation failed\n");
+                        goto close_in_lab;
+                }
+        }
+        if (!indexed && !qpsk_demod_synced(&worker->demod)) { //EOF
+                count = qpsk_demod_flush(&worker->demod, worker->symbols,
+                                BUFFER_SIZE);
+                if (count == -1) {
+                        fprintf(stderr, "error: synchronization sequence "
+                                        "not found\n");
+                        goto close_in_lab;
+                }
+        }
+        if (worker->range_len != 0 && !indexed) { //layout from the sync
+                worker->params.symbol_len = worker->demod.symbol_len;
+                if (seek_index_layout(&worker->index, &worker->params,
+                                        worker->demod.origin,
+                                        sf_info.frames) != 0)
+                {
+                        perror("malloc");
+                        goto close_in_lab;
+                }
+        }
+
+        //printf("bit rate = %zu\n", sf_info.samplerate / symbol_len * 2);
+
+        /* Open output text (or binary) file. */
+        out_file_name = strdup(stream ? "stdout" : file_name);
+        if (out_file_name == NULL) {
+                perror("strdup");
+                goto close_in_lab;
+        }
+        if (stream) {
+                out_fd = STDOUT_FILENO;
+                out_flags &= ~O_DIRECT;
+        } else {
+                strcpy(out_file_name + file_name_len - 3,
+                                (worker->out_format == BITS_PACKED) ?
+                                "bin" : "txt");
+                out_fd = open(out_file_name, out_flags, 0666);
+        }
+        if (out_fd == -1 && errno == EINVAL && (out_flags & O_DIRECT)) {
+                fprintf(stderr, "warning: %s: direct I/O not supported\n",
+                                out_file_name);
+                out_flags &= ~O_DIRECT;
+                out_fd = open(out_file_name, out_flags, 0666);
+        }
+        if (out_fd == -1) {
+                perror(out_file_name);
+                goto free_lab;
+        }
+        bits_writer_reset(&worker->writer, out_fd,
+                        (out_flags & O_DIRECT) != 0);
+        bits_writer_width(&worker->writer, constellation_get(
+                                worker->params.constellation)->bits, 1);
+
+        if (worker->range_len != 0) {
+                ret = decode_range(worker, &input, &sf_info, item);
+                if (ret != 0) {
+                        goto close_out_lab;
+                }
+        } else if ((worker->threads > 1 || worker->params.frame != 0) &&
+                        sf_info.seekable)
+        {
+                /* Symbol positions are known now, decode chunks in parallel.
+                 * Frames are always decoded at their positions, resynced
+                 * one by one (by one worker with -j 1). */
+                par_ctx_t ctx = {
+                        .file_name = file_name,
+                        .sf_info = &sf_info,
+                        .origin = worker->demod.origin,
+                        .data_start = worker->demod.data_start,
+                        .symbol_len = worker->demod.symbol_len,
+                        .symbols = (sf_info.frames - worker->demod.origin -
+                                        worker->demod.data_start) /
+                                worker->demod.symbol_len,
+                        .frame = worker->params.frame,
+                        .frame_len = worker->demod.symbol_len * frame_symbols(
+                                        qpsk_sync_symbols(
+                                                worker->params.sync_seq),
+                                        worker->params.frame),
+                        .carrier = &worker->carrier,
+                        .params = &worker->params,
+                        .decision = worker->decision,
+                        .gain = worker->demod.gain,
+                        .stats = stats,
+                        .map = (input.map.map != NULL) ? &input.map : NULL,
+                        .format = (input.map.map != NULL) ? input.format :
+                                QPSK_S32, //libsndfile for io_uring input
+                };
+
+                worker->params.symbol_len = worker->demod.symbol_len;
+                ret = decode_parallel(&ctx, worker->threads, &worker->writer);
+                item->samples = sf_info.frames;
+                if (ret != 0) {
+                        goto close_out_lab;
+                }
+        } else {
+                /* Rest of the block after the sync sequence carries data. */
+                start = stats_start(stats);
+                ret = bits_write(&worker->writer, worker->symbols, count);
+                stats_stop(stats, STATS_WRITE, start);
+
+                if (worker->pipeline && ret == 0) {
+                        ret = decode_pipeline(worker, &input, item);
+                }
+                while (!worker->pipeline && ret == 0) {
+                        start = stats_start(stats);
+                        items_read = input_read(&input, worker->buffer,
+                                        BUFFER_SIZE, &samples);
+                        stats_stop(stats, STATS_READ, start);
+                        if (items_read <= 0) {
+                                break;
                         }
-                        time++;
+
+                        item->samples += items_read;
+                        start = stats_start(stats);
+                        count = qpsk_demod_decode(&worker->demod, samples,
+                                        input.format, items_read,
+                                        worker->symbols);
+                        stats_stop(stats, STATS_DSP, start);
+
+                        start = stats_start(stats);
+                        ret = bits_write(&worker->writer, worker->symbols,
+                                        count);
+                        stats_stop(stats, STATS_WRITE, start);
+                }
+                /* Symbols still buffered by the search. */
+                while (ret == 0 && (count = qpsk_demod_flush(&worker->demod,
+                                                worker->symbols,
+                                                BUFFER_SIZE)) > 0)
+                {
+                        start = stats_start(stats);
+                        ret = bits_write(&worker->writer, worker->symbols,
+                                        count);
+                        stats_stop(stats, STATS_WRITE, start);
+                }
+
+                if (stats != NULL) {
+                        stats->symbols += worker->demod.symbols;
+                        stats->ties += worker->demod.ties;
+                        stats->low_margin += worker->demod.low_margin;
+                }
+        }
+
+        /* Write EOL (text) or last incomplete byte (binary) to the file. */
+        start = stats_start(stats);
+        if (ret != 0 || bits_writer_finish(&worker->writer) != 0) {
+                perror(out_file_name);
+                ret = -1;
+        }
+        stats_stop(stats, STATS_WRITE, start);
+
+
+close_out_lab:
+        if (close(out_fd) != 0) {
+                perror(out_file_name);
+                ret = -1;
+        }
+free_lab:
+        free(out_file_name);
+close_in_lab:
+        seek_index_free(&worker->index);
+        if (input_close(&input) != 0) {
+                ret = -1;
+        }
+        if (stats != NULL) {
+                stats->files++;
+                stats->samples += item->samples;
+        }
+
+        return ret;
+}
+
+static int demod_worker_init(demod_worker_t *worker, qpsk_decision_t decision,
+                bits_format_t out_format, int out_flags, int raw,
+                size_t threads, int pipeline, int uring,
+                const qpsk_params_t *cli, unsigned cli_set,
+                size_t range_start, size_t range_len, stats_t *stats)
+{
+        const qpsk_params_t cli_copy = *cli; //may point into the worker
+
+
+        memset(worker, 0, sizeof (*worker));
+        worker->cli = cli_copy;
+        worker->cli_set = cli_set;
+        worker->stats = stats;
+        worker->pipeline = pipeline;
+        worker->uring = uring;
+        worker->range_start = range_start;
+        worker->range_len = range_len;
+        worker->decision = decision;
+        worker->out_format = out_format;
+        worker->out_flags = out_flags;
+        worker->raw = raw;
+        worker->threads = threads;
+
+        worker->buffer = malloc(BUFFER_SIZE * sizeof (*worker->buffer));
+        worker->symbols = malloc(BUFFER_SIZE);
+        if (worker->buffer == NULL || worker->symbols == NULL) {
+                goto free_lab;
+        }
+        if (qpsk_demod_init(&worker->demod, &worker->carrier,
+                                decision) != 0)
+        {
+                goto free_lab;
+        }
+        if (bits_writer_init(&worker->writer, -1, out_format, 0) != 0) {
+                qpsk_demod_free(&worker->demod);
+                goto free_lab;
+        }
+
+        return 0;
+
+
+free_lab:
+        free(worker->symbols);
+        free(worker->buffer);
+
+        return -1;
+}
+
+static void demod_worker_free(demod_worker_t *worker)
+{
+        bits_writer_free(&worker->writer);
+        qpsk_demod_free(&worker->demod);
+        if (worker->sample_rate != 0) {
+                carrier_free(&worker->carrier);
+        }
+        free(worker->symbols);
+        free(worker->buffer);
+}
+
+/**
+ * \brief Demodulate all the files on a thread pool, print report to stdout.
+ *
+ * \return 0 if all files succeeded, -1 otherwise.
+ */
+static int demod_batch(char **names, size_t count, size_t threads,
+                const demod_worker_t *opts)
+{
+        batch_item_t *items = calloc(count, sizeof (*items));
+        demod_worker_t *workers;
+        stats_t *worker_stats = NULL; //merged into opts->stats at the end
+        size_t ready = 0; //initialized workers
+        size_t failed = count;
+        double start;
+
+
+        if (threads > count) { //no use for idle workers
+                threads = (count == 0) ? 1 : count;
+        }
+        workers = calloc(threads, sizeof (*workers));
+        if (opts->stats != NULL) {
+                worker_stats = calloc(threads, sizeof (*worker_stats));
+        }
+        if (items == NULL || workers == NULL ||
+                        (opts->stats != NULL && worker_stats == NULL))
+        {
+                perror("malloc");
+                goto free_lab;
+        }
+        for (size_t i = 0; i < count; ++i) {
+                if (strcmp(names[i], "-") == 0) {
+                        fprintf(stderr, "error: stream can't be batched\n");
+                        goto free_lab;
+                }
+                items[i].file_name = names[i];
+        }
+        for (; ready < threads; ++ready) {
+                if (demod_worker_init(&workers[ready], opts->decision,
+                                        opts->out_format, opts->out_flags,
+                                        opts->raw, 1, opts->pipeline,
+                                        opts->uring, &opts->cli,
+                                        opts->cli_set, opts->range_start,
+                                        opts->range_len,
+                                        (opts->stats == NULL) ?
+                                        NULL : &worker_stats[ready]) != 0)
+                {
+                        perror("malloc");
+                        goto free_lab;
                 }
+        }
+
+        start = batch_time();
+        failed = batch_run(items, count, threads, demod_file, workers,
+                        sizeof (*workers));
+        batch_report(stdout, items, count, batch_time() - start);
+
+
+free_lab:
+        for (size_t i = 0; i < ready; ++i) {
+                if (opts->stats != NULL) {
+                        stats_merge(opts->stats, &worker_stats[i]);
+                }
+                demod_worker_free(&workers[i]);
+        }
+        free(worker_stats);
+        free(workers);
+        free(items);
+
+        return (failed == 0) ? 0 : -1;
+}
 
-                /* Find the most popular phase shift for this symbol. */
-                for (size_t i = 0; i < 4; ++i) {
-                        if (max_val < res_histogram[i]) {
-                                max_val = res_histogram[i];
-                                max_idx = i;
+int main(int argc, char **argv)
+{
+        int ret; //return code
+        size_t threads = 1; //decoding threads
+        const char *manifest = NULL; //file with input file names
+        char **names; //batch of input files
+        size_t count; //number of input files
+        int stats_on = 0; //collect statistics, 2 with hardware counters
+        stats_t stats; //statistics summary
+        const constellation_t *constellation;
+        const char *bad_params;
+        char *endptr;
+
+        demod_worker_t worker = { //options, single file demodulation
+                .decision = QPSK_DECIDE_HIST,
+                .out_format = BITS_TEXT,
+                .out_flags = O_WRONLY | O_CREAT | O_TRUNC,
+        };
+
+
+        /* Options parsing. */
+        qpsk_params_default(&worker.cli);
+        worker.cli.symbol_len = 0; //searched for by the demodulator
+        while ((ret = getopt_long(argc, argv, "bDj:l:m:pru", long_options,
+                                        NULL)) != -1)
+        {
+                switch (ret) {
+                case 'b': //packed binary output
+                        worker.out_format = BITS_PACKED;
+                        break;
+
+                case 'D': //direct I/O output, bypass the page cache
+                        worker.out_flags |= O_DIRECT;
+                        break;
+
+                case 'j': //number of threads, 0 for all CPUs
+                        threads = strtoul(optarg, &endptr, 10);
+                        if (*optarg == '\0' || *endptr != '\0') {
+                                fprintf(stderr, "error: bad thread count\n");
+                                return EXIT_FAILURE;
+                        } else if (threads == 0) {
+                                threads = get_nprocs();
+                        }
+                        break;
+
+                case 'l': //batch mode, manifest with one file name per line
+                        manifest = optarg;
+                        break;
+
+                case 'm': //symbol decision mode
+                        if (strcmp(optarg, "hist") == 0) {
+                                worker.decision = QPSK_DECIDE_HIST;
+                        } else if (strcmp(optarg, "corr") == 0) {
+                                worker.decision = QPSK_DECIDE_CORR;
+                        } else {
+                                fprintf(stderr, "error: bad decision mode "
+                                                "(hist or corr)\n");
+                                return EXIT_FAILURE;
                         }
+                        break;
+
+                case 'p': //pipelined read, decode and write
+                        worker.pipeline = 1;
+                        break;
+
+                case 'r': //raw input, no WAV header
+                        worker.raw = 1;
+                        break;
+
+                case 'u': //native WAV reader on io_uring
+                        worker.uring = 1;
+                        break;
+
+                case 'R': //--rate, sample rate of raw input [Hz]
+                        if (parse_ulong(optarg, &worker.cli.sample_rate) !=
+                                        0)
+                        {
+                                return EXIT_FAILURE;
+                        }
+                        worker.cli_set |= PARAM_RATE;
+                        break;
+
+                case 'F': //--freq, carrier frequency [Hz]
+                        if (parse_ulong(optarg, &worker.cli.freq) != 0) {
+                                return EXIT_FAILURE;
+                        }
+                        worker.cli_set |= PARAM_FREQ;
+                        break;
+
+                case 's': //--sync, sequence of bit pairs
+                        if (strlen(optarg) >= sizeof (worker.cli.sync_seq)) {
+                                fprintf(stderr, "error: sync sequence too "
+                                                "long\n");
+                                return EXIT_FAILURE;
+                        }
+                        strcpy(worker.cli.sync_seq, optarg);
+                        worker.cli_set |= PARAM_SYNC;
+                        break;
+
+                case 'M': //--frame, payload symbols per frame
+                        if (parse_size(optarg, &worker.cli.frame) != 0) {
+                                return EXIT_FAILURE;
+                        }
+                        worker.cli_set |= PARAM_FRAME;
+                        break;
+
+                case 'G': //--range start:len, payload bits to decode
+                        if (parse_range(optarg, &worker.range_start,
+                                                &worker.range_len) != 0)
+                        {
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                case 'C': //--constellation, of the payload symbols
+                        constellation = constellation_find(optarg);
+                        if (constellation == NULL) {
+                                fprintf(stderr, "error: bad constellation "
+                                                "(qpsk, 8psk or 16qam)\n");
+                                return EXIT_FAILURE;
+                        }
+                        worker.cli.constellation = constellation->id;
+                        worker.cli_set |= PARAM_CONSTELLATION;
+                        break;
+
+                case 'T': //--threshold, relative to the amplitude
+                        if (parse_double(optarg, &worker.cli.threshold) !=
+                                        0)
+                        {
+                                return EXIT_FAILURE;
+                        }
+                        worker.cli_set |= PARAM_THRESHOLD;
+                        break;
+
+                case 'S': //--stats[=hw], JSON summary to stderr
+                        if (optarg == NULL) {
+                                stats_on = 1;
+                        } else if (strcmp(optarg, "hw") == 0) {
+                                stats_on = 2;
+                        } else {
+                                fprintf(stderr, "error: bad stats mode "
+                                                "(hw)\n");
+                                return EXIT_FAILURE;
+                        }
+                        break;
+
+                default:
+                        return EXIT_FAILURE; //getopt already printed error
                 }
+        }
 
-                /* Write string coresponding to the symbol to the file. */
-                fputs(res_sym[max_idx], out_file);
+        if ((manifest == NULL && argc - optind < 1) ||
+                        (manifest != NULL && argc - optind != 0))
+        {
+                fprintf(stderr, "error: bad argument count\n");
+                return EXIT_FAILURE;
+        } else if ((bad_params = qpsk_params_check(&worker.cli)) != NULL) {
+                fprintf(stderr, "error: %s\n", bad_params);
+                return EXIT_FAILURE;
         }
 
 
-all_read_lab:
-        fputc('\n', out_file); //write EOL to the output file
+        if (stats_on) {
+                stats_init(&stats, stats_on == 2);
+                worker.stats = &stats;
+        }
 
-        /* Close files. */
-        fclose(out_file);
-        ret = sf_close(in_file);
-        if (ret != 0) {
-                fprintf(stderr, "%s\n", sf_error_number(ret));
+        if (manifest != NULL || argc - optind > 1) {
+                /* Batch mode, threads process whole files. */
+                if (manifest != NULL) {
+                        names = batch_manifest_read(manifest, &count);
+                        if (names == NULL) {
+                                return EXIT_FAILURE;
+                        }
+                } else {
+                        names = argv + optind;
+                        count = argc - optind;
+                }
+
+                ret = demod_batch(names, count, threads, &worker);
+                if (manifest != NULL) {
+                        batch_manifest_free(names, count);
+                }
+        } else {
+                batch_item_t item = { .file_name = argv[optind] };
+
+                if (demod_worker_init(&worker, worker.decision,
+                                        worker.out_format, worker.out_flags,
+                                        worker.raw, threads, worker.pipeline,
+                                        worker.uring, &worker.cli,
+                                        worker.cli_set, worker.range_start,
+                                        worker.range_len, worker.stats)
+                                != 0)
+                {
+                        perror("malloc");
+                        return EXIT_FAILURE;
+                }
+                ret = demod_file(&item, &worker);
+                demod_worker_free(&worker);
+        }
+        if (stats_on) {
+                stats_print(&stats, stderr);
         }
 
-        return EXIT_SUCCESS;
+
+        return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
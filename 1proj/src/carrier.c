@@ -0,0 +1,154 @@
+/**
+ * \file carrier.c
+ * \brief Table driven carrier generator shared by modulator and demodulator
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "carrier.h"
+
+
+const double phase_shift[CARRIER_PHASES] = {
+        1.0 / 4.0 * M_PI, //00 -> 45 degrees
+        7.0 / 4.0 * M_PI, //01 -> 315 degrees
+        3.0 / 4.0 * M_PI, //10 -> 135 degrees
+        5.0 / 4.0 * M_PI, //11 -> 225 degrees
+};
+
+
+static unsigned long gcd(unsigned long a, unsigned long b)
+{
+        while (b != 0) {
+                const unsigned long tmp = a % b;
+
+                a = b;
+                b = tmp;
+        }
+
+        return a;
+}
+
+/* Phase accumulator at discrete time in cycles, freq * time wrapped modulo
+ * the sample rate (which fits 32 bits, so the product fits 64). */
+static double nco_cycle(const carrier_t *carrier, size_t time)
+{
+        const unsigned long rate = carrier->sample_rate;
+
+
+        return (double)(carrier->freq * (time % rate) % rate) / rate;
+}
+
+/* Carrier periods shifted by phase, straight from the NCO. */
+static double * period_table(const carrier_t *carrier, double phase)
+{
+        double *table = malloc(carrier->len * sizeof (*table));
+
+
+        if (table == NULL) {
+                return NULL;
+        }
+
+        for (size_t t = 0; t < carrier->period; ++t) {
+                table[t] = carrier_nco(carrier, phase, t);
+        }
+        for (size_t t = carrier->period; t < carrier->len; ++t) {
+                table[t] = table[t - carrier->period];
+        }
+
+        return table;
+}
+
+
+int carrier_init(carrier_t *carrier, unsigned long sample_rate,
+                unsigned long freq)
+{
+        carrier->sample_rate = sample_rate;
+        carrier->freq = freq;
+        carrier->period = sample_rate / gcd(sample_rate, freq);
+        carrier->nco = (carrier->period > CARRIER_MAX_PERIOD);
+        if (carrier->nco) { //no tables, windows of the NCO are used
+                carrier->len = 0;
+                for (size_t i = 0; i < CARRIER_PHASES; ++i) {
+                        carrier->table[i] = NULL;
+                }
+                carrier->in_phase = carrier->quadrature = NULL;
+                return 0;
+        }
+        carrier->len = (CARRIER_MIN_LEN + carrier->period - 1) /
+                carrier->period * carrier->period;
+
+        for (size_t i = 0; i < CARRIER_PHASES; ++i) {
+                carrier->table[i] = period_table(carrier, phase_shift[i]);
+        }
+        carrier->in_phase = period_table(carrier, 0.0);
+        carrier->quadrature = period_table(carrier, M_PI / 2.0); //-sin x
+
+        for (size_t i = 0; i < CARRIER_PHASES; ++i) {
+                if (carrier->table[i] == NULL) {
+                        goto free_lab;
+                }
+        }
+        if (carrier->in_phase == NULL || carrier->quadrature == NULL) {
+                goto free_lab;
+        }
+
+        return 0;
+
+
+free_lab:
+        carrier_free(carrier);
+        return -1;
+}
+
+double carrier_nco(const carrier_t *carrier, double phase, size_t time)
+{
+        return cos(2.0 * M_PI * nco_cycle(carrier, time) + phase);
+}
+
+void carrier_window_fill(const carrier_t *carrier, carrier_window_t *window,
+                size_t time)
+{
+        const double theta = 2.0 * M_PI * nco_cycle(carrier, time);
+        const double step = 2.0 * M_PI * carrier->freq / carrier->sample_rate;
+        const double rot_re = cos(step), rot_im = sin(step);
+        double re = cos(theta), im = sin(theta); //rotator, e^(i 2 pi f t)
+        double shift_re[CARRIER_PHASES], shift_im[CARRIER_PHASES];
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                shift_re[j] = cos(phase_shift[j]);
+                shift_im[j] = sin(phase_shift[j]);
+        }
+
+        for (size_t t = 0; t < CARRIER_WINDOW; ++t) {
+                const double tmp = re * rot_re - im * rot_im;
+
+                /* cos(x + phase) = cos x cos phase - sin x sin phase */
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        window->table[j][t] = re * shift_re[j] -
+                                im * shift_im[j];
+                }
+                window->in_phase[t] = re;
+                window->quadrature[t] = -im;
+
+                im = re * rot_im + im * rot_re;
+                re = tmp;
+        }
+        window->start = time;
+        window->len = CARRIER_WINDOW;
+}
+
+void carrier_free(carrier_t *carrier)
+{
+        for (size_t i = 0; i < CARRIER_PHASES; ++i) {
+                free(carrier->table[i]);
+                carrier->table[i] = NULL;
+        }
+        free(carrier->in_phase);
+        carrier->in_phase = NULL;
+        free(carrier->quadrature);
+        carrier->quadrature = NULL;
+}
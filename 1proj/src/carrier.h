@@ -0,0 +1,188 @@
+/**
+ * \file carrier.h
+ * \brief Table driven carrier generator shared by modulator and demodulator
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#ifndef CARRIER_H
+#define CARRIER_H
+
+#include <stddef.h>
+#include <math.h> //M_PI
+
+
+#define CARRIER_PHASES 4 //number of phase shifts (QPSK)
+#define CARRIER_MIN_LEN 1024 //minimal table length, for long contiguous runs
+#define CARRIER_MAX_PERIOD 4096 //longer periods are synthesized by the NCO
+#define CARRIER_WINDOW 512 //samples synthesized by the NCO at once
+
+
+/* Phase shift for each symbol index (2 * first_bit + second_bit). */
+extern const double phase_shift[CARRIER_PHASES];
+
+typedef struct {
+        unsigned long sample_rate;
+        unsigned long freq;
+        size_t period; //carrier period in samples
+        int nco; //period too long for tables, waveforms come from windows
+        size_t len; //table length, multiple of the period, 0 for the NCO
+        double *table[CARRIER_PHASES]; //carrier for each shift
+        double *in_phase; //cos(2 pi f t), I mixer
+        double *quadrature; //-sin(2 pi f t), Q mixer
+} carrier_t;
+
+typedef struct { //carrier waveforms from one discrete time on
+        const double *table[CARRIER_PHASES];
+        const double *in_phase;
+        const double *quadrature;
+} carrier_span_t;
+
+typedef struct { //NCO output, owned by one modulator or demodulator
+        size_t start; //discrete time of the first sample
+        size_t len; //synthesized samples, 0 if none yet
+        double table[CARRIER_PHASES][CARRIER_WINDOW];
+        double in_phase[CARRIER_WINDOW];
+        double quadrature[CARRIER_WINDOW];
+} carrier_window_t;
+
+
+/**
+ * \brief Precompute carrier tables.
+ *
+ * Carrier with frequency freq sampled at sample_rate repeats every
+ * sample_rate / gcd(sample_rate, freq) samples, so one period for each phase
+ * shift and for both I/Q mixers is all we ever need. Short periods are
+ * repeated up to CARRIER_MIN_LEN samples, so vector kernels can walk long
+ * contiguous runs of the tables.
+ *
+ * Periods longer than CARRIER_MAX_PERIOD (frequencies nearly coprime with
+ * the sample rate) are not tabulated, the waveforms are synthesized into
+ * windows by the NCO instead (see carrier_span()).
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+int carrier_init(carrier_t *carrier, unsigned long sample_rate,
+                unsigned long freq);
+
+/**
+ * \brief Free carrier tables.
+ */
+void carrier_free(carrier_t *carrier);
+
+/**
+ * \brief NCO value cos(2 pi f t + phase) at discrete time.
+ *
+ * Phase accumulator freq * time is wrapped modulo the sample rate in
+ * integers, so the value is exact however long the stream is.
+ */
+double carrier_nco(const carrier_t *carrier, double phase, size_t time);
+
+/**
+ * \brief Synthesize the NCO window starting at discrete time.
+ *
+ * Complex rotator starts from the exact accumulator phase in every window,
+ * so its rounding errors never build up.
+ */
+void carrier_window_fill(const carrier_t *carrier, carrier_window_t *window,
+                size_t time);
+
+/**
+ * \brief Carrier value for phase shift index at discrete time.
+ */
+static inline double carrier_value(const carrier_t *carrier, size_t phase,
+                size_t time)
+{
+        if (carrier->nco) {
+                return carrier_nco(carrier, phase_shift[phase], time);
+        }
+
+        return carrier->table[phase][time % carrier->period];
+}
+
+/**
+ * \brief Number of contiguous table items available from discrete time.
+ *
+ * Table pointers for the time are table + time % period. Tables only.
+ */
+static inline size_t carrier_run(const carrier_t *carrier, size_t time)
+{
+        return carrier->len - time % carrier->period;
+}
+
+/**
+ * \brief Waveforms from discrete time on.
+ *
+ * Tables are used in place, the NCO refills the window if it doesn't hold
+ * at least min(want, CARRIER_WINDOW) samples from the time.
+ *
+ * \return Number of contiguous samples in the span, at least 1.
+ */
+static inline size_t carrier_span(const carrier_t *carrier,
+                carrier_window_t *window, size_t time, size_t want,
+                carrier_span_t *span)
+{
+        const double *base[CARRIER_PHASES + 2];
+        size_t offset, len;
+
+
+        if (carrier->nco) {
+                if (want > CARRIER_WINDOW) {
+                        want = CARRIER_WINDOW;
+                }
+                if (time < window->start ||
+                                time + want > window->start + window->len)
+                {
+                        carrier_window_fill(carrier, window, time);
+                }
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        base[j] = window->table[j];
+                }
+                base[CARRIER_PHASES] = window->in_phase;
+                base[CARRIER_PHASES + 1] = window->quadrature;
+                offset = time - window->start;
+                len = window->len;
+        } else {
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        base[j] = carrier->table[j];
+                }
+                base[CARRIER_PHASES] = carrier->in_phase;
+                base[CARRIER_PHASES + 1] = carrier->quadrature;
+                offset = time % carrier->period;
+                len = carrier->len;
+        }
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                span->table[j] = base[j] + offset;
+        }
+        span->in_phase = base[CARRIER_PHASES] + offset;
+        span->quadrature = base[CARRIER_PHASES + 1] + offset;
+
+        return len - offset;
+}
+
+/**
+ * \brief In-phase (I) mixer value at discrete time.
+ */
+static inline double carrier_i(const carrier_t *carrier, size_t time)
+{
+        if (carrier->nco) {
+                return carrier_nco(carrier, 0.0, time);
+        }
+
+        return carrier->in_phase[time % carrier->period];
+}
+
+/**
+ * \brief Quadrature (Q) mixer value at discrete time.
+ */
+static inline double carrier_q(const carrier_t *carrier, size_t time)
+{
+        if (carrier->nco) {
+                return carrier_nco(carrier, M_PI / 2.0, time);
+        }
+
+        return carrier->quadrature[time % carrier->period];
+}
+
+#endif //CARRIER_H
@@ -0,0 +1,86 @@
+/**
+ * \file constellation.c
+ * \brief Signal constellations, symbol index to I/Q point tables
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <string.h>
+#include <math.h> //HUGE_VAL
+
+#include "constellation.h"
+
+
+#define H 0.7071067811865476 //cos(pi / 4)
+#define C 0.9238795325112867 //cos(pi / 8)
+#define S 0.3826834323650898 //sin(pi / 8)
+#define A 0.7071067811865476 //QAM outer level, 3 / (3 * sqrt(2))
+#define B 0.2357022603955158 //QAM inner level, 1 / (3 * sqrt(2))
+
+
+static const constellation_t constellations[CONSTELLATION_COUNT] = {
+        [CONSTELLATION_QPSK] = {
+                CONSTELLATION_QPSK, "qpsk", 2, 4, 1.4142135623730951,
+                { { H, H }, { H, -H }, { -H, H }, { -H, -H } },
+        },
+        /* Phases pi / 8 + m * pi / 4, index is the Gray code of m. */
+        [CONSTELLATION_8PSK] = {
+                CONSTELLATION_8PSK, "8psk", 3, 8, 0.7653668647301796,
+                {
+                        { C, S }, { S, C }, { -C, S }, { -S, C },
+                        { C, -S }, { S, -C }, { -C, -S }, { -S, -C },
+                },
+        },
+        /* Two Gray coded bits per axis, first pair I, second Q:
+         * 00 -> -3, 01 -> -1, 11 -> +1, 10 -> +3. */
+        [CONSTELLATION_16QAM] = {
+                CONSTELLATION_16QAM, "16qam", 4, 16, 2.0 * B,
+                {
+                        { -A, -A }, { -A, -B }, { -A, A }, { -A, B },
+                        { -B, -A }, { -B, -B }, { -B, A }, { -B, B },
+                        { A, -A }, { A, -B }, { A, A }, { A, B },
+                        { B, -A }, { B, -B }, { B, A }, { B, B },
+                },
+        },
+};
+
+
+const constellation_t * constellation_get(constellation_id_t id)
+{
+        return &constellations[id];
+}
+
+const constellation_t * constellation_find(const char *name)
+{
+        for (size_t i = 0; i < CONSTELLATION_COUNT; ++i) {
+                if (strcmp(constellations[i].name, name) == 0) {
+                        return &constellations[i];
+                }
+        }
+
+        return NULL;
+}
+
+unsigned char constellation_decide(const constellation_t *constellation,
+                const double received[2], double *best, double *second)
+{
+        unsigned char best_idx = 0;
+
+
+        *best = *second = HUGE_VAL;
+        for (size_t j = 0; j < constellation->points; ++j) {
+                const double di = received[0] - constellation->point[j][0];
+                const double dq = received[1] - constellation->point[j][1];
+                const double dist = di * di + dq * dq;
+
+                if (dist < *best) {
+                        *second = *best;
+                        *best = dist;
+                        best_idx = j;
+                } else if (dist < *second) {
+                        *second = dist;
+                }
+        }
+
+        return best_idx;
+}
@@ -0,0 +1,64 @@
+/**
+ * \file constellation.h
+ * \brief Signal constellations, symbol index to I/Q point tables
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Point (x, y) is sent as x * cos(2 pi f t) - y * sin(2 pi f t), which is
+ * a * cos(2 pi f t + phi) for the point a * exp(i phi). Points are scaled
+ * to the QPSK amplitude: PSK points lie on the unit circle, the corners of
+ * the QAM grid too, so no constellation ever clips.
+ *
+ * Indices are Gray mapped, neighbouring points differ in one bit, so the
+ * most likely decision error costs one bit. QPSK keeps its historical
+ * mapping (2 * first_bit + second_bit, see phase_shift), which is Gray too.
+ */
+
+#ifndef CONSTELLATION_H
+#define CONSTELLATION_H
+
+#include <stddef.h>
+
+
+#define CONSTELLATION_MAX_POINTS 16
+
+
+typedef enum { //supported constellations
+        CONSTELLATION_QPSK, //4 phases, 2 bits per symbol
+        CONSTELLATION_8PSK, //8 phases, 3 bits per symbol
+        CONSTELLATION_16QAM, //4x4 grid, 4 bits per symbol
+        CONSTELLATION_COUNT,
+} constellation_id_t;
+
+typedef struct { //symbol index -> I/Q point
+        constellation_id_t id;
+        const char *name; //in the parameters
+        unsigned bits; //per symbol
+        size_t points; //2^bits
+        double spacing; //distance of the two closest points
+        double point[CONSTELLATION_MAX_POINTS][2]; //in-phase, quadrature
+} constellation_t;
+
+
+/**
+ * \brief Constellation table of the id.
+ */
+const constellation_t * constellation_get(constellation_id_t id);
+
+/**
+ * \brief Constellation table of the name ("qpsk", "8psk", "16qam").
+ *
+ * \return Table or NULL for an unknown name.
+ */
+const constellation_t * constellation_find(const char *name);
+
+/**
+ * \brief Index of the point closest to the received point.
+ *
+ * Squared distances of the closest point and of the runner-up are stored
+ * to best and second.
+ */
+unsigned char constellation_decide(const constellation_t *constellation,
+                const double received[2], double *best, double *second);
+
+#endif //CONSTELLATION_H
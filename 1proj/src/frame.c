@@ -0,0 +1,83 @@
+/**
+ * \file frame.c
+ * \brief Frame headers of the framed transmission
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include "frame.h"
+
+
+#define CRC_POLY 0x1021u
+#define CRC_INIT 0xFFFFu
+#define FIELD_SYMBOLS 8 //16 bit header field
+
+
+/* Shift one bit into the CRC. */
+static unsigned crc_bit(unsigned crc, unsigned bit)
+{
+        crc ^= bit << 15;
+
+        return ((crc & 0x8000u) ? (crc << 1) ^ CRC_POLY : crc << 1) & 0xFFFFu;
+}
+
+static unsigned crc_update(unsigned crc, const unsigned char *symbols,
+                size_t count)
+{
+        for (size_t i = 0; i < count; ++i) {
+                crc = crc_bit(crc, symbols[i] >> 1);
+                crc = crc_bit(crc, symbols[i] & 1);
+        }
+
+        return crc;
+}
+
+/* 16 bit field, MSB first, two bits per symbol. */
+static void field_pack(unsigned value, unsigned char *symbols)
+{
+        for (size_t i = 0; i < FIELD_SYMBOLS; ++i) {
+                symbols[i] = (value >> (14 - 2 * i)) & 0x3;
+        }
+}
+
+static unsigned field_unpack(const unsigned char *symbols)
+{
+        unsigned value = 0;
+
+
+        for (size_t i = 0; i < FIELD_SYMBOLS; ++i) {
+                value = (value << 2) | (symbols[i] & 0x3);
+        }
+
+        return value;
+}
+
+
+unsigned frame_crc(const unsigned char *symbols, size_t count)
+{
+        return crc_update(CRC_INIT, symbols, count);
+}
+
+void frame_header_pack(const frame_header_t *header, unsigned char *symbols)
+{
+        field_pack(header->seq & FRAME_SEQ_MASK, symbols);
+        field_pack(header->len, symbols + FIELD_SYMBOLS);
+        field_pack(header->crc, symbols + 2 * FIELD_SYMBOLS);
+        field_pack(frame_crc(symbols, 3 * FIELD_SYMBOLS),
+                        symbols + 3 * FIELD_SYMBOLS);
+}
+
+int frame_header_unpack(frame_header_t *header, const unsigned char *symbols)
+{
+        if (field_unpack(symbols + 3 * FIELD_SYMBOLS) !=
+                        frame_crc(symbols, 3 * FIELD_SYMBOLS))
+        {
+                return -1;
+        }
+
+        header->seq = field_unpack(symbols);
+        header->len = field_unpack(symbols + FIELD_SYMBOLS);
+        header->crc = field_unpack(symbols + 2 * FIELD_SYMBOLS);
+
+        return 0;
+}
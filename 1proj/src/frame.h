@@ -0,0 +1,61 @@
+/**
+ * \file frame.h
+ * \brief Frame headers of the framed transmission
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Framed transmission splits the payload into frames of a fixed number of
+ * symbols (the last one may be shorter). Every frame is the sync sequence,
+ * FRAME_HEADER_SYMBOLS of the header and the payload, carrier time 0 is the
+ * first sample of its sync sequence. Frames are therefore found and decoded
+ * independently of each other, a damaged frame costs only its own payload.
+ *
+ * Header is four 16 bit fields, MSB first: sequence number (modulo 2^16),
+ * payload length in symbols, CRC of the payload and CRC of the three fields
+ * before. CRC is CRC-16/CCITT (0x1021, initial 0xFFFF) of the bits.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+
+
+#define FRAME_HEADER_SYMBOLS 32 //four 16 bit fields
+#define FRAME_MAX_PAYLOAD 65535 //longest payload in symbols
+#define FRAME_SEQ_MASK 0xFFFFu //sequence numbers wrap around
+
+
+typedef struct { //decoded frame header
+        unsigned seq; //sequence number, modulo 2^16
+        size_t len; //payload symbols
+        unsigned crc; //CRC of the payload
+} frame_header_t;
+
+
+/**
+ * \brief CRC-16/CCITT of the bits of the phase shift indices.
+ */
+unsigned frame_crc(const unsigned char *symbols, size_t count);
+
+/**
+ * \brief Store the header as FRAME_HEADER_SYMBOLS phase shift indices.
+ */
+void frame_header_pack(const frame_header_t *header, unsigned char *symbols);
+
+/**
+ * \brief Parse FRAME_HEADER_SYMBOLS phase shift indices into the header.
+ *
+ * \return 0 on success, -1 if the header CRC does not match.
+ */
+int frame_header_unpack(frame_header_t *header, const unsigned char *symbols);
+
+/**
+ * \brief Number of symbols of a frame with the payload, sync included.
+ */
+static inline size_t frame_symbols(size_t sync_symbols, size_t payload)
+{
+        return sync_symbols + FRAME_HEADER_SYMBOLS + payload;
+}
+
+#endif //FRAME_H
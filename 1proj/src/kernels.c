@@ -0,0 +1,766 @@
+/**
+ * \file kernels.c
+ * \brief Vectorized DSP kernels with runtime CPU dispatch
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Every kernel has a scalar version and, on x86, SSE2 and AVX2 versions
+ * compiled with target attributes, so the binary runs everywhere and the
+ * best version is picked at runtime. Vector versions process the bulk of
+ * the data and leave the tail to the scalar version, which is always inlined
+ * to avoid calls (and SSE/AVX transitions) from the vector code.
+ */
+
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+
+/*
+ * Fixed symbol length kernels. The generic kernels of the instruction set
+ * are inlined with a constant length, one copy for every hot length.
+ */
+#define FIXED_SYMBOL_LENS(X, isa, attr) \
+        X(isa, attr, 18) X(isa, attr, 30) X(isa, attr, 36)
+
+#define FIXED_BODIES(isa, attr) \
+attr KERNEL_INLINE void synth_fixed_##isa(int *out, \
+                const unsigned char *symbols, size_t count, \
+                const double *const table[CARRIER_PHASES], size_t offset, \
+                size_t period, double amplitude, size_t n) \
+{ \
+        for (size_t s = 0; s < count; ++s, out += n) { \
+                synth_##isa(out, table[symbols[s]] + offset, n, amplitude); \
+                offset = fixed_next(offset, n, period); \
+        } \
+} \
+attr KERNEL_INLINE void hist_fixed_##isa( \
+                size_t histogram[][CARRIER_PHASES], const double *samples, \
+                const double *const table[CARRIER_PHASES], size_t offset, \
+                size_t period, size_t count, double threshold, size_t n) \
+{ \
+        for (size_t s = 0; s < count; ++s, samples += n) { \
+                const double *ref[CARRIER_PHASES]; \
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) { \
+                        histogram[s][j] = 0; \
+                        ref[j] = table[j] + offset; \
+                } \
+                hist_##isa(histogram[s], samples, ref, n, threshold); \
+                offset = fixed_next(offset, n, period); \
+        } \
+} \
+attr KERNEL_INLINE void corr_fixed_##isa(double acc[][2], \
+                const double *samples, const double *in_phase, \
+                const double *quadrature, size_t offset, size_t period, \
+                size_t count, size_t n) \
+{ \
+        for (size_t s = 0; s < count; ++s, samples += n) { \
+                acc[s][0] = acc[s][1] = 0.0; \
+                corr_##isa(&acc[s][0], &acc[s][1], samples, \
+                                in_phase + offset, quadrature + offset, n); \
+                offset = fixed_next(offset, n, period); \
+        } \
+}
+
+#define FIXED_WRAPPERS(isa, attr, n) \
+attr static void synth##n##_##isa(int *out, const unsigned char *symbols, \
+                size_t count, const double *const table[CARRIER_PHASES], \
+                size_t offset, size_t period, double amplitude) \
+{ \
+        synth_fixed_##isa(out, symbols, count, table, offset, period, \
+                        amplitude, n); \
+} \
+attr static void hist##n##_##isa(size_t histogram[][CARRIER_PHASES], \
+                const double *samples, \
+                const double *const table[CARRIER_PHASES], size_t offset, \
+                size_t period, size_t count, double threshold) \
+{ \
+        hist_fixed_##isa(histogram, samples, table, offset, period, count, \
+                        threshold, n); \
+} \
+attr static void corr##n##_##isa(double acc[][2], const double *samples, \
+                const double *in_phase, const double *quadrature, \
+                size_t offset, size_t period, size_t count) \
+{ \
+        corr_fixed_##isa(acc, samples, in_phase, quadrature, offset, period, \
+                        count, n); \
+}
+
+#define FIXED_ENTRY(isa, attr, n) \
+        { n, synth##n##_##isa, hist##n##_##isa, corr##n##_##isa },
+
+#define FIXED_KERNELS(isa, attr) \
+        FIXED_BODIES(isa, attr) \
+        FIXED_SYMBOL_LENS(FIXED_WRAPPERS, isa, attr) \
+        static const kernels_fixed_t fixed_##isa[] = { \
+                FIXED_SYMBOL_LENS(FIXED_ENTRY, isa, attr) \
+                { 0, NULL, NULL, NULL }, \
+        };
+
+
+/* Table offset of the next symbol. */
+KERNEL_INLINE size_t fixed_next(size_t offset, size_t n, size_t period)
+{
+        offset += n;
+        while (offset >= period) { //once or twice for the hot lengths
+                offset -= period;
+        }
+
+        return offset;
+}
+
+
+/*
+ * Scalar kernels.
+ */
+KERNEL_INLINE void synth_scalar(int *out, const double *carrier, size_t n,
+                double amplitude)
+{
+        for (size_t i = 0; i < n; ++i) {
+                out[i] = amplitude * carrier[i];
+        }
+}
+
+KERNEL_INLINE void normalize_scalar(double *out, const int *in, size_t n,
+                double amplitude)
+{
+        for (size_t i = 0; i < n; ++i) {
+                out[i] = (double)in[i] / amplitude;
+        }
+}
+
+KERNEL_INLINE void hist_scalar(size_t histogram[CARRIER_PHASES],
+                const double *samples, const double *const ref[CARRIER_PHASES],
+                size_t n, double threshold)
+{
+        for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        histogram[j] += fabs(ref[j][i] - samples[i]) <
+                                threshold;
+                }
+        }
+}
+
+KERNEL_INLINE void corr_scalar(double *acc_i, double *acc_q, const double *samples,
+                const double *ref_i, const double *ref_q, size_t n)
+{
+        for (size_t i = 0; i < n; ++i) {
+                *acc_i += samples[i] * ref_i[i];
+                *acc_q += samples[i] * ref_q[i];
+        }
+}
+
+KERNEL_INLINE void hist_s16_scalar(size_t histogram[CARRIER_PHASES],
+                const int16_t *samples, const int16_t *const ref[CARRIER_PHASES],
+                size_t n, int threshold)
+{
+        for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        const int d = ref[j][i] - samples[i];
+
+                        histogram[j] += (d < threshold && d > -threshold);
+                }
+        }
+}
+
+KERNEL_INLINE void hist_u8_scalar(size_t histogram[CARRIER_PHASES],
+                const uint8_t *samples, const int16_t *const ref[CARRIER_PHASES],
+                size_t n, int threshold)
+{
+        for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        const int d = ref[j][i] - (samples[i] - 128);
+
+                        histogram[j] += (d < threshold && d > -threshold);
+                }
+        }
+}
+
+KERNEL_INLINE void corr_s16_scalar(long long *acc_i, long long *acc_q,
+                const int16_t *samples, const int16_t *ref_i,
+                const int16_t *ref_q, size_t n)
+{
+        for (size_t i = 0; i < n; ++i) {
+                *acc_i += samples[i] * ref_i[i];
+                *acc_q += samples[i] * ref_q[i];
+        }
+}
+
+KERNEL_INLINE void corr_u8_scalar(long long *acc_i, long long *acc_q,
+                const uint8_t *samples, const int16_t *ref_i,
+                const int16_t *ref_q, size_t n)
+{
+        for (size_t i = 0; i < n; ++i) {
+                *acc_i += (samples[i] - 128) * ref_i[i];
+                *acc_q += (samples[i] - 128) * ref_q[i];
+        }
+}
+
+FIXED_KERNELS(scalar, )
+
+static const kernels_t kernels_scalar = {
+        .name = "scalar",
+        .synth = synth_scalar,
+        .normalize = normalize_scalar,
+        .hist = hist_scalar,
+        .corr = corr_scalar,
+        .hist_s16 = hist_s16_scalar,
+        .hist_u8 = hist_u8_scalar,
+        .corr_s16 = corr_s16_scalar,
+        .corr_u8 = corr_u8_scalar,
+        .fixed = fixed_scalar,
+};
+
+
+#ifdef KERNELS_X86
+/*
+ * SSE2 kernels, 2 doubles per vector.
+ */
+__attribute__((target("sse2")))
+KERNEL_INLINE void synth_sse2(int *out, const double *carrier, size_t n,
+                double amplitude)
+{
+        const __m128d amp = _mm_set1_pd(amplitude);
+        size_t i = 0;
+
+
+        for (; i + 4 <= n; i += 4) {
+                const __m128i lo = _mm_cvttpd_epi32(_mm_mul_pd(amp,
+                                        _mm_loadu_pd(carrier + i)));
+                const __m128i hi = _mm_cvttpd_epi32(_mm_mul_pd(amp,
+                                        _mm_loadu_pd(carrier + i + 2)));
+
+                _mm_storeu_si128((__m128i *)(out + i),
+                                _mm_unpacklo_epi64(lo, hi));
+        }
+        synth_scalar(out + i, carrier + i, n - i, amplitude);
+}
+
+__attribute__((target("sse2")))
+static void normalize_sse2(double *out, const int *in, size_t n,
+                double amplitude)
+{
+        const __m128d amp = _mm_set1_pd(amplitude);
+        size_t i = 0;
+
+
+        for (; i + 4 <= n; i += 4) {
+                const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+
+                _mm_storeu_pd(out + i, _mm_div_pd(_mm_cvtepi32_pd(v), amp));
+                _mm_storeu_pd(out + i + 2, _mm_div_pd(_mm_cvtepi32_pd(
+                                                _mm_srli_si128(v, 8)), amp));
+        }
+        normalize_scalar(out + i, in + i, n - i, amplitude);
+}
+
+__attribute__((target("sse2")))
+KERNEL_INLINE void hist_sse2(size_t histogram[CARRIER_PHASES],
+                const double *samples, const double *const ref[CARRIER_PHASES],
+                size_t n, double threshold)
+{
+        const __m128d sign = _mm_set1_pd(-0.0);
+        const __m128d thr = _mm_set1_pd(threshold);
+        __m128i cnt[CARRIER_PHASES];
+        size_t i = 0;
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                cnt[j] = _mm_setzero_si128();
+        }
+
+        for (; i + 2 <= n; i += 2) {
+                const __m128d x = _mm_loadu_pd(samples + i);
+
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        const __m128d d = _mm_andnot_pd(sign, _mm_sub_pd(
+                                                _mm_loadu_pd(ref[j] + i), x));
+
+                        /* Mask is all ones (-1) for hits. */
+                        cnt[j] = _mm_sub_epi64(cnt[j], _mm_castpd_si128(
+                                                _mm_cmplt_pd(d, thr)));
+                }
+        }
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                long long lanes[2];
+
+                _mm_storeu_si128((__m128i *)lanes, cnt[j]);
+                histogram[j] += lanes[0] + lanes[1];
+        }
+
+        if (i < n) {
+                const double *tail[CARRIER_PHASES];
+
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        tail[j] = ref[j] + i;
+                }
+                hist_scalar(histogram, samples + i, tail, n - i, threshold);
+        }
+}
+
+__attribute__((target("sse2")))
+KERNEL_INLINE void corr_sse2(double *acc_i, double *acc_q,
+                const double *samples, const double *ref_i,
+                const double *ref_q, size_t n)
+{
+        __m128d vi = _mm_setzero_pd();
+        __m128d vq = _mm_setzero_pd();
+        double lanes[2];
+        size_t i = 0;
+
+
+        for (; i + 2 <= n; i += 2) {
+                const __m128d x = _mm_loadu_pd(samples + i);
+
+                vi = _mm_add_pd(vi, _mm_mul_pd(x, _mm_loadu_pd(ref_i + i)));
+                vq = _mm_add_pd(vq, _mm_mul_pd(x, _mm_loadu_pd(ref_q + i)));
+        }
+
+        _mm_storeu_pd(lanes, vi);
+        *acc_i += lanes[0] + lanes[1];
+        _mm_storeu_pd(lanes, vq);
+        *acc_q += lanes[0] + lanes[1];
+        corr_scalar(acc_i, acc_q, samples + i, ref_i + i, ref_q + i, n - i);
+}
+
+FIXED_KERNELS(sse2, __attribute__((target("sse2"))))
+
+/* Narrow kernels need abs and sign extension missing in SSE2. */
+static const kernels_t kernels_sse2 = {
+        .name = "sse2",
+        .synth = synth_sse2,
+        .normalize = normalize_sse2,
+        .hist = hist_sse2,
+        .corr = corr_sse2,
+        .hist_s16 = hist_s16_scalar,
+        .hist_u8 = hist_u8_scalar,
+        .corr_s16 = corr_s16_scalar,
+        .corr_u8 = corr_u8_scalar,
+        .fixed = fixed_sse2,
+};
+
+
+/*
+ * AVX2 kernels, 4 doubles per vector.
+ */
+__attribute__((target("avx2")))
+KERNEL_INLINE void synth_avx2(int *out, const double *carrier, size_t n,
+                double amplitude)
+{
+        const __m256d amp = _mm256_set1_pd(amplitude);
+        size_t i = 0;
+
+
+        for (; i + 8 <= n; i += 8) {
+                const __m128i lo = _mm256_cvttpd_epi32(_mm256_mul_pd(amp,
+                                        _mm256_loadu_pd(carrier + i)));
+                const __m128i hi = _mm256_cvttpd_epi32(_mm256_mul_pd(amp,
+                                        _mm256_loadu_pd(carrier + i + 4)));
+
+                _mm256_storeu_si256((__m256i *)(out + i),
+                                _mm256_set_m128i(hi, lo));
+        }
+        synth_scalar(out + i, carrier + i, n - i, amplitude);
+}
+
+__attribute__((target("avx2")))
+static void normalize_avx2(double *out, const int *in, size_t n,
+                double amplitude)
+{
+        const __m256d amp = _mm256_set1_pd(amplitude);
+        size_t i = 0;
+
+
+        for (; i + 8 <= n; i += 8) {
+                const __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+
+                _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_cvtepi32_pd(
+                                                _mm256_castsi256_si128(v)),
+                                        amp));
+                _mm256_storeu_pd(out + i + 4, _mm256_div_pd(_mm256_cvtepi32_pd(
+                                                _mm256_extracti128_si256(v, 1)),
+                                        amp));
+        }
+        normalize_scalar(out + i, in + i, n - i, amplitude);
+}
+
+__attribute__((target("avx2")))
+KERNEL_INLINE void hist_avx2(size_t histogram[CARRIER_PHASES],
+                const double *samples, const double *const ref[CARRIER_PHASES],
+                size_t n, double threshold)
+{
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        const __m256d thr = _mm256_set1_pd(threshold);
+        __m256i cnt[CARRIER_PHASES];
+        size_t i = 0;
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                cnt[j] = _mm256_setzero_si256();
+        }
+
+        for (; i + 4 <= n; i += 4) {
+                const __m256d x = _mm256_loadu_pd(samples + i);
+
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        const __m256d d = _mm256_andnot_pd(sign, _mm256_sub_pd(
+                                                _mm256_loadu_pd(ref[j] + i),
+                                                x));
+
+                        /* Mask is all ones (-1) for hits. */
+                        cnt[j] = _mm256_sub_epi64(cnt[j], _mm256_castpd_si256(
+                                                _mm256_cmp_pd(d, thr,
+                                                        _CMP_LT_OQ)));
+                }
+        }
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                long long lanes[4];
+
+                _mm256_storeu_si256((__m256i *)lanes, cnt[j]);
+                histogram[j] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+
+        if (i < n) {
+                const double *tail[CARRIER_PHASES];
+
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        tail[j] = ref[j] + i;
+                }
+                hist_scalar(histogram, samples + i, tail, n - i, threshold);
+        }
+}
+
+__attribute__((target("avx2,fma")))
+KERNEL_INLINE void corr_avx2(double *acc_i, double *acc_q,
+                const double *samples, const double *ref_i,
+                const double *ref_q, size_t n)
+{
+        __m256d vi = _mm256_setzero_pd();
+        __m256d vq = _mm256_setzero_pd();
+        double lanes[4];
+        size_t i = 0;
+
+
+        for (; i + 4 <= n; i += 4) {
+                const __m256d x = _mm256_loadu_pd(samples + i);
+
+                vi = _mm256_fmadd_pd(x, _mm256_loadu_pd(ref_i + i), vi);
+                vq = _mm256_fmadd_pd(x, _mm256_loadu_pd(ref_q + i), vq);
+        }
+
+        _mm256_storeu_pd(lanes, vi);
+        *acc_i += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm256_storeu_pd(lanes, vq);
+        *acc_q += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        corr_scalar(acc_i, acc_q, samples + i, ref_i + i, ref_q + i, n - i);
+}
+
+/* 16 narrow samples against all references, hits summed in 32 bit lanes.
+ * Saturated difference -32768 stays negative after abs, so the unsigned
+ * comparison takes it as a miss. */
+__attribute__((target("avx2")))
+static inline void hist16_step_avx2(__m256i cnt[CARRIER_PHASES], __m256i x,
+                const int16_t *const ref[CARRIER_PHASES], size_t i,
+                __m256i thr)
+{
+        const __m256i ones = _mm256_set1_epi16(1);
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                const __m256i d = _mm256_abs_epi16(_mm256_subs_epi16(
+                                        _mm256_loadu_si256((const __m256i *)
+                                                (ref[j] + i)), x));
+                const __m256i hit = _mm256_cmpeq_epi16(
+                                _mm256_min_epu16(d, thr), d);
+
+                cnt[j] = _mm256_sub_epi32(cnt[j], _mm256_madd_epi16(hit, ones));
+        }
+}
+
+/* Same for 8 samples, symbols are often shorter than two full vectors. */
+__attribute__((target("avx2")))
+static inline void hist8_step_avx2(__m256i cnt[CARRIER_PHASES], __m128i x,
+                const int16_t *const ref[CARRIER_PHASES], size_t i,
+                __m256i thr)
+{
+        const __m128i ones = _mm_set1_epi16(1);
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                const __m128i d = _mm_abs_epi16(_mm_subs_epi16(
+                                        _mm_loadu_si128((const __m128i *)
+                                                (ref[j] + i)), x));
+                const __m128i hit = _mm_cmpeq_epi16(_mm_min_epu16(d,
+                                        _mm256_castsi256_si128(thr)), d);
+
+                cnt[j] = _mm256_sub_epi32(cnt[j], _mm256_inserti128_si256(
+                                        _mm256_setzero_si256(),
+                                        _mm_madd_epi16(hit, ones), 0));
+        }
+}
+
+__attribute__((target("avx2")))
+static inline void hist16_sum_avx2(size_t histogram[CARRIER_PHASES],
+                const __m256i cnt[CARRIER_PHASES])
+{
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                int lanes[8];
+
+                _mm256_storeu_si256((__m256i *)lanes, cnt[j]);
+                for (size_t k = 0; k < 8; ++k) {
+                        histogram[j] += lanes[k];
+                }
+        }
+}
+
+/* Products of 16 narrow samples, accumulated in 64 bit lanes. */
+__attribute__((target("avx2")))
+static inline void corr16_step_avx2(__m256i *vi, __m256i *vq, __m256i x,
+                const int16_t *ref_i, const int16_t *ref_q)
+{
+        const __m256i pi = _mm256_madd_epi16(x, _mm256_loadu_si256(
+                                (const __m256i *)ref_i));
+        const __m256i pq = _mm256_madd_epi16(x, _mm256_loadu_si256(
+                                (const __m256i *)ref_q));
+
+        *vi = _mm256_add_epi64(*vi, _mm256_add_epi64(
+                                _mm256_cvtepi32_epi64(
+                                        _mm256_castsi256_si128(pi)),
+                                _mm256_cvtepi32_epi64(
+                                        _mm256_extracti128_si256(pi, 1))));
+        *vq = _mm256_add_epi64(*vq, _mm256_add_epi64(
+                                _mm256_cvtepi32_epi64(
+                                        _mm256_castsi256_si128(pq)),
+                                _mm256_cvtepi32_epi64(
+                                        _mm256_extracti128_si256(pq, 1))));
+}
+
+__attribute__((target("avx2")))
+static inline void corr8_step_avx2(__m256i *vi, __m256i *vq, __m128i x,
+                const int16_t *ref_i, const int16_t *ref_q)
+{
+        const __m128i pi = _mm_madd_epi16(x, _mm_loadu_si128(
+                                (const __m128i *)ref_i));
+        const __m128i pq = _mm_madd_epi16(x, _mm_loadu_si128(
+                                (const __m128i *)ref_q));
+
+        *vi = _mm256_add_epi64(*vi, _mm256_cvtepi32_epi64(pi));
+        *vq = _mm256_add_epi64(*vq, _mm256_cvtepi32_epi64(pq));
+}
+
+__attribute__((target("avx2")))
+static inline void corr16_sum_avx2(long long *acc_i, long long *acc_q,
+                __m256i vi, __m256i vq)
+{
+        long long lanes[4];
+
+
+        _mm256_storeu_si256((__m256i *)lanes, vi);
+        *acc_i += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        _mm256_storeu_si256((__m256i *)lanes, vq);
+        *acc_q += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static void hist_s16_avx2(size_t histogram[CARRIER_PHASES],
+                const int16_t *samples, const int16_t *const ref[CARRIER_PHASES],
+                size_t n, int threshold)
+{
+        const __m256i thr = _mm256_set1_epi16(threshold - 1);
+        __m256i cnt[CARRIER_PHASES];
+        const int16_t *tail[CARRIER_PHASES];
+        size_t i = 0;
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                cnt[j] = _mm256_setzero_si256();
+        }
+        for (; i + 16 <= n; i += 16) {
+                hist16_step_avx2(cnt, _mm256_loadu_si256((const __m256i *)
+                                        (samples + i)), ref, i, thr);
+        }
+        if (i + 8 <= n) {
+                hist8_step_avx2(cnt, _mm_loadu_si128((const __m128i *)
+                                        (samples + i)), ref, i, thr);
+                i += 8;
+        }
+        hist16_sum_avx2(histogram, cnt);
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                tail[j] = ref[j] + i;
+        }
+        hist_s16_scalar(histogram, samples + i, tail, n - i, threshold);
+}
+
+__attribute__((target("avx2")))
+static void hist_u8_avx2(size_t histogram[CARRIER_PHASES],
+                const uint8_t *samples, const int16_t *const ref[CARRIER_PHASES],
+                size_t n, int threshold)
+{
+        const __m256i thr = _mm256_set1_epi16(threshold - 1);
+        const __m256i bias = _mm256_set1_epi16(128);
+        __m256i cnt[CARRIER_PHASES];
+        const int16_t *tail[CARRIER_PHASES];
+        size_t i = 0;
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                cnt[j] = _mm256_setzero_si256();
+        }
+        for (; i + 16 <= n; i += 16) {
+                const __m256i x = _mm256_sub_epi16(_mm256_cvtepu8_epi16(
+                                        _mm_loadu_si128((const __m128i *)
+                                                (samples + i))), bias);
+
+                hist16_step_avx2(cnt, x, ref, i, thr);
+        }
+        if (i + 8 <= n) {
+                const __m128i x = _mm_sub_epi16(_mm_cvtepu8_epi16(
+                                        _mm_loadl_epi64((const __m128i *)
+                                                (samples + i))),
+                                _mm256_castsi256_si128(bias));
+
+                hist8_step_avx2(cnt, x, ref, i, thr);
+                i += 8;
+        }
+        hist16_sum_avx2(histogram, cnt);
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                tail[j] = ref[j] + i;
+        }
+        hist_u8_scalar(histogram, samples + i, tail, n - i, threshold);
+}
+
+__attribute__((target("avx2")))
+static void corr_s16_avx2(long long *acc_i, long long *acc_q,
+                const int16_t *samples, const int16_t *ref_i,
+                const int16_t *ref_q, size_t n)
+{
+        __m256i vi = _mm256_setzero_si256();
+        __m256i vq = _mm256_setzero_si256();
+        size_t i = 0;
+
+
+        for (; i + 16 <= n; i += 16) {
+                corr16_step_avx2(&vi, &vq, _mm256_loadu_si256(
+                                        (const __m256i *)(samples + i)),
+                                ref_i + i, ref_q + i);
+        }
+        if (i + 8 <= n) {
+                corr8_step_avx2(&vi, &vq, _mm_loadu_si128((const __m128i *)
+                                        (samples + i)), ref_i + i, ref_q + i);
+                i += 8;
+        }
+        corr16_sum_avx2(acc_i, acc_q, vi, vq);
+        corr_s16_scalar(acc_i, acc_q, samples + i, ref_i + i, ref_q + i,
+                        n - i);
+}
+
+__attribute__((target("avx2")))
+static void corr_u8_avx2(long long *acc_i, long long *acc_q,
+                const uint8_t *samples, const int16_t *ref_i,
+                const int16_t *ref_q, size_t n)
+{
+        const __m256i bias = _mm256_set1_epi16(128);
+        __m256i vi = _mm256_setzero_si256();
+        __m256i vq = _mm256_setzero_si256();
+        size_t i = 0;
+
+
+        for (; i + 16 <= n; i += 16) {
+                const __m256i x = _mm256_sub_epi16(_mm256_cvtepu8_epi16(
+                                        _mm_loadu_si128((const __m128i *)
+                                                (samples + i))), bias);
+
+                corr16_step_avx2(&vi, &vq, x, ref_i + i, ref_q + i);
+        }
+        if (i + 8 <= n) {
+                const __m128i x = _mm_sub_epi16(_mm_cvtepu8_epi16(
+                                        _mm_loadl_epi64((const __m128i *)
+                                                (samples + i))),
+                                _mm256_castsi256_si128(bias));
+
+                corr8_step_avx2(&vi, &vq, x, ref_i + i, ref_q + i);
+                i += 8;
+        }
+        corr16_sum_avx2(acc_i, acc_q, vi, vq);
+        corr_u8_scalar(acc_i, acc_q, samples + i, ref_i + i, ref_q + i,
+                        n - i);
+}
+
+FIXED_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+
+static const kernels_t kernels_avx2 = {
+        .name = "avx2",
+        .synth = synth_avx2,
+        .normalize = normalize_avx2,
+        .hist = hist_avx2,
+        .corr = corr_avx2,
+        .hist_s16 = hist_s16_avx2,
+        .hist_u8 = hist_u8_avx2,
+        .corr_s16 = corr_s16_avx2,
+        .corr_u8 = corr_u8_avx2,
+        .fixed = fixed_avx2,
+};
+#endif //KERNELS_X86
+
+
+const kernels_fixed_t * kernels_fixed(const kernels_t *kernels,
+                size_t symbol_len)
+{
+        for (const kernels_fixed_t *fixed = kernels->fixed;
+                        fixed->symbol_len != 0; ++fixed)
+        {
+                if (fixed->symbol_len == symbol_len) {
+                        return fixed;
+                }
+        }
+
+        return NULL;
+}
+
+const kernels_t * kernels_get(kernels_isa_t isa)
+{
+#ifdef KERNELS_X86
+        __builtin_cpu_init();
+        const int have_sse2 = __builtin_cpu_supports("sse2");
+        const int have_avx2 = __builtin_cpu_supports("avx2") &&
+                __builtin_cpu_supports("fma");
+#endif
+
+
+        switch (isa) {
+        case KERNELS_AUTO:
+#ifdef KERNELS_X86
+                if (have_avx2) {
+                        return &kernels_avx2;
+                } else if (have_sse2) {
+                        return &kernels_sse2;
+                }
+#endif
+                return &kernels_scalar;
+
+        case KERNELS_SCALAR:
+                return &kernels_scalar;
+
+#ifdef KERNELS_X86
+        case KERNELS_SSE2:
+                return have_sse2 ? &kernels_sse2 : NULL;
+
+        case KERNELS_AVX2:
+                return have_avx2 ? &kernels_avx2 : NULL;
+#endif
+
+        default:
+                return NULL;
+        }
+}
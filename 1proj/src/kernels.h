@@ -0,0 +1,114 @@
+/**
+ * \file kernels.h
+ * \brief Vectorized DSP kernels with runtime CPU dispatch
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "carrier.h"
+
+
+#define KERNELS_FIXED_SYMBOLS 64 //most symbols decided by one fixed call
+
+
+typedef enum { //instruction set selection
+        KERNELS_AUTO, //best one supported by the CPU
+        KERNELS_SCALAR,
+        KERNELS_SSE2,
+        KERNELS_AVX2,
+} kernels_isa_t;
+
+/* Kernels for one symbol length known at compile time, whole symbols only.
+ * Symbol s starts at offset + s * symbol_len modulo period of the tables,
+ * which have to be contiguous for period - 1 + symbol_len items. */
+typedef struct {
+        size_t symbol_len; //0 terminates the table
+
+        /* Synthesize count symbols of phase shift indices. */
+        void (*synth)(int *out, const unsigned char *symbols, size_t count,
+                        const double *const table[CARRIER_PHASES],
+                        size_t offset, size_t period, double amplitude);
+
+        /* Threshold histogram of every symbol, histogram is overwritten. */
+        void (*hist)(size_t histogram[][CARRIER_PHASES],
+                        const double *samples,
+                        const double *const table[CARRIER_PHASES],
+                        size_t offset, size_t period, size_t count,
+                        double threshold);
+
+        /* I/Q correlation of every symbol, acc is overwritten. */
+        void (*corr)(double acc[][2], const double *samples,
+                        const double *in_phase, const double *quadrature,
+                        size_t offset, size_t period, size_t count);
+} kernels_fixed_t;
+
+typedef struct {
+        const char *name;
+
+        /* out[i] = (int)(amplitude * carrier[i]), C truncation semantics. */
+        void (*synth)(int *out, const double *carrier, size_t n,
+                        double amplitude);
+
+        /* out[i] = in[i] / amplitude */
+        void (*normalize)(double *out, const int *in, size_t n,
+                        double amplitude);
+
+        /* histogram[j] += count of |ref[j][i] - samples[i]| < threshold */
+        void (*hist)(size_t histogram[CARRIER_PHASES], const double *samples,
+                        const double *const ref[CARRIER_PHASES], size_t n,
+                        double threshold);
+
+        /* acc_i += sum(samples * ref_i), acc_q += sum(samples * ref_q) */
+        void (*corr)(double *acc_i, double *acc_q, const double *samples,
+                        const double *ref_i, const double *ref_q, size_t n);
+
+        /* Narrow samples used as they are, no conversion to double. Hist
+         * references are scaled to the sample amplitude, corr references
+         * to any 16 bit scale. U8 samples are offset binary (WAV PCM_8). */
+        void (*hist_s16)(size_t histogram[CARRIER_PHASES],
+                        const int16_t *samples,
+                        const int16_t *const ref[CARRIER_PHASES], size_t n,
+                        int threshold);
+        void (*hist_u8)(size_t histogram[CARRIER_PHASES],
+                        const uint8_t *samples,
+                        const int16_t *const ref[CARRIER_PHASES], size_t n,
+                        int threshold);
+        void (*corr_s16)(long long *acc_i, long long *acc_q,
+                        const int16_t *samples, const int16_t *ref_i,
+                        const int16_t *ref_q, size_t n);
+        void (*corr_u8)(long long *acc_i, long long *acc_q,
+                        const uint8_t *samples, const int16_t *ref_i,
+                        const int16_t *ref_q, size_t n);
+
+        const kernels_fixed_t *fixed; //hot symbol lengths, see kernels_fixed()
+} kernels_t;
+
+
+/**
+ * \brief Get kernels for the instruction set.
+ *
+ * \return Kernels or NULL if the CPU (or the compiler) doesn't support
+ *         the instruction set. KERNELS_AUTO never fails.
+ */
+const kernels_t * kernels_get(kernels_isa_t isa);
+
+/**
+ * \brief Get kernels specialised for the symbol length.
+ *
+ * Hot configurations (18, 30 and 36 samples, one period, the default and two
+ * periods at 18 kHz / 1 kHz) have their kernels compiled for the constant
+ * length, so the per symbol loops are unrolled and no length or table run
+ * is computed per symbol.
+ *
+ * \return Kernels or NULL if there are none for the symbol length.
+ */
+const kernels_fixed_t * kernels_fixed(const kernels_t *kernels,
+                size_t symbol_len);
+
+#endif //KERNELS_H
@@ -0,0 +1,381 @@
+/**
+ * \file loop.c
+ * \brief In-memory loopback: modulator, channel model and demodulator
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Pseudo-random symbols are modulated into a ring buffer, impaired by the
+ * channel (gain, DC offset, AWGN, dropped samples) on the way and decided
+ * by the demodulator straight from the ring. No files are touched, so the
+ * DSP paths may be stressed and soaked without measuring the disk. BER and
+ * throughput are reported as JSON on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "carrier.h"
+#include "qpsk.h"
+#include "batch.h" //batch_time
+
+
+#define FREQ 1000 //frequency [Hz]
+#define DEFAULT_SAMPLE_RATE 18000
+#define DEFAULT_SYMBOL_LEN 30
+#define DEFAULT_BITS (1 << 24)
+#define DEFAULT_SEED 42
+
+#define RING_SIZE (1 << 18) //samples, power of two
+#define BATCH_SYMBOLS 1024 //symbols modulated at once
+
+
+typedef struct { //channel model, applied to normalized samples
+        double gain; //multiplies the signal
+        double dc; //added to the signal
+        double noise; //standard deviation of the white Gaussian noise
+        double drop; //probability of a sample being lost
+        uint64_t rand; //generator state
+        size_t dropped; //number of lost samples
+} channel_t;
+
+typedef struct { //sample ring shared by the modulator and demodulator
+        int *buf;
+        size_t head; //samples written, only grows
+        size_t tail; //samples read, only grows
+} ring_t;
+
+
+/* xorshift64*, reproducible for the seed on every platform. */
+static uint64_t rand_next(uint64_t *state)
+{
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+
+        return *state * 2685821657736338717ull;
+}
+
+/* Uniform in (0, 1). */
+static double rand_uniform(uint64_t *state)
+{
+        return ((rand_next(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* Standard normal distribution, Box-Muller. */
+static double rand_normal(uint64_t *state)
+{
+        const double u1 = rand_uniform(state);
+        const double u2 = rand_uniform(state);
+
+        return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * \brief Pass samples through the channel into the ring.
+ *
+ * The ring has to have room for all the samples.
+ */
+static void channel_apply(channel_t *ch, const int *samples, size_t count,
+                ring_t *ring)
+{
+        const int impaired = (ch->gain != 1.0 || ch->dc != 0.0 ||
+                        ch->noise != 0.0);
+
+
+        for (size_t i = 0; i < count; ++i) {
+                double x;
+
+                if (ch->drop > 0.0 && rand_uniform(&ch->rand) < ch->drop) {
+                        ch->dropped++;
+                        continue;
+                }
+                if (!impaired) {
+                        ring->buf[ring->head++ & (RING_SIZE - 1)] =
+                                samples[i];
+                        continue;
+                }
+
+                x = samples[i] / (double)QPSK_AMPLITUDE;
+                x = x * ch->gain + ch->dc;
+                if (ch->noise != 0.0) {
+                        x += ch->noise * rand_normal(&ch->rand);
+                }
+
+                /* Clip to the sample range. */
+                x *= QPSK_AMPLITUDE;
+                if (x > INT32_MAX) {
+                        x = INT32_MAX;
+                } else if (x < INT32_MIN) {
+                        x = INT32_MIN;
+                }
+                ring->buf[ring->head++ & (RING_SIZE - 1)] = x;
+        }
+}
+
+/* Wrong bits of the decided symbols, sent ones come from the generator. */
+static size_t check_symbols(const unsigned char *rx, size_t count,
+                uint64_t *rand)
+{
+        size_t errors = 0;
+
+
+        for (size_t i = 0; i < count; ++i) {
+                const unsigned diff = rx[i] ^ (rand_next(rand) >> 62);
+
+                errors += (diff & 1) + (diff >> 1);
+        }
+
+        return errors;
+}
+
+static int parse_double(const char *str, double *val)
+{
+        char *endptr;
+
+
+        *val = strtod(str, &endptr);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
+        }
+
+        return 0;
+}
+
+static int parse_size(const char *str, size_t *val)
+{
+        char *endptr;
+
+
+        *val = strtoull(str, &endptr, 10);
+        if (*str == '\0' || *endptr != '\0') {
+                fprintf(stderr, "error: bad number %s\n", str);
+                return -1;
+        }
+
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        size_t bits = DEFAULT_BITS; //0 for unlimited
+        size_t sample_rate = DEFAULT_SAMPLE_RATE;
+        size_t symbol_len = DEFAULT_SYMBOL_LEN;
+        size_t seed = DEFAULT_SEED;
+        double duration = 0.0; //seconds, 0 for unlimited
+        qpsk_decision_t decision = QPSK_DECIDE_HIST;
+        channel_t ch = { .gain = 1.0 };
+        int ret;
+
+        carrier_t carrier;
+        qpsk_mod_t mod;
+        qpsk_demod_t demod;
+        qpsk_params_t params;
+        const char *bad_params;
+        ring_t ring = { NULL, 0, 0 };
+        int *samples; //modulator output
+        unsigned char tx[BATCH_SYMBOLS]; //transmitted symbols
+        unsigned char *rx; //decided symbols
+        uint64_t tx_rand, rx_rand; //same sequence for both sides
+        size_t tx_symbols = 0, rx_symbols = 0;
+        size_t bit_errors = 0;
+        int sync_failed = 0;
+        double start, seconds;
+
+
+        /* Options parsing. */
+        while ((ret = getopt(argc, argv, "a:d:g:l:m:n:p:R:S:t:")) != -1) {
+                switch (ret) {
+                case 'a': //AWGN standard deviation, relative to amplitude
+                        ret = parse_double(optarg, &ch.noise);
+                        break;
+
+                case 'd': //DC offset, relative to amplitude
+                        ret = parse_double(optarg, &ch.dc);
+                        break;
+
+                case 'g': //gain
+                        ret = parse_double(optarg, &ch.gain);
+                        break;
+
+                case 'l': //symbol length in samples
+                        ret = parse_size(optarg, &symbol_len);
+                        break;
+
+                case 'm': //symbol decision mode
+                        ret = 0;
+                        if (strcmp(optarg, "hist") == 0) {
+                                decision = QPSK_DECIDE_HIST;
+                        } else if (strcmp(optarg, "corr") == 0) {
+                                decision = QPSK_DECIDE_CORR;
+                        } else {
+                                fprintf(stderr, "error: bad decision mode "
+                                                "(hist or corr)\n");
+                                ret = -1;
+                        }
+                        break;
+
+                case 'n': //number of bits, 0 for unlimited
+                        ret = parse_size(optarg, &bits);
+                        break;
+
+                case 'p': //sample drop probability
+                        ret = parse_double(optarg, &ch.drop);
+                        break;
+
+                case 'R': //sample rate
+                        ret = parse_size(optarg, &sample_rate);
+                        break;
+
+                case 'S': //random generator seed
+                        ret = parse_size(optarg, &seed);
+                        break;
+
+                case 't': //duration in seconds, 0 for unlimited
+                        ret = parse_double(optarg, &duration);
+                        break;
+
+                default:
+                        return EXIT_FAILURE; //getopt already printed error
+                }
+                if (ret != 0) {
+                        return EXIT_FAILURE;
+                }
+        }
+        if (argc - optind != 0) {
+                fprintf(stderr, "error: bad argument count\n");
+                return EXIT_FAILURE;
+        } else if (symbol_len == 0 || symbol_len * BATCH_SYMBOLS >
+                        RING_SIZE / 2)
+        {
+                fprintf(stderr, "error: bad symbol length\n");
+                return EXIT_FAILURE;
+        } else if (sample_rate < FREQ) {
+                fprintf(stderr, "error: bad sample rate\n");
+                return EXIT_FAILURE;
+        }
+        qpsk_params_default(&params);
+        params.sample_rate = sample_rate;
+        params.freq = FREQ;
+        params.symbol_len = symbol_len;
+        if ((bad_params = qpsk_params_check(&params)) != NULL) {
+                fprintf(stderr, "error: %s\n", bad_params);
+                return EXIT_FAILURE;
+        }
+
+
+        /* Initializations. */
+        if (carrier_init(&carrier, sample_rate, FREQ) != 0) {
+                fprintf(stderr, "error: carrier tables allocation failed\n");
+                return EXIT_FAILURE;
+        }
+        ring.buf = malloc(RING_SIZE * sizeof (*ring.buf));
+        samples = malloc(BATCH_SYMBOLS * symbol_len * sizeof (*samples));
+        rx = malloc(RING_SIZE);
+        if (ring.buf == NULL || samples == NULL || rx == NULL ||
+                        qpsk_demod_init(&demod, &carrier, decision) != 0)
+        {
+                perror("malloc");
+                return EXIT_FAILURE;
+        }
+        qpsk_mod_init(&mod, &carrier, symbol_len);
+        tx_rand = rx_rand = seed ? seed : DEFAULT_SEED;
+        ch.rand = ~tx_rand;
+
+
+        start = batch_time();
+        channel_apply(&ch, samples, qpsk_mod_sync(&mod, samples), &ring);
+        for (;;) {
+                const size_t room = RING_SIZE - (ring.head - ring.tail);
+                size_t count = (bits == 0) ? BATCH_SYMBOLS :
+                        (bits + 1) / 2 - tx_symbols;
+
+                /* Modulator: fill the free part of the ring. */
+                if (count > BATCH_SYMBOLS) {
+                        count = BATCH_SYMBOLS;
+                }
+                if (count * symbol_len <= room && count > 0) {
+                        for (size_t i = 0; i < count; ++i) {
+                                tx[i] = rand_next(&tx_rand) >> 62;
+                        }
+                        channel_apply(&ch, samples, qpsk_mod_process(&mod,
+                                                tx, count, samples), &ring);
+                        tx_symbols += count;
+                }
+
+                /* Demodulator: drain the ring, contiguous runs at once. */
+                while (ring.tail < ring.head) {
+                        const size_t offset = ring.tail & (RING_SIZE - 1);
+                        const size_t run = (ring.head - ring.tail <
+                                        RING_SIZE - offset) ?
+                                ring.head - ring.tail : RING_SIZE - offset;
+                        const ssize_t decided = qpsk_demod_process(&demod,
+                                        ring.buf + offset, run, rx);
+
+                        ring.tail += run;
+                        if (decided == -1) {
+                                sync_failed = 1;
+                                break;
+                        }
+                        bit_errors += check_symbols(rx, decided, &rx_rand);
+                        rx_symbols += decided;
+                }
+
+                if (sync_failed || (bits != 0 && tx_symbols * 2 >= bits) ||
+                                (duration > 0.0 &&
+                                 batch_time() - start >= duration))
+                {
+                        break;
+                }
+        }
+        /* Symbols still buffered by the sync search. */
+        while (!sync_failed) {
+                const ssize_t decided = qpsk_demod_flush(&demod, rx,
+                                RING_SIZE);
+
+                if (decided <= 0) {
+                        sync_failed = (decided == -1);
+                        break;
+                }
+                bit_errors += check_symbols(rx, decided, &rx_rand);
+                rx_symbols += decided;
+        }
+        seconds = batch_time() - start;
+
+        /* Lost symbols (dropped samples, sync failure) are wrong bits. */
+        if (sync_failed || !qpsk_demod_synced(&demod)) {
+                sync_failed = 1;
+                bit_errors = tx_symbols * 2;
+        } else if (rx_symbols < tx_symbols) {
+                bit_errors += (tx_symbols - rx_symbols) * 2;
+        }
+
+
+        printf("{\"sample_rate\": %zu, \"symbol_len\": %zu, "
+                        "\"engine\": \"%s\", \"gain\": %g, \"dc\": %g, "
+                        "\"noise\": %g, \"drop\": %g, ", sample_rate,
+                        symbol_len, (decision == QPSK_DECIDE_CORR) ?
+                        "corr" : "hist", ch.gain, ch.dc, ch.noise, ch.drop);
+        printf("\"synced\": %s, \"bits\": %zu, \"bit_errors\": %zu, "
+                        "\"ber\": %.3e, \"ties\": %zu, \"low_margin\": %zu, "
+                        "\"dropped_samples\": %zu, ",
+                        sync_failed ? "false" : "true", tx_symbols * 2,
+                        bit_errors, (tx_symbols == 0) ? 0.0 :
+                        bit_errors / (tx_symbols * 2.0), demod.ties,
+                        demod.low_margin, ch.dropped);
+        printf("\"samples\": %zu, \"seconds\": %.6f, \"samples_per_s\": %.1f, "
+                        "\"bits_per_s\": %.1f}\n", ring.tail, seconds,
+                        ring.tail / seconds, tx_symbols * 2 / seconds);
+
+        qpsk_demod_free(&demod);
+        carrier_free(&carrier);
+        free(rx);
+        free(samples);
+        free(ring.buf);
+
+        return sync_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
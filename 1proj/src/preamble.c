@@ -0,0 +1,443 @@
+/**
+ * \file preamble.c
+ * \brief Search for the synchronization sequence at any offset of the input
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "preamble.h"
+
+
+#define PREAMBLE_MIN_CAP 4096 //initial buffer size in samples
+#define SUMS 4 //prefix sums per sample: x * I, x * Q, x, x * x
+
+
+/* Phase shift index of the sync symbol. */
+static size_t sync_symbol(const char *sync_seq, size_t idx)
+{
+        return 2 * (sync_seq[2 * idx] - '0') + (sync_seq[2 * idx + 1] - '0');
+}
+
+/* Sum of cos(alpha * t + beta) for t from first, count items. */
+static double cos_sum(double alpha, double beta, size_t first, size_t count)
+{
+        const double half = sin(alpha / 2.0);
+
+
+        if (fabs(half) < 1e-12) { //alpha is a multiple of 2 pi
+                return count * cos(alpha * first + beta);
+        }
+
+        return sin(count * alpha / 2.0) / half *
+                cos(alpha * (first + (count - 1) / 2.0) + beta);
+}
+
+/**
+ * \brief Sum and energy of the sync waveform for every candidate length.
+ *
+ * cos^2(x) = (1 + cos(2x)) / 2, sums of cosines have a closed form, so even
+ * long candidates are cheap. Energy is taken around the mean, as the input
+ * energy is (the DC offset is removed).
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+static int prepare(preamble_t *pre)
+{
+        const double omega = 2.0 * M_PI * pre->carrier->freq /
+                pre->carrier->sample_rate;
+        double *waves;
+
+
+        if (pre->min_len == 0) { //every length up to two carrier periods
+                pre->min_len = (PREAMBLE_MIN_SAMPLES + pre->sync_symbols -
+                                1) / pre->sync_symbols;
+                pre->max_len = 2 * pre->carrier->sample_rate /
+                        pre->carrier->freq;
+                pre->exact_min = 1;
+                pre->exact_max = (pre->min_len - 1 < pre->max_len) ?
+                        pre->min_len - 1 : pre->max_len;
+        } else if (pre->sync_symbols * pre->min_len < PREAMBLE_MIN_SAMPLES) {
+                pre->exact_min = pre->exact_max = pre->min_len;
+                pre->exact_only = 1;
+        }
+        pre->exact_next = pre->exact_min;
+        if (pre->max_len < pre->min_len) { //too short carrier, in vain
+                pre->max_len = pre->min_len;
+        }
+        waves = realloc(pre->waves, 2 * (pre->max_len - pre->min_len + 1) *
+                        sizeof (*waves));
+        if (waves == NULL) {
+                return -1;
+        }
+        pre->waves = waves;
+
+        for (size_t len = pre->min_len; len <= pre->max_len; ++len) {
+                const size_t samples = pre->sync_symbols * len;
+                double sum = 0.0;
+                double energy = samples / 2.0;
+
+                for (size_t j = 0; j < pre->sync_symbols; ++j) {
+                        const double phase = phase_shift[sync_symbol(
+                                        pre->sync_seq, j)];
+
+                        sum += cos_sum(omega, phase, j * len, len);
+                        energy += cos_sum(2.0 * omega, 2.0 * phase, j * len,
+                                        len) / 2.0;
+                }
+                waves[2 * (len - pre->min_len)] = sum;
+                waves[2 * (len - pre->min_len) + 1] = energy -
+                        sum * sum / samples;
+        }
+        pre->ready = 1;
+
+        return 0;
+}
+
+/* Make room for count more samples. */
+static int reserve(preamble_t *pre, size_t count)
+{
+        size_t cap = (pre->cap == 0) ? PREAMBLE_MIN_CAP : pre->cap;
+        double *samples, *sums;
+
+
+        while (cap < pre->len + count) {
+                cap *= 2;
+        }
+        if (cap == pre->cap) {
+                return 0;
+        }
+
+        samples = realloc(pre->samples, cap * sizeof (*samples));
+        if (samples == NULL) {
+                return -1;
+        }
+        pre->samples = samples;
+        sums = realloc(pre->sums, SUMS * (cap + 1) * sizeof (*sums));
+        if (sums == NULL) {
+                return -1;
+        }
+        pre->sums = sums;
+        pre->cap = cap;
+
+        return 0;
+}
+
+/**
+ * \brief Drop samples before the input sample from the buffer.
+ *
+ * Only done once at least half of the buffer goes, so every sample is moved
+ * a constant number of times on average. Prefix sums are rebased, so they
+ * never grow beyond the buffer.
+ */
+static void compact(preamble_t *pre, size_t keep)
+{
+        const size_t drop = keep - pre->start;
+        double base[SUMS];
+
+
+        if (drop == 0 || drop < pre->len / 2) {
+                return;
+        }
+
+        memcpy(base, pre->sums + SUMS * drop, sizeof (base));
+        memmove(pre->samples, pre->samples + drop,
+                        (pre->len - drop) * sizeof (*pre->samples));
+        for (size_t i = 0; i <= pre->len - drop; ++i) {
+                for (size_t c = 0; c < SUMS; ++c) {
+                        pre->sums[SUMS * i + c] =
+                                pre->sums[SUMS * (i + drop) + c] - base[c];
+                }
+        }
+        pre->start = keep;
+        pre->len -= drop;
+}
+
+/* Mix the new samples down and integrate them. */
+static void integrate(preamble_t *pre, size_t first, size_t count)
+{
+        double *sums = pre->sums + SUMS * first;
+
+
+        for (size_t i = first; i < first + count; ++i) {
+                const size_t time = pre->start + i;
+                const double x = pre->samples[i];
+
+                sums[SUMS] = sums[0] + x * carrier_i(pre->carrier, time);
+                sums[SUMS + 1] = sums[1] + x * carrier_q(pre->carrier, time);
+                sums[SUMS + 2] = sums[2] + x;
+                sums[SUMS + 3] = sums[3] + x * x;
+                sums += SUMS;
+        }
+}
+
+/**
+ * \brief Correlate the next offset with the candidate lengths up to max_len.
+ *
+ * Mixed sync symbol is A / 2 * exp(i (phase - omega * offset)), so the sums
+ * are rotated back by the phase shifts and by the offset, the real part is
+ * the correlation with the sync waveform starting at the offset. Mean of the
+ * input is removed from the correlation and from the energy.
+ */
+static void correlate(preamble_t *pre, size_t max_len)
+{
+        const size_t offset = pre->next;
+        const size_t symbols = pre->sync_symbols;
+        const double *first = pre->sums + SUMS * (offset - pre->start);
+        const double c = carrier_i(pre->carrier, offset);
+        const double q = carrier_q(pre->carrier, offset);
+
+
+        pre->next++;
+
+        /* Silence (zero samples) everywhere the candidates reach. */
+        if (first[SUMS * symbols * max_len + 3] - first[3] <
+                        PREAMBLE_MIN_POWER * symbols * pre->min_len)
+        {
+                return;
+        }
+
+        for (size_t len = pre->min_len; len <= max_len; ++len) {
+                const double *wave = pre->waves + 2 * (len - pre->min_len);
+                const double *last = first + SUMS * symbols * len;
+                const double samples = symbols * len;
+                const double mean = (last[2] - first[2]) / samples;
+                const double energy = last[3] - first[3] -
+                        mean * mean * samples;
+                double re = 0.0, im = 0.0;
+                double corr;
+
+                if (energy < PREAMBLE_MIN_POWER * samples) {
+                        continue;
+                }
+                for (size_t j = 0; j < symbols; ++j) {
+                        const double *from = first + SUMS * j * len;
+                        const double *to = from + SUMS * len;
+                        const double sum_i = to[0] - from[0];
+                        const double sum_q = to[1] - from[1];
+
+                        re += pre->ref[j][0] * sum_i + pre->ref[j][1] * sum_q;
+                        im += pre->ref[j][0] * sum_q - pre->ref[j][1] * sum_i;
+                }
+
+                corr = (re * c + im * q - mean * wave[0]) /
+                        sqrt(energy * wave[1]);
+                if (corr > pre->best && corr * sqrt(samples) >=
+                                PREAMBLE_MIN_SCORE)
+                {
+                        if (!pre->armed) {
+                                pre->armed = 1;
+                                pre->until = offset + symbols * pre->max_len;
+                        }
+                        pre->best = corr;
+                        pre->offset = offset;
+                        pre->symbol_len = len;
+                }
+        }
+}
+
+/* Whether the input starts with the sync waveform of the length exactly. */
+static int exact_match(const preamble_t *pre, size_t len)
+{
+        for (size_t t = 0; t < pre->sync_symbols * len; ++t) {
+                const size_t phase = sync_symbol(pre->sync_seq, t / len);
+
+                if (fabs(carrier_value(pre->carrier, phase, t) -
+                                        pre->samples[t]) >= pre->threshold)
+                {
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
+/**
+ * \brief Match the short candidates sample by sample at the input start.
+ *
+ * Shortest matching length wins, the first two sync symbols differ, so a
+ * shorter length fails at the latest on the first sample of the second one.
+ *
+ * \return 1 if found, 0 if more samples are needed, -1 if none matches.
+ */
+static int exact(preamble_t *pre)
+{
+        for (; pre->exact_next <= pre->exact_max; ++pre->exact_next) {
+                const size_t len = pre->exact_next;
+
+                if (pre->sync_symbols * len > pre->len) {
+                        return 0;
+                }
+                if (exact_match(pre, len)) {
+                        pre->found = 1;
+                        pre->offset = 0;
+                        pre->symbol_len = len;
+                        pre->pos = pre->sync_symbols * len;
+                        return 1;
+                }
+        }
+
+        return -1;
+}
+
+/**
+ * \brief Correlate all the offsets with enough buffered samples.
+ *
+ * At the end of the input (last) the offsets are correlated with the
+ * candidates which still fit.
+ *
+ * \return 1 if found, 0 otherwise.
+ */
+static int search(preamble_t *pre, int last)
+{
+        const size_t span = pre->sync_symbols * pre->max_len;
+
+
+        while (!pre->armed || pre->next <= pre->until) {
+                const size_t i = pre->next - pre->start;
+                size_t max_len = pre->max_len;
+
+                if (i + span > pre->len) {
+                        if (!last) {
+                                return 0;
+                        }
+                        max_len = (pre->len - i) / pre->sync_symbols;
+                        if (max_len < pre->min_len) {
+                                break;
+                        }
+                }
+                correlate(pre, max_len);
+        }
+
+        pre->found = pre->armed;
+        pre->pos = pre->offset + pre->sync_symbols * pre->symbol_len;
+
+        return pre->found;
+}
+
+/**
+ * \brief Exact match of the short candidates first, then the correlation
+ *        search (which needs more samples than any of them anyway).
+ *
+ * \return 1 if found, 0 otherwise.
+ */
+static int match(preamble_t *pre, int last)
+{
+        const int ret = exact(pre);
+
+
+        if (ret == 1) {
+                return 1;
+        } else if ((ret == 0 && !last) || pre->exact_only) {
+                return 0;
+        }
+
+        return search(pre, last);
+}
+
+
+void preamble_reset(preamble_t *pre, const carrier_t *carrier,
+                const char *sync_seq, size_t symbol_len, double threshold)
+{
+        pre->carrier = carrier;
+        pre->sync_seq = sync_seq;
+        pre->sync_symbols = strlen(sync_seq) / 2;
+        for (size_t j = 0; j < pre->sync_symbols; ++j) {
+                const double phase = phase_shift[sync_symbol(sync_seq, j)];
+
+                pre->ref[j][0] = cos(phase);
+                pre->ref[j][1] = sin(phase);
+        }
+        pre->min_len = symbol_len; //candidates are known with the carrier
+        pre->max_len = symbol_len;
+        pre->exact_min = 1; //none
+        pre->exact_max = 0;
+        pre->exact_only = 0;
+        pre->threshold = threshold;
+        pre->ready = 0;
+
+        pre->len = 0;
+        pre->start = 0;
+        pre->next = 0;
+        pre->armed = 0;
+        pre->best = PREAMBLE_MIN_CORR;
+        pre->until = 0;
+        pre->found = 0;
+        pre->offset = 0;
+        pre->symbol_len = 0;
+        pre->pos = 0;
+}
+
+void preamble_free(preamble_t *pre)
+{
+        free(pre->waves);
+        pre->waves = NULL;
+        free(pre->samples);
+        pre->samples = NULL;
+        free(pre->sums);
+        pre->sums = NULL;
+        pre->cap = pre->len = 0;
+        pre->ready = 0;
+}
+
+int preamble_feed(preamble_t *pre, const double *samples, size_t count)
+{
+        if (!pre->ready && prepare(pre) != 0) {
+                return -1;
+        }
+        if (!pre->found) {
+                compact(pre, pre->armed ? pre->offset : pre->next);
+        }
+        if (reserve(pre, count) != 0) {
+                return -1;
+        }
+
+        if (pre->len == 0) {
+                memset(pre->sums, 0, SUMS * sizeof (*pre->sums));
+        }
+        memcpy(pre->samples + pre->len, samples, count * sizeof (*samples));
+        if (pre->found) { //only kept for the decision
+                pre->len += count;
+                return 1;
+        }
+        integrate(pre, pre->len, count);
+        pre->len += count;
+
+        return match(pre, 0);
+}
+
+int preamble_finish(preamble_t *pre)
+{
+        if (pre->found) {
+                return 1;
+        }
+        if (!pre->ready || pre->len == 0) {
+                return 0;
+        }
+
+        return match(pre, 1);
+}
+
+size_t preamble_tail(const preamble_t *pre, const double **samples)
+{
+        if (!pre->found) {
+                return 0;
+        }
+        if (samples != NULL) {
+                *samples = pre->samples + (pre->pos - pre->start);
+        }
+
+        return pre->start + pre->len - pre->pos;
+}
+
+void preamble_consume(preamble_t *pre, size_t count)
+{
+        pre->pos += count;
+        if (pre->pos == pre->start + pre->len) { //all decided, start over
+                pre->start = pre->pos;
+                pre->len = 0;
+        }
+}
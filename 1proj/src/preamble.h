@@ -0,0 +1,126 @@
+/**
+ * \file preamble.h
+ * \brief Search for the synchronization sequence at any offset of the input
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * For a candidate symbol length the sync sequence is a known waveform, so
+ * the normalized cross-correlation with the input tells how well an offset
+ * matches it (1 for a perfect match at any gain). The input is mixed down by
+ * the I/Q carrier once and integrated into prefix sums, every sync symbol of
+ * any length is then a difference of two sums. Correlation of one offset and
+ * one symbol length costs a few operations per sync symbol, regardless of
+ * the symbol length, so all the candidate lengths are tried at every offset.
+ *
+ * The first offset correlated better than PREAMBLE_MIN_CORR starts the peak
+ * search, the best match within the next sync sequence length wins (partial
+ * matches of a repeating sync sequence come earlier than the whole one).
+ * Correlation of noise with a waveform of n samples has deviation
+ * 1 / sqrt(n), so short waveforms match noise easily. Matches also have to
+ * score PREAMBLE_MIN_SCORE deviations and sync waveforms shorter than
+ * PREAMBLE_MIN_SAMPLES are never searched for.
+ *
+ * Shorter candidates are only matched sample by sample at the very start of
+ * the input, every sample within the threshold of the sync waveform (the
+ * sync of the old sample-exact demodulator). So files with short symbols
+ * still decode if they start with the sync sequence.
+ */
+
+#ifndef PREAMBLE_H
+#define PREAMBLE_H
+
+#include <stddef.h>
+
+#include "carrier.h"
+
+
+#define PREAMBLE_MAX_SYMBOLS 32 //longest sync sequence in symbols
+#define PREAMBLE_MIN_CORR 0.8 //weaker matches are ignored
+#define PREAMBLE_MIN_SCORE 7.0 //corr * sqrt(samples), N(0, 1) for noise
+#define PREAMBLE_MIN_SAMPLES 49 //shortest sync waveform, MIN_SCORE^2
+#define PREAMBLE_MIN_POWER 1e-6 //quieter input is silence, rel. to amplitude
+
+
+typedef struct { //search state, owned by one demodulator
+        /* Searched sequence. */
+        const carrier_t *carrier;
+        const char *sync_seq; //bit pairs
+        size_t sync_symbols;
+        double ref[PREAMBLE_MAX_SYMBOLS][2]; //cos, sin of the phase shifts
+        size_t min_len; //candidate symbol lengths, correlated
+        size_t max_len;
+        size_t exact_min; //shorter candidates, matched exactly at sample 0
+        size_t exact_max;
+        size_t exact_next; //next exactly matched candidate
+        int exact_only; //the only candidate is short, nothing is correlated
+        double threshold; //of the exact match, normalized samples
+        double *waves; //sum and energy of the sync waveform for every length
+        int ready; //waves computed for the sequence and the carrier
+
+        /* Buffered input, normalized samples. */
+        double *samples;
+        double *sums; //prefix sums of x * I, x * Q, x and x * x per sample
+        size_t cap; //allocated samples
+        size_t len; //buffered samples
+        size_t start; //input sample of samples[0]
+        size_t next; //next offset to be correlated (input sample)
+
+        /* Best match, the search ends at the until offset once armed. */
+        int armed;
+        double best; //correlation
+        size_t until;
+        int found;
+        size_t offset; //input sample of the first sync sample
+        size_t symbol_len;
+        size_t pos; //next undecided input sample after the sync sequence
+} preamble_t;
+
+
+/**
+ * \brief Start a new search for the sync sequence (bit pairs).
+ *
+ * Only symbol_len is tried if not 0, otherwise every length up to two
+ * carrier periods. The sequence is referenced, it has to outlive the search.
+ * Short candidates are matched exactly at the input start, every sample
+ * closer than threshold to the sync waveform.
+ */
+void preamble_reset(preamble_t *pre, const carrier_t *carrier,
+                const char *sync_seq, size_t symbol_len, double threshold);
+
+/**
+ * \brief Free search buffers.
+ */
+void preamble_free(preamble_t *pre);
+
+/**
+ * \brief Buffer samples and continue the search.
+ *
+ * Samples are only buffered once the sequence is found (until they are
+ * consumed by preamble_consume()).
+ *
+ * \return 1 if found, 0 if not yet, -1 on memory allocation failure.
+ */
+int preamble_feed(preamble_t *pre, const double *samples, size_t count);
+
+/**
+ * \brief End of the input, correlate the offsets left with the candidate
+ *        lengths which still fit.
+ *
+ * \return 1 if found, 0 otherwise.
+ */
+int preamble_finish(preamble_t *pre);
+
+/**
+ * \brief Buffered samples following the found sync sequence.
+ *
+ * \return Number of samples, pointer to them is stored to samples (if not
+ *         NULL) and stays valid until the next preamble_feed().
+ */
+size_t preamble_tail(const preamble_t *pre, const double **samples);
+
+/**
+ * \brief Drop count samples from the beginning of the tail.
+ */
+void preamble_consume(preamble_t *pre, size_t count);
+
+#endif //PREAMBLE_H
@@ -0,0 +1,1077 @@
+/**
+ * \file qpsk.c
+ * \brief Reentrant QPSK modem library
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "qpsk.h"
+
+
+/* Block already normalized into demod->samples, internal sample format. */
+#define SAMPLE_NORMALIZED ((qpsk_sample_t)(QPSK_U8 + 1))
+
+#define PARAMS_LINE_MAX 128 //longest "key=value" line of the parameters
+#define GRAM_MIN_DET 1e-6 //relative to symbol_len^2, mixers are parallel
+
+/* Value of the macro as a string literal, messages follow the limits. */
+#define STR(x) STR_(x)
+#define STR_(x) #x
+
+
+/* Phase shift index of the sync symbol. */
+static size_t sync_symbol(const char *sync_seq, size_t idx)
+{
+        return 2 * (sync_seq[2 * idx] - '0') + (sync_seq[2 * idx + 1] - '0');
+}
+
+/**
+ * \brief Kernels specialised for the symbol length, if the carrier tables
+ *        are contiguous for a whole symbol from any offset (never for the
+ *        NCO).
+ */
+static const kernels_fixed_t * fixed_kernels(const kernels_t *kernels,
+                const carrier_t *carrier, size_t symbol_len)
+{
+        if (carrier->nco || carrier->len - carrier->period + 1 < symbol_len) {
+                return NULL;
+        }
+
+        return kernels_fixed(kernels, symbol_len);
+}
+
+
+/*
+ * Parameters.
+ */
+void qpsk_params_default(qpsk_params_t *params)
+{
+        memset(params, 0, sizeof (*params));
+        params->sample_rate = QPSK_SAMPLE_RATE;
+        params->freq = QPSK_FREQ;
+        params->symbol_len = QPSK_SYMBOL_LEN;
+        strcpy(params->sync_seq, QPSK_SYNC_SEQ);
+        params->threshold = QPSK_THRESHOLD;
+        params->constellation = CONSTELLATION_QPSK;
+}
+
+const char * qpsk_params_check(const qpsk_params_t *params)
+{
+        const size_t len = strnlen(params->sync_seq,
+                        sizeof (params->sync_seq));
+
+
+        if (len == sizeof (params->sync_seq) || len % 2 != 0 || len < 4 ||
+                        strspn(params->sync_seq, "01") != len)
+        {
+                return "sync sequence has to be 2 to " STR(QPSK_SYNC_MAX)
+                        " bit pairs";
+        } else if (sync_symbol(params->sync_seq, 0) ==
+                        sync_symbol(params->sync_seq, 1))
+        {
+                return "first two sync symbols have to differ";
+        } else if (params->sample_rate > QPSK_RATE_MAX) {
+                return "sample rate has to be at most " STR(QPSK_RATE_MAX)
+                        " Hz";
+        } else if (params->freq == 0 ||
+                        params->sample_rate < 2 * params->freq)
+        {
+                return "sample rate has to be at least twice the frequency";
+        } else if (params->symbol_len >
+                        2 * params->sample_rate / params->freq)
+        {
+                return "symbol length has to be at most 2 carrier periods";
+        } else if (params->frame != 0 && params->symbol_len != 0 &&
+                        len / 2 * params->symbol_len < PREAMBLE_MIN_SAMPLES)
+        {
+                return "framed sync sequence has to be at least "
+                        STR(PREAMBLE_MIN_SAMPLES) " samples long";
+        } else if (!(params->threshold > 0.0 && params->threshold < 2.0)) {
+                return "threshold has to be between 0 and 2";
+        } else if (params->frame > FRAME_MAX_PAYLOAD) {
+                return "frame payload has to be at most "
+                        STR(FRAME_MAX_PAYLOAD) " symbols";
+        } else if (params->constellation >= CONSTELLATION_COUNT) {
+                return "unknown constellation";
+        } else if (params->frame != 0 &&
+                        params->constellation != CONSTELLATION_QPSK)
+        {
+                return "frames carry qpsk symbols only";
+        }
+
+        return NULL;
+}
+
+int qpsk_params_format(const qpsk_params_t *params, char *buf, size_t size)
+{
+        return snprintf(buf, size, "sample_rate=%lu\nfreq=%lu\n"
+                        "symbol_len=%zu\nsync=%s\nthreshold=%g\nframe=%zu\n"
+                        "constellation=%s\n",
+                        params->sample_rate, params->freq, params->symbol_len,
+                        params->sync_seq, params->threshold, params->frame,
+                        constellation_get(params->constellation)->name);
+}
+
+/* One "key=value" line, NUL terminated. */
+static int params_line(qpsk_params_t *params, char *line)
+{
+        char *value = strchr(line, '=');
+        char *endptr;
+
+
+        if (value == NULL) {
+                return 0; //not a parameter
+        }
+        *value++ = '\0';
+        errno = 0;
+
+        if (strcmp(line, "sample_rate") == 0) {
+                params->sample_rate = strtoul(value, &endptr, 10);
+        } else if (strcmp(line, "freq") == 0) {
+                params->freq = strtoul(value, &endptr, 10);
+        } else if (strcmp(line, "symbol_len") == 0) {
+                params->symbol_len = strtoull(value, &endptr, 10);
+        } else if (strcmp(line, "threshold") == 0) {
+                params->threshold = strtod(value, &endptr);
+        } else if (strcmp(line, "frame") == 0) {
+                params->frame = strtoull(value, &endptr, 10);
+        } else if (strcmp(line, "sync") == 0) {
+                if (strlen(value) >= sizeof (params->sync_seq)) {
+                        return -1;
+                }
+                strcpy(params->sync_seq, value);
+                return 0;
+        } else if (strcmp(line, "constellation") == 0) {
+                const constellation_t *constellation =
+                        constellation_find(value);
+
+                if (constellation == NULL) {
+                        return -1;
+                }
+                params->constellation = constellation->id;
+                return 0;
+        } else {
+                return 0; //unknown key
+        }
+
+        return (*value == '\0' || *endptr != '\0' || errno != 0) ? -1 : 0;
+}
+
+int qpsk_params_parse(qpsk_params_t *params, const char *text, size_t len)
+{
+        while (len > 0) {
+                const char *end = memchr(text, '\n', len);
+                const size_t line_len = (end == NULL) ? len :
+                        (size_t)(end - text);
+                char line[PARAMS_LINE_MAX];
+
+                if (line_len >= sizeof (line)) {
+                        return -1;
+                }
+                memcpy(line, text, line_len);
+                line[line_len] = '\0';
+                if (params_line(params, line) != 0) {
+                        return -1;
+                }
+
+                text += line_len;
+                len -= line_len;
+                if (len > 0) { //skip the newline
+                        text++;
+                        len--;
+                }
+        }
+
+        return 0;
+}
+
+
+/*
+ * Modulator.
+ */
+static void mod_phase(qpsk_mod_t *mod, size_t phase_shift_idx, int *buffer)
+{
+        assert(phase_shift_idx < CARRIER_PHASES);
+
+        /* Synthesize contiguous runs of the carrier. */
+        for (size_t i = 0, run; i < mod->symbol_len; i += run) {
+                carrier_span_t span;
+
+                run = carrier_span(mod->carrier, &mod->window, mod->time,
+                                mod->symbol_len - i, &span);
+                if (run > mod->symbol_len - i) {
+                        run = mod->symbol_len - i;
+                }
+                mod->kernels->synth(buffer + i, span.table[phase_shift_idx],
+                                run, QPSK_AMPLITUDE);
+
+                mod->time += run;
+        }
+}
+
+/* Point of the constellation, x * I + y * Q. */
+static void mod_point(qpsk_mod_t *mod, size_t point_idx, int *buffer)
+{
+        const double *point = mod->constellation->point[point_idx];
+
+
+        assert(point_idx < mod->constellation->points);
+
+        for (size_t i = 0, run; i < mod->symbol_len; i += run) {
+                carrier_span_t span;
+
+                run = carrier_span(mod->carrier, &mod->window, mod->time,
+                                mod->symbol_len - i, &span);
+                if (run > mod->symbol_len - i) {
+                        run = mod->symbol_len - i;
+                }
+                for (size_t k = 0; k < run; ++k) { //C truncation, as synth
+                        buffer[i + k] = QPSK_AMPLITUDE * (point[0] *
+                                        span.in_phase[k] + point[1] *
+                                        span.quadrature[k]);
+                }
+
+                mod->time += run;
+        }
+}
+
+
+void qpsk_mod_init(qpsk_mod_t *mod, const carrier_t *carrier,
+                size_t symbol_len)
+{
+        mod->carrier = carrier;
+        mod->kernels = kernels_get(KERNELS_AUTO);
+        mod->symbol_len = symbol_len;
+        mod->sync_seq = QPSK_SYNC_SEQ;
+        mod->time = 0;
+        mod->frame_len = 0;
+        mod->constellation = constellation_get(CONSTELLATION_QPSK);
+        mod->window.len = 0;
+}
+
+void qpsk_mod_configure(qpsk_mod_t *mod, const qpsk_params_t *params)
+{
+        mod->symbol_len = params->symbol_len;
+        mod->sync_seq = params->sync_seq;
+        mod->frame_len = (params->frame == 0) ? 0 : params->symbol_len *
+                frame_symbols(qpsk_sync_symbols(params->sync_seq),
+                                params->frame);
+        mod->constellation = constellation_get(params->constellation);
+}
+
+void qpsk_mod_seek(qpsk_mod_t *mod, size_t symbol)
+{
+        mod->time = symbol * mod->symbol_len;
+        if (mod->frame_len != 0) {
+                mod->time %= mod->frame_len;
+        }
+}
+
+size_t qpsk_mod_sync(qpsk_mod_t *mod, int *samples)
+{
+        const size_t sync_symbols = qpsk_sync_symbols(mod->sync_seq);
+
+
+        for (size_t i = 0; i < sync_symbols; ++i) {
+                mod_phase(mod, sync_symbol(mod->sync_seq, i),
+                                samples + i * mod->symbol_len);
+        }
+
+        return sync_symbols * mod->symbol_len;
+}
+
+/* Symbols of one frame (or of the unframed stream). */
+static void mod_run(qpsk_mod_t *mod, const unsigned char *symbols,
+                size_t count, int *samples)
+{
+        const carrier_t *carrier = mod->carrier;
+        const kernels_fixed_t *fixed = fixed_kernels(mod->kernels, carrier,
+                        mod->symbol_len);
+
+
+        if (mod->constellation->id != CONSTELLATION_QPSK) {
+                const size_t sync_end = mod->symbol_len *
+                        qpsk_sync_symbols(mod->sync_seq);
+
+                for (size_t i = 0; i < count; ++i) {
+                        if (mod->time < sync_end) { //sync is always QPSK
+                                mod_phase(mod, symbols[i],
+                                                samples + i * mod->symbol_len);
+                        } else {
+                                mod_point(mod, symbols[i],
+                                                samples + i * mod->symbol_len);
+                        }
+                }
+                return;
+        }
+        if (fixed != NULL) { //whole run by the specialised kernel
+                fixed->synth(samples, symbols, count,
+                                (const double *const *)carrier->table,
+                                mod->time % carrier->period, carrier->period,
+                                QPSK_AMPLITUDE);
+                mod->time += count * mod->symbol_len;
+                return;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+                mod_phase(mod, symbols[i], samples + i * mod->symbol_len);
+        }
+}
+
+size_t qpsk_mod_process(qpsk_mod_t *mod, const unsigned char *symbols,
+                size_t count, int *samples)
+{
+        for (size_t done = 0, run; done < count; done += run) {
+                run = count - done;
+                if (mod->frame_len != 0 && run > (mod->frame_len -
+                                        mod->time) / mod->symbol_len)
+                { //up to the end of the frame
+                        run = (mod->frame_len - mod->time) / mod->symbol_len;
+                }
+                mod_run(mod, symbols + done, run,
+                                samples + done * mod->symbol_len);
+                if (mod->frame_len != 0 && mod->time == mod->frame_len) {
+                        mod->time = 0; //next frame starts with its sync
+                }
+        }
+
+        return count * mod->symbol_len;
+}
+
+
+/*
+ * Demodulator sample formats.
+ */
+static size_t sample_width(qpsk_sample_t format)
+{
+        return (format == SAMPLE_NORMALIZED) ? sizeof (double) :
+                qpsk_sample_size(format);
+}
+
+/* Integer version of the carrier table scaled to amplitude. */
+static int16_t * int_table(int16_t *dst, const double *src, size_t len,
+                double amplitude)
+{
+        for (size_t t = 0; t < len; ++t) {
+                dst[t] = lrint(src[t] * amplitude);
+        }
+
+        return dst;
+}
+
+/**
+ * \brief Build the integer carrier tables for narrow samples.
+ *
+ * \return 0 on success, -1 on memory allocation failure or for the NCO
+ *         (narrow samples take the double path then).
+ */
+static int int_tables_init(qpsk_demod_t *demod)
+{
+        const carrier_t *carrier = demod->carrier;
+        const size_t len = carrier->len;
+        int16_t *table;
+
+
+        if (carrier->nco) {
+                return -1; //no tables to convert, doubles from the NCO
+        }
+        table = realloc(demod->int_tables,
+                        (2 * CARRIER_PHASES + 2) * len * sizeof (*table));
+        if (table == NULL) {
+                return -1;
+        }
+        demod->int_tables = table;
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                demod->ref_s16[j] = int_table(table, carrier->table[j], len,
+                                QPSK_AMPLITUDE_S16);
+                table += len;
+                demod->ref_u8[j] = int_table(table, carrier->table[j], len,
+                                QPSK_AMPLITUDE_U8);
+                table += len;
+        }
+        demod->in_phase_q15 = int_table(table, carrier->in_phase, len,
+                        INT16_MAX);
+        table += len;
+        demod->quadrature_q15 = int_table(table, carrier->quadrature, len,
+                        INT16_MAX);
+
+        demod->threshold_s16 = ceil(demod->threshold * QPSK_AMPLITUDE_S16);
+        demod->threshold_u8 = ceil(demod->threshold * QPSK_AMPLITUDE_U8);
+        demod->int_ready = 1;
+
+        return 0;
+}
+
+/* Samples as doubles relative to the amplitude of the format. */
+static void normalize_block(qpsk_demod_t *demod, const void *samples,
+                qpsk_sample_t format, size_t len)
+{
+        const int16_t *s16 = samples;
+        const uint8_t *u8 = samples;
+
+
+        switch (format) {
+        case QPSK_S16:
+                for (size_t i = 0; i < len; ++i) {
+                        demod->samples[i] = s16[i] /
+                                (double)QPSK_AMPLITUDE_S16;
+                }
+                break;
+
+        case QPSK_U8:
+                for (size_t i = 0; i < len; ++i) {
+                        demod->samples[i] = (u8[i] - 128) /
+                                (double)QPSK_AMPLITUDE_U8;
+                }
+                break;
+
+        default:
+                demod->kernels->normalize(demod->samples, samples, len,
+                                QPSK_AMPLITUDE);
+        }
+}
+
+
+/*
+ * Demodulator symbol decision.
+ */
+/* Number of samples to process at once: rest of the symbol, rest of the
+ * block, or rest of the contiguous carrier span, whichever is shortest. */
+static size_t decode_run(qpsk_demod_t *demod, size_t block_len,
+                carrier_span_t *span)
+{
+        size_t run = demod->symbol_len - demod->items;
+        size_t span_len;
+
+
+        if (run > block_len) {
+                run = block_len;
+        }
+        span_len = carrier_span(demod->carrier, &demod->window, demod->time,
+                        run, span);
+
+        return (run > span_len) ? span_len : run;
+}
+
+/* Offset of the current time in the integer tables. */
+static size_t int_offset(const qpsk_demod_t *demod)
+{
+        return demod->time % demod->carrier->period;
+}
+
+static void reset_symbol(qpsk_demod_t *demod)
+{
+        memset(demod->histogram, 0, sizeof (demod->histogram));
+        demod->acc_i = 0.0;
+        demod->acc_q = 0.0;
+        demod->items = 0;
+}
+
+/**
+ * \brief Add a run of samples of one symbol to the histogram.
+ *
+ * Every sample is compared with all four reference values and the phase shift
+ * with the most hits wins. Symbol may span multiple blocks, partially
+ * processed symbol is kept in the context (demod->histogram) until
+ * hist_decide() takes the complete one. Block holds samples in the format,
+ * SAMPLE_NORMALIZED for doubles.
+ */
+static void hist_run(qpsk_demod_t *demod, const void *block,
+                qpsk_sample_t format, const carrier_span_t *span, size_t run)
+{
+        const kernels_t *kernels = demod->kernels;
+        const int16_t *ref_int[CARRIER_PHASES];
+
+
+        switch (format) {
+        case QPSK_S16:
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        ref_int[j] = demod->ref_s16[j] + int_offset(demod);
+                }
+                kernels->hist_s16(demod->histogram, block, ref_int, run,
+                                demod->threshold_s16);
+                break;
+
+        case QPSK_U8:
+                for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                        ref_int[j] = demod->ref_u8[j] + int_offset(demod);
+                }
+                kernels->hist_u8(demod->histogram, block, ref_int, run,
+                                demod->threshold_u8);
+                break;
+
+        default:
+                kernels->hist(demod->histogram, block, span->table, run,
+                                demod->threshold);
+        }
+}
+
+/* Most popular phase shift of the complete symbol, starts the next one. */
+static unsigned char hist_decide(qpsk_demod_t *demod)
+{
+        size_t max_val = 0; //maximum value in histogram (one of them)
+        size_t max_idx = 0; //index of maximum value in histogram
+        size_t second_val = 0; //runner-up value in histogram
+
+
+        for (size_t j = 0; j < CARRIER_PHASES; ++j) {
+                if (max_val < demod->histogram[j]) {
+                        second_val = max_val;
+                        max_val = demod->histogram[j];
+                        max_idx = j;
+                } else if (second_val < demod->histogram[j]) {
+                        second_val = demod->histogram[j];
+                }
+        }
+
+        /* Decision quality, the winner should take it all. */
+        demod->ties += (second_val == max_val);
+        demod->low_margin += (max_val - second_val <
+                        QPSK_LOW_MARGIN * demod->symbol_len);
+
+        reset_symbol(demod);
+
+        return max_idx;
+}
+
+/* Number of whole symbols for the fixed kernels, 0 if they don't apply. */
+static size_t fixed_count(const qpsk_demod_t *demod,
+                const kernels_fixed_t *fixed, size_t block_len)
+{
+        const size_t count = block_len / demod->symbol_len;
+
+
+        if (fixed == NULL || demod->items != 0) {
+                return 0;
+        }
+
+        return (count < KERNELS_FIXED_SYMBOLS) ? count : KERNELS_FIXED_SYMBOLS;
+}
+
+static size_t decode_block_hist(qpsk_demod_t *demod, const void *samples,
+                qpsk_sample_t format, size_t block_len,
+                unsigned char *symbols)
+{
+        const carrier_t *carrier = demod->carrier;
+        const unsigned char *block = samples;
+        const size_t width = sample_width(format);
+        /* Specialised kernels decide whole symbols of doubles. */
+        const kernels_fixed_t *fixed = (format == SAMPLE_NORMALIZED) ?
+                fixed_kernels(demod->kernels, carrier, demod->symbol_len) :
+                NULL;
+        size_t histogram[KERNELS_FIXED_SYMBOLS][CARRIER_PHASES];
+        size_t count = 0;
+
+
+        while (block_len > 0) {
+                const size_t whole = fixed_count(demod, fixed, block_len);
+                carrier_span_t span;
+                size_t run;
+
+                if (whole > 0) {
+                        run = whole * demod->symbol_len;
+                        fixed->hist(histogram, (const double *)block,
+                                        (const double *const *)carrier->table,
+                                        demod->time % carrier->period,
+                                        carrier->period, whole,
+                                        demod->threshold);
+                        for (size_t s = 0; s < whole; ++s) {
+                                memcpy(demod->histogram, histogram[s],
+                                                sizeof (demod->histogram));
+                                symbols[count++] = hist_decide(demod);
+                        }
+
+                        block += run * width;
+                        block_len -= run;
+                        demod->time += run;
+                        continue;
+                }
+
+                /* Compare with all four possible phase shifts. */
+                /* It is stupid, but working. */
+                run = decode_run(demod, block_len, &span);
+                hist_run(demod, block, format, &span, run);
+
+                block += run * width;
+                block_len -= run;
+                demod->time += run;
+                demod->items += run;
+                if (demod->items == demod->symbol_len) {
+                        symbols[count++] = hist_decide(demod);
+                }
+        }
+
+        return count;
+}
+
+/**
+ * \brief Integrate a run of samples of one symbol by the I/Q correlator
+ *        (integrate and dump).
+ *
+ * Samples are mixed with cos and -sin carriers and integrated over the whole
+ * symbol. Signs of I and Q give the quadrant of the phase shift:
+ * 45 -> (+, +), 315 -> (+, -), 135 -> (-, +), 225 -> (-, -), which is exactly
+ * 2 * (I < 0) + (Q < 0). No threshold is needed and the amplitude of the
+ * signal doesn't matter. Narrow samples are mixed in their own scale by the
+ * exact integer kernels, the sums are scaled to the normalized samples (for
+ * the other constellations, see point_decide()). Sums of the partially
+ * processed symbol are kept in the context (demod->acc_i, demod->acc_q)
+ * until corr_decide() takes the complete one.
+ */
+static void corr_run(qpsk_demod_t *demod, const void *block,
+                qpsk_sample_t format, const carrier_span_t *span, size_t run)
+{
+        const kernels_t *kernels = demod->kernels;
+        const size_t offset = (format == SAMPLE_NORMALIZED) ? 0 :
+                int_offset(demod);
+        long long acc_i = 0, acc_q = 0; //integer kernels, exact
+        double scale;
+
+
+        switch (format) {
+        case QPSK_S16:
+                kernels->corr_s16(&acc_i, &acc_q, block,
+                                demod->in_phase_q15 + offset,
+                                demod->quadrature_q15 + offset, run);
+                scale = (double)QPSK_AMPLITUDE_S16 * INT16_MAX;
+                break;
+
+        case QPSK_U8:
+                kernels->corr_u8(&acc_i, &acc_q, block,
+                                demod->in_phase_q15 + offset,
+                                demod->quadrature_q15 + offset, run);
+                scale = (double)QPSK_AMPLITUDE_U8 * INT16_MAX;
+                break;
+
+        default:
+                kernels->corr(&demod->acc_i, &demod->acc_q, block,
+                                span->in_phase, span->quadrature, run);
+                return;
+        }
+        demod->acc_i += acc_i / scale;
+        demod->acc_q += acc_q / scale;
+}
+
+/**
+ * \brief Sums of the mixers over a symbol starting at phase 0.
+ *
+ * Sum of cos(a t) over t = 0 .. n - 1 is sin(n a / 2) / sin(a / 2) *
+ * cos((n - 1) a / 2), the same with sin for sin(a t). Call when the symbol
+ * length changes.
+ */
+static void gram_init(qpsk_demod_t *demod)
+{
+        const carrier_t *carrier = demod->carrier;
+        const double omega = 2.0 * M_PI * carrier->freq / carrier->sample_rate;
+        const double len = demod->symbol_len;
+
+
+        if (fabs(sin(omega)) < 1e-12) { //2 omega is a multiple of 2 pi
+                demod->gram[0] = len;
+                demod->gram[1] = 0.0;
+                return;
+        }
+        demod->gram[0] = sin(len * omega) / sin(omega) *
+                cos((len - 1.0) * omega);
+        demod->gram[1] = sin(len * omega) / sin(omega) *
+                sin((len - 1.0) * omega);
+}
+
+/**
+ * \brief Point (x, y) sent by the symbol starting at time from its I/Q sums.
+ *
+ * Over a symbol which is not a whole number of half periods the mixers are
+ * not orthogonal, x * I + y * Q integrates to G (x, y), G being the Gram
+ * matrix of the mixers over the symbol. I^2 = (1 + cos 2wt) / 2,
+ * Q^2 = (1 - cos 2wt) / 2 and I Q = -sin(2wt) / 2, so its items are the
+ * sums of demod->gram rotated by twice the carrier phase of the time.
+ */
+static void equalize(const qpsk_demod_t *demod, size_t time,
+                const double acc[2], double point[2])
+{
+        const double len = demod->symbol_len;
+        const double c = carrier_i(demod->carrier, time); //cos(w t)
+        const double s = -carrier_q(demod->carrier, time); //sin(w t)
+        const double cos2 = c * c - s * s;
+        const double sin2 = 2.0 * s * c;
+        const double sum_cos = demod->gram[0] * cos2 - demod->gram[1] * sin2;
+        const double sum_sin = demod->gram[1] * cos2 + demod->gram[0] * sin2;
+        const double ii = (len + sum_cos) / 2.0;
+        const double qq = (len - sum_cos) / 2.0;
+        const double iq = -sum_sin / 2.0;
+        const double det = ii * qq - iq * iq;
+
+
+        if (det < GRAM_MIN_DET * len * len) { //e.g. at half the sample rate
+                point[0] = 2.0 * acc[0] / len;
+                point[1] = 2.0 * acc[1] / len;
+                return;
+        }
+        point[0] = (qq * acc[0] - iq * acc[1]) / det;
+        point[1] = (ii * acc[1] - iq * acc[0]) / det;
+}
+
+/**
+ * \brief Nearest point of the constellation to the complete symbol starting
+ *         at time, starts the next one.
+ *
+ * Received point is scaled by the gain, so the amplitude rings of QAM match
+ * the table.
+ */
+static unsigned char point_decide(qpsk_demod_t *demod, size_t time)
+{
+        const constellation_t *constellation = demod->constellation;
+        const double acc[2] = { demod->acc_i, demod->acc_q };
+        double received[2];
+        double best, second;
+        unsigned char idx;
+
+
+        equalize(demod, time, acc, received);
+        received[0] /= demod->gain;
+        received[1] /= demod->gain;
+        idx = constellation_decide(constellation, received, &best, &second);
+
+        /* Decision quality, ideally right at the winning point. */
+        demod->ties += (best == second);
+        demod->low_margin += (second - best < QPSK_LOW_MARGIN *
+                        constellation->spacing * constellation->spacing);
+
+        reset_symbol(demod);
+
+        return idx;
+}
+
+/* Quadrant of the complete symbol starting at time, starts the next one.
+ * Other constellations than QPSK are decided by the table. */
+static unsigned char corr_decide(qpsk_demod_t *demod, size_t time)
+{
+        const double abs_i = fabs(demod->acc_i);
+        const double abs_q = fabs(demod->acc_q);
+        const unsigned char idx = 2 * (demod->acc_i < 0.0) +
+                (demod->acc_q < 0.0);
+
+
+        if (demod->constellation->id != CONSTELLATION_QPSK) {
+                return point_decide(demod, time);
+        }
+
+        /* Decision quality, ideally |I| == |Q|. */
+        demod->ties += (abs_i == 0.0 || abs_q == 0.0);
+        demod->low_margin += (abs_i < QPSK_LOW_MARGIN * abs_q ||
+                        abs_q < QPSK_LOW_MARGIN * abs_i);
+
+        reset_symbol(demod);
+
+        return idx;
+}
+
+static size_t decode_block_corr(qpsk_demod_t *demod, const void *samples,
+                qpsk_sample_t format, size_t block_len,
+                unsigned char *symbols)
+{
+        const carrier_t *carrier = demod->carrier;
+        const unsigned char *block = samples;
+        const size_t width = sample_width(format);
+        const kernels_fixed_t *fixed = (format == SAMPLE_NORMALIZED) ?
+                fixed_kernels(demod->kernels, carrier, demod->symbol_len) :
+                NULL;
+        double acc[KERNELS_FIXED_SYMBOLS][2];
+        size_t count = 0;
+
+
+        while (block_len > 0) {
+                const size_t whole = fixed_count(demod, fixed, block_len);
+                carrier_span_t span;
+                size_t run;
+
+                if (whole > 0) {
+                        run = whole * demod->symbol_len;
+                        fixed->corr(acc, (const double *)block,
+                                        carrier->in_phase, carrier->quadrature,
+                                        demod->time % carrier->period,
+                                        carrier->period, whole);
+                        for (size_t s = 0; s < whole; ++s) {
+                                demod->acc_i = acc[s][0];
+                                demod->acc_q = acc[s][1];
+                                symbols[count++] = corr_decide(demod,
+                                                demod->time + s *
+                                                demod->symbol_len);
+                        }
+
+                        block += run * width;
+                        block_len -= run;
+                        demod->time += run;
+                        continue;
+                }
+
+                run = decode_run(demod, block_len, &span);
+                corr_run(demod, block, format, &span, run);
+
+                block += run * width;
+                block_len -= run;
+                demod->time += run;
+                demod->items += run;
+                if (demod->items == demod->symbol_len) {
+                        symbols[count++] = corr_decide(demod, demod->time -
+                                        demod->symbol_len);
+                }
+        }
+
+        return count;
+}
+
+static size_t decode_block(qpsk_demod_t *demod, const void *samples,
+                qpsk_sample_t format, size_t block_len,
+                unsigned char *symbols)
+{
+        if (demod->decision == QPSK_DECIDE_CORR ||
+                        demod->constellation->id != CONSTELLATION_QPSK)
+        {
+                return decode_block_corr(demod, samples, format, block_len,
+                                symbols);
+        }
+
+        return decode_block_hist(demod, samples, format, block_len, symbols);
+}
+
+
+/*
+ * Demodulator synchronization.
+ */
+/* Amplitude of the received sync sequence, its points are on the unit
+ * circle. Samples of the sequence are still buffered by the search. */
+static double sync_gain(const qpsk_demod_t *demod)
+{
+        const preamble_t *pre = &demod->preamble;
+        const size_t len = demod->symbol_len;
+        const size_t symbols = qpsk_sync_symbols(demod->sync_seq);
+        const double *samples = pre->samples + (pre->offset - pre->start);
+        double sum = 0.0;
+
+
+        for (size_t j = 0; j < symbols; ++j) {
+                double acc[2] = { 0.0, 0.0 };
+                double point[2];
+
+                for (size_t t = j * len; t < (j + 1) * len; ++t) {
+                        acc[0] += samples[t] * carrier_i(demod->carrier, t);
+                        acc[1] += samples[t] * carrier_q(demod->carrier, t);
+                }
+                equalize(demod, j * len, acc, point);
+                sum += hypot(point[0], point[1]);
+        }
+
+        return (sum > 0.0) ? sum / symbols : 1.0;
+}
+
+/* Sync sequence found, time 0 is its first sample. */
+static void sync_lock(qpsk_demod_t *demod)
+{
+        demod->sync_state = QPSK_SYNC_DONE;
+        demod->symbol_len = demod->preamble.symbol_len;
+        demod->origin = demod->preamble.offset;
+        demod->data_start = qpsk_sync_symbols(demod->sync_seq) *
+                demod->symbol_len;
+        demod->time = demod->data_start;
+        gram_init(demod);
+        demod->gain = sync_gain(demod);
+        reset_symbol(demod);
+}
+
+/**
+ * \brief Decide samples buffered after the sync sequence.
+ *
+ * \return Number of symbol indices stored into symbols, at most room.
+ */
+static size_t sync_drain(qpsk_demod_t *demod, unsigned char *symbols,
+                size_t room)
+{
+        const double *samples;
+        size_t len = preamble_tail(&demod->preamble, &samples);
+
+
+        if (room == 0) {
+                return 0;
+        }
+        if (len > room * demod->symbol_len - demod->items) {
+                len = room * demod->symbol_len - demod->items;
+        }
+        preamble_consume(&demod->preamble, len);
+
+        return decode_block(demod, samples, SAMPLE_NORMALIZED, len, symbols);
+}
+
+
+/*
+ * Demodulator interface.
+ */
+int qpsk_demod_init(qpsk_demod_t *demod, const carrier_t *carrier,
+                qpsk_decision_t decision)
+{
+        memset(demod, 0, sizeof (*demod));
+        demod->carrier = carrier;
+        demod->kernels = kernels_get(KERNELS_AUTO);
+        demod->decision = decision;
+        demod->constellation = constellation_get(CONSTELLATION_QPSK);
+        demod->sync_seq = QPSK_SYNC_SEQ;
+        demod->threshold = QPSK_THRESHOLD;
+        demod->search_len = 0;
+        qpsk_demod_reset(demod);
+
+        demod->samples = malloc(QPSK_BLOCK * sizeof (*demod->samples));
+
+        return (demod->samples == NULL) ? -1 : 0;
+}
+
+void qpsk_demod_configure(qpsk_demod_t *demod, const qpsk_params_t *params)
+{
+        demod->sync_seq = params->sync_seq;
+        demod->threshold = params->threshold;
+        demod->search_len = params->symbol_len;
+        demod->constellation = constellation_get(params->constellation);
+        demod->int_ready = 0; //integer thresholds follow
+        qpsk_demod_reset(demod);
+}
+
+void qpsk_demod_reset(qpsk_demod_t *demod)
+{
+        demod->int_ready = 0; //carrier may have changed
+        demod->window.len = 0;
+        demod->symbols = 0;
+        demod->ties = 0;
+        demod->low_margin = 0;
+        qpsk_demod_resync(demod);
+}
+
+void qpsk_demod_resync(qpsk_demod_t *demod)
+{
+        demod->sync_state = QPSK_SYNC_SEARCH;
+        preamble_reset(&demod->preamble, demod->carrier, demod->sync_seq,
+                        demod->search_len, demod->threshold);
+        demod->symbol_len = 0;
+        demod->origin = 0;
+        demod->data_start = 0;
+        demod->time = 0;
+        demod->gain = 1.0;
+        reset_symbol(demod);
+}
+
+void qpsk_demod_free(qpsk_demod_t *demod)
+{
+        free(demod->samples);
+        demod->samples = NULL;
+        free(demod->int_tables);
+        demod->int_tables = NULL;
+        demod->int_ready = 0;
+        preamble_free(&demod->preamble);
+}
+
+void qpsk_demod_start(qpsk_demod_t *demod, size_t symbol_len, size_t time)
+{
+        demod->sync_state = QPSK_SYNC_DONE;
+        preamble_reset(&demod->preamble, demod->carrier, demod->sync_seq,
+                        demod->search_len, demod->threshold); //nothing
+                                                              //buffered
+        demod->symbol_len = symbol_len;
+        demod->data_start = time;
+        demod->time = time;
+        gram_init(demod);
+        reset_symbol(demod);
+}
+
+ssize_t qpsk_demod_process(qpsk_demod_t *demod, const int *samples,
+                size_t count, unsigned char *symbols)
+{
+        return qpsk_demod_decode(demod, samples, QPSK_S32, count, symbols);
+}
+
+ssize_t qpsk_demod_decode(qpsk_demod_t *demod, const void *samples,
+                qpsk_sample_t format, size_t count, unsigned char *symbols)
+{
+        const unsigned char *in = samples;
+        const size_t size = qpsk_sample_size(format);
+        const size_t room = count; //at most one symbol per sample
+        /* Without the integer tables narrow samples take the double path. */
+        const int native = (format != QPSK_S32 && (demod->int_ready ||
+                                int_tables_init(demod) == 0));
+        size_t produced = 0;
+
+
+        while (count > 0) {
+                const size_t len = (count < QPSK_BLOCK) ? count : QPSK_BLOCK;
+                const void *block = in;
+                qpsk_sample_t block_format = format;
+
+                /* Search for the sync sequence, samples are buffered until
+                 * all the buffered symbols are decided. */
+                if (demod->sync_state != QPSK_SYNC_DONE ||
+                                preamble_tail(&demod->preamble, NULL) > 0)
+                {
+                        normalize_block(demod, in, format, len);
+                        in += len * size;
+                        count -= len;
+                        if (preamble_feed(&demod->preamble, demod->samples,
+                                                len) == -1)
+                        {
+                                return -1;
+                        }
+                        if (demod->sync_state != QPSK_SYNC_DONE &&
+                                        demod->preamble.found)
+                        {
+                                sync_lock(demod);
+                        }
+                        if (demod->sync_state == QPSK_SYNC_DONE) {
+                                produced += sync_drain(demod,
+                                                symbols + produced,
+                                                room - produced);
+                        }
+                        continue;
+                }
+
+                /* Doubles are needed for the 32 bit kernels. */
+                if (!native) {
+                        normalize_block(demod, in, format, len);
+                        block = demod->samples;
+                        block_format = SAMPLE_NORMALIZED;
+                }
+                in += len * size;
+                count -= len;
+
+                produced += decode_block(demod, block, block_format, len,
+                                symbols + produced);
+        }
+        demod->symbols += produced;
+
+        return produced;
+}
+
+ssize_t qpsk_demod_flush(qpsk_demod_t *demod, unsigned char *symbols,
+                size_t count)
+{
+        size_t produced;
+
+
+        if (demod->sync_state != QPSK_SYNC_DONE) {
+                if (!preamble_finish(&demod->preamble)) {
+                        return -1;
+                }
+                sync_lock(demod);
+        }
+
+        produced = sync_drain(demod, symbols, count);
+        if (preamble_tail(&demod->preamble, NULL) == 0) {
+                reset_symbol(demod); //incomplete last symbol is thrown away
+        }
+        demod->symbols += produced;
+
+        return produced;
+}
@@ -0,0 +1,339 @@
+/**
+ * \file qpsk.h
+ * \brief Reentrant QPSK modem library
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * All the state lives in the modulator and demodulator contexts, so any
+ * number of streams may be processed in one process. Carrier tables are
+ * read only and may be shared by any number of contexts (and threads).
+ */
+
+#ifndef QPSK_H
+#define QPSK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h> //ssize_t
+
+#include "carrier.h"
+#include "kernels.h"
+#include "preamble.h"
+#include "frame.h"
+#include "constellation.h"
+
+
+#define QPSK_AMPLITUDE 0x7F000000u
+#define QPSK_THRESHOLD 0.1 //god knows why this number
+#define QPSK_SYNC_SEQ "00110011"
+#define QPSK_SYNC_SYMBOLS ((sizeof (QPSK_SYNC_SEQ) - 1) / 2)
+#define QPSK_SYNC_MAX PREAMBLE_MAX_SYMBOLS //longest sync sequence in symbols
+#define QPSK_SAMPLE_RATE 18000 //default sample rate [Hz]
+#define QPSK_RATE_MAX 4294967295 //WAV stores 32 bits, the NCO relies on it
+#define QPSK_FREQ 1000 //default carrier frequency [Hz]
+#define QPSK_SYMBOL_LEN 30 //default symbol length in samples
+#define QPSK_PARAMS_CHUNK "qpsk" //WAV chunk with the parameters
+#define QPSK_BLOCK 4096 //samples normalized at once by the demodulator
+#define QPSK_LOW_MARGIN 0.5 //decisions won by less are counted as low margin
+#define QPSK_AMPLITUDE_S16 (QPSK_AMPLITUDE >> 16) //amplitude of 16 bit samples
+#define QPSK_AMPLITUDE_U8 (QPSK_AMPLITUDE >> 24) //amplitude of 8 bit samples
+
+
+typedef enum { //symbol decision engines
+        QPSK_DECIDE_HIST, //threshold histogram
+        QPSK_DECIDE_CORR, //I/Q correlator (integrate and dump)
+} qpsk_decision_t;
+
+typedef enum { //demodulator input sample formats
+        QPSK_S32, //int, full 32 bit scale
+        QPSK_S16, //int16_t, native byte order
+        QPSK_U8, //uint8_t, offset binary (WAV PCM_8)
+} qpsk_sample_t;
+
+typedef enum { //synchronization states
+        QPSK_SYNC_SEARCH, //looking for the sync sequence
+        QPSK_SYNC_DONE,
+} qpsk_sync_state_t;
+
+typedef struct { //runtime modem parameters
+        unsigned long sample_rate; //[Hz]
+        unsigned long freq; //carrier frequency [Hz]
+        size_t symbol_len; //in samples, 0 if unknown (demodulator searches)
+        char sync_seq[2 * QPSK_SYNC_MAX + 1]; //bit pairs
+        double threshold; //histogram decision, relative to amplitude
+        size_t frame; //payload symbols per frame, 0 for one unframed payload
+        constellation_id_t constellation; //of the payload symbols
+} qpsk_params_t;
+
+typedef struct { //modulator context
+        const carrier_t *carrier;
+        const kernels_t *kernels;
+        size_t symbol_len; //in samples
+        const char *sync_seq; //bit pairs
+        size_t time; //discrete time of the next sample
+        size_t frame_len; //samples per frame (time wraps), 0 if not framed
+        const constellation_t *constellation; //of the payload symbols
+        carrier_window_t window; //NCO output, unused with tables
+} qpsk_mod_t;
+
+typedef struct { //demodulator context
+        const carrier_t *carrier;
+        const kernels_t *kernels;
+        qpsk_decision_t decision;
+        const constellation_t *constellation; //of the payload symbols
+
+        /* Synchronization. */
+        const char *sync_seq; //bit pairs
+        double threshold; //histogram decision, relative
+        size_t search_len; //symbol length to search for, 0 for all
+        qpsk_sync_state_t sync_state;
+        preamble_t preamble;
+        size_t symbol_len; //in samples, known after synchronization
+        size_t origin; //input sample of time 0 (first sync sample)
+        size_t data_start; //time of the first data sample, known after sync
+        size_t time; //discrete time of the next sample
+        double gain; //received sync amplitude, 1 until synchronized
+        double gram[2]; //sums of cos and sin of 4 pi f t over a symbol
+
+        /* Symbol decision state, survives block boundaries. */
+        size_t histogram[CARRIER_PHASES]; //result histogram of cur. symbol
+        double acc_i; //correlator in-phase accumulator
+        double acc_q; //correlator quadrature accumulator
+        size_t items; //samples of the current symbol already processed
+
+        /* Statistics since the last reset. Low margin histogram decision
+         * wins by less than QPSK_LOW_MARGIN * symbol_len hits, low margin
+         * correlator decision has min(|I|, |Q|) < QPSK_LOW_MARGIN * max,
+         * low margin constellation decision has squared distances of the
+         * winner and the runner-up closer than QPSK_LOW_MARGIN * spacing^2
+         * (which is their difference right at the winning point). */
+        size_t symbols; //decided symbols
+        size_t ties; //decisions without a clear winner
+        size_t low_margin; //winner less than QPSK_LOW_MARGIN ahead
+
+        double *samples; //normalized samples, QPSK_BLOCK
+        carrier_window_t window; //NCO output, unused with tables
+
+        /* Integer carrier tables for narrow samples, built from the carrier
+         * on first use after reset (never for the NCO). Histogram
+         * references are scaled to the sample amplitude, I/Q mixers to
+         * 32767. */
+        int16_t *int_tables; //one allocation for all the tables below
+        int int_ready; //tables match the carrier
+        const int16_t *ref_s16[CARRIER_PHASES];
+        const int16_t *ref_u8[CARRIER_PHASES];
+        const int16_t *in_phase_q15;
+        const int16_t *quadrature_q15;
+        int threshold_s16; //threshold in 16 bit sample units
+        int threshold_u8; //threshold in 8 bit sample units
+} qpsk_demod_t;
+
+
+/**
+ * \brief Default parameters, 18000 Hz, 1000 Hz carrier, 30 samples/symbol.
+ */
+void qpsk_params_default(qpsk_params_t *params);
+
+/**
+ * \brief Check the parameters.
+ *
+ * Sync sequence has 2 to QPSK_SYNC_MAX symbols and its first two symbols
+ * differ, so the symbol length is unambiguous. Sample rate is at most
+ * QPSK_RATE_MAX (the NCO wraps freq * time modulo the rate in 64 bits).
+ * Symbol length is at most two carrier periods, 0 (unknown) passes. Framed
+ * sync sequence is at least PREAMBLE_MIN_SAMPLES long, so it can be told
+ * from noise anywhere in the stream, shorter ones are matched exactly at
+ * the input start only. Frame payload is at most FRAME_MAX_PAYLOAD symbols,
+ * frames carry QPSK symbols only.
+ *
+ * \return NULL if valid, description of the first bad parameter otherwise.
+ */
+const char * qpsk_params_check(const qpsk_params_t *params);
+
+/**
+ * \brief Format the parameters as "key=value" lines (the WAV chunk).
+ *
+ * \return Length of the text, as snprintf().
+ */
+int qpsk_params_format(const qpsk_params_t *params, char *buf, size_t size);
+
+/**
+ * \brief Parse "key=value" lines, unknown keys are skipped.
+ *
+ * \return 0 on success, -1 on a malformed value of a known key.
+ */
+int qpsk_params_parse(qpsk_params_t *params, const char *text, size_t len);
+
+/**
+ * \brief Number of symbols of the sync sequence.
+ */
+static inline size_t qpsk_sync_symbols(const char *sync_seq)
+{
+        size_t len = 0;
+
+
+        while (sync_seq[len] != '\0') {
+                len++;
+        }
+
+        return len / 2;
+}
+
+
+/**
+ * \brief Initialize modulator producing symbols symbol_len samples long.
+ *
+ * QPSK_SYNC_SEQ is used until qpsk_mod_configure().
+ */
+void qpsk_mod_init(qpsk_mod_t *mod, const carrier_t *carrier,
+                size_t symbol_len);
+
+/**
+ * \brief Take symbol length, sync sequence, framing and constellation from
+ *        the parameters.
+ *
+ * Sync sequence is always QPSK, the symbols of qpsk_mod_process() are
+ * indices of the constellation. Framed modulator takes the symbols of whole
+ * frames, sync sequences and headers included (see frame.h), carrier time
+ * restarts at every frame. Parameters are referenced, they have to outlive
+ * the modulator.
+ */
+void qpsk_mod_configure(qpsk_mod_t *mod, const qpsk_params_t *params);
+
+/**
+ * \brief Move the modulator before the symbol (sync sequence included).
+ *
+ * Waveform of a symbol depends only on its position, so independent parts
+ * of one stream may be synthesized by independent modulators.
+ */
+void qpsk_mod_seek(qpsk_mod_t *mod, size_t symbol);
+
+/**
+ * \brief Synthesize the synchronization sequence.
+ *
+ * \return Number of stored samples, sync symbols * symbol_len.
+ */
+size_t qpsk_mod_sync(qpsk_mod_t *mod, int *samples);
+
+/**
+ * \brief Synthesize phase shift indices (2 * first_bit + second_bit), or
+ *        point indices of the constellation.
+ *
+ * Symbols of the sync sequence (the modulator was moved before it by
+ * qpsk_mod_seek()) are always phase shift indices.
+ *
+ * \return Number of stored samples, count * symbol_len.
+ */
+size_t qpsk_mod_process(qpsk_mod_t *mod, const unsigned char *symbols,
+                size_t count, int *samples);
+
+
+/**
+ * \brief Initialize demodulator searching for the synchronization sequence.
+ *
+ * Sync sequence may start anywhere in the stream (after silence or noise),
+ * time 0 of the carrier is its first sample. See preamble.h.
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+int qpsk_demod_init(qpsk_demod_t *demod, const carrier_t *carrier,
+                qpsk_decision_t decision);
+
+/**
+ * \brief Take sync sequence, threshold, symbol length and constellation from
+ *        the parameters.
+ *
+ * Defaults are QPSK_SYNC_SEQ, QPSK_THRESHOLD, 0 (every symbol length up to
+ * two carrier periods is searched for) and QPSK. Other constellations are
+ * always decided by the I/Q correlator, the nearest point of the table
+ * wins (see qpsk_demod_start() for the gain). Parameters are referenced,
+ * they have to outlive the demodulator. Call before the stream starts.
+ */
+void qpsk_demod_configure(qpsk_demod_t *demod, const qpsk_params_t *params);
+
+/**
+ * \brief Forget the stream, search for the synchronization sequence again.
+ *
+ * Carrier tables may be recomputed between streams, before the reset.
+ */
+void qpsk_demod_reset(qpsk_demod_t *demod);
+
+/**
+ * \brief Search for the next synchronization sequence, starting with the
+ *        next sample (its input sample 0).
+ *
+ * Unlike qpsk_demod_reset() the statistics and the carrier tables are kept,
+ * for the frames of one stream.
+ */
+void qpsk_demod_resync(qpsk_demod_t *demod);
+
+/**
+ * \brief Free demodulator resources.
+ */
+void qpsk_demod_free(qpsk_demod_t *demod);
+
+/**
+ * \brief Skip synchronization, the next sample is the first sample of
+ *        a symbol at discrete time (for decoding of independent parts).
+ *
+ * Gain of the signal measured on the sync sequence is kept (it is 1, the
+ * amplitude of the modulator, without one), set demod->gain to decode
+ * a part of an attenuated stream by another demodulator.
+ */
+void qpsk_demod_start(qpsk_demod_t *demod, size_t symbol_len, size_t time);
+
+/**
+ * \brief Synchronize and decide symbols from the block of samples.
+ *
+ * Samples are buffered during the search, the sync sequence is found once
+ * two sync sequence lengths follow its start (or at the end of the stream,
+ * see qpsk_demod_flush()). Buffered samples are decoded right away then, but
+ * at most count symbols are stored, the rest is left for the next calls.
+ *
+ * \return Number of stored phase shift indices or -1 on memory allocation
+ *         failure.
+ */
+ssize_t qpsk_demod_process(qpsk_demod_t *demod, const int *samples,
+                size_t count, unsigned char *symbols);
+
+/**
+ * \brief Same as qpsk_demod_process(), count samples in the format.
+ *
+ * Narrow samples are converted only for the synchronization (and while the
+ * buffered samples are decided), symbols are decided by the integer kernels
+ * straight from the samples.
+ */
+ssize_t qpsk_demod_decode(qpsk_demod_t *demod, const void *samples,
+                qpsk_sample_t format, size_t count, unsigned char *symbols);
+
+/**
+ * \brief Size of one sample in the format in bytes.
+ */
+static inline size_t qpsk_sample_size(qpsk_sample_t format)
+{
+        return (format == QPSK_S32) ? sizeof (int) :
+                (format == QPSK_S16) ? sizeof (int16_t) : sizeof (uint8_t);
+}
+
+/**
+ * \brief End of the stream, finish the search and decide buffered symbols.
+ *
+ * Offsets too close to the end are searched for the shorter symbol lengths
+ * which still fit. At most count symbols are stored, call again while count
+ * is returned. Incomplete last symbol is thrown away.
+ *
+ * \return Number of stored phase shift indices or -1 if the sync sequence
+ *         was not found.
+ */
+ssize_t qpsk_demod_flush(qpsk_demod_t *demod, unsigned char *symbols,
+                size_t count);
+
+/**
+ * \brief Whether the synchronization sequence was found.
+ */
+static inline int qpsk_demod_synced(const qpsk_demod_t *demod)
+{
+        return demod->sync_state == QPSK_SYNC_DONE;
+}
+
+#endif //QPSK_H
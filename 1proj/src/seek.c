@@ -0,0 +1,238 @@
+/**
+ * \file seek.c
+ * \brief Seek index, payload bit offsets to sample offsets
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "seek.h"
+
+
+#define MIN_POINTS 16 //initial allocation
+
+
+static int add_point(seek_index_t *index, size_t *size, size_t bit,
+                size_t sample, size_t time)
+{
+        if (index->count == *size) {
+                const size_t new_size = (*size == 0) ? MIN_POINTS : *size * 2;
+                seek_point_t *points = realloc(index->points,
+                                new_size * sizeof (*points));
+
+                if (points == NULL) {
+                        return -1;
+                }
+                index->points = points;
+                *size = new_size;
+        }
+        index->points[index->count].bit = bit;
+        index->points[index->count].sample = sample;
+        index->points[index->count].time = time;
+        index->count++;
+
+        return 0;
+}
+
+
+int seek_index_layout(seek_index_t *index, const qpsk_params_t *params,
+                size_t origin, size_t samples)
+{
+        const size_t len = params->symbol_len;
+        const int framed = (params->frame != 0);
+        const size_t sync_symbols = qpsk_sync_symbols(params->sync_seq);
+        /* Samples before the payload of a frame (or of the stream). */
+        const size_t head = len * (framed ? frame_symbols(sync_symbols, 0) :
+                        sync_symbols);
+        const size_t period = len * frame_symbols(sync_symbols,
+                        params->frame);
+        const size_t step = framed ? params->frame : SEEK_STEP;
+        const unsigned bits = constellation_get(params->constellation)->bits;
+        size_t symbols = 0; //indexed payload symbols
+        size_t size = 0; //allocated points
+
+
+        memset(index, 0, sizeof (*index));
+        index->symbol_len = len;
+
+        for (size_t k = 0; ; ++k) {
+                const size_t pos = origin + (framed ? k * period + head :
+                                head + k * step * len);
+                size_t run = (samples > pos) ? (samples - pos) / len : 0;
+
+                if (run > step) {
+                        run = step;
+                }
+                if (run == 0) {
+                        break;
+                }
+                /* Carrier time restarts with every frame. */
+                if (add_point(index, &size, bits * symbols, pos,
+                                        framed ? head : pos - origin) != 0)
+                {
+                        seek_index_free(index);
+                        return -1;
+                }
+                symbols += run;
+                if (run < step) { //short last frame
+                        break;
+                }
+        }
+        if (bits != 2 && symbols > 0) { //trailer of the wide symbols
+                symbols--;
+        }
+        index->bits = bits * symbols;
+
+        return 0;
+}
+
+int seek_index_save(const seek_index_t *index, const char *file_name)
+{
+        FILE *file = fopen(file_name, "w");
+        int ret = 0;
+
+
+        if (file == NULL) {
+                return -1;
+        }
+
+        if (fprintf(file, "symbol_len=%zu\nbits=%zu\npoints=%zu\n",
+                                index->symbol_len, index->bits,
+                                index->count) < 0)
+        {
+                ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < index->count; ++i) {
+                const seek_point_t *point = &index->points[i];
+
+                if (fprintf(file, "%zu %zu %zu\n", point->bit, point->sample,
+                                        point->time) < 0)
+                {
+                        ret = -1;
+                }
+        }
+
+        if (fclose(file) != 0) {
+                ret = -1;
+        }
+
+        return ret;
+}
+
+int seek_index_load(seek_index_t *index, const char *file_name)
+{
+        FILE *file = fopen(file_name, "r");
+        size_t count;
+
+
+        memset(index, 0, sizeof (*index));
+        if (file == NULL) {
+                return -1;
+        }
+
+        if (fscanf(file, "symbol_len=%zu bits=%zu points=%zu",
+                                &index->symbol_len, &index->bits,
+                                &count) != 3 || index->symbol_len == 0 ||
+                        count > index->bits)
+        {
+                goto malformed_lab;
+        }
+        index->points = malloc((count + 1) * sizeof (*index->points));
+        if (index->points == NULL) {
+                fclose(file);
+                return -1;
+        }
+
+        for (; index->count < count; ++index->count) {
+                seek_point_t *point = &index->points[index->count];
+
+                if (fscanf(file, "%zu %zu %zu", &point->bit, &point->sample,
+                                        &point->time) != 3 ||
+                                point->bit % 2 != 0 ||
+                                point->bit >= index->bits ||
+                                (index->count > 0 && point->bit <=
+                                 point[-1].bit))
+                {
+                        goto malformed_lab;
+                }
+        }
+        fclose(file);
+
+        return 0;
+
+
+malformed_lab:
+        fclose(file);
+        seek_index_free(index);
+        errno = EINVAL;
+
+        return -1;
+}
+
+int seek_index_match(const seek_index_t *index, const qpsk_params_t *params,
+                size_t samples)
+{
+        const size_t sync_symbols = qpsk_sync_symbols(params->sync_seq);
+        qpsk_params_t layout_params = *params;
+        seek_index_t layout;
+        size_t head;
+        int match;
+
+
+        if (params->symbol_len == 0) { //no header, trust the index
+                layout_params.symbol_len = index->symbol_len;
+        } else if (params->symbol_len != index->symbol_len) {
+                return 0;
+        }
+        if (index->count == 0) {
+                return 0;
+        }
+
+        /* Origin of the transmission follows from the first point. */
+        head = layout_params.symbol_len * ((params->frame != 0) ?
+                        frame_symbols(sync_symbols, 0) : sync_symbols);
+        if (index->points[0].sample < head) {
+                return 0;
+        }
+        if (seek_index_layout(&layout, &layout_params,
+                                index->points[0].sample - head, samples) != 0)
+        {
+                return -1;
+        }
+
+        match = (layout.bits == index->bits && layout.count == index->count &&
+                        memcmp(layout.points, index->points,
+                                index->count * sizeof (*index->points)) == 0);
+        seek_index_free(&layout);
+
+        return match;
+}
+
+size_t seek_index_find(const seek_index_t *index, size_t bit)
+{
+        size_t low = 0, high = index->count; //answer in [low, high)
+
+
+        while (high - low > 1) {
+                const size_t mid = low + (high - low) / 2;
+
+                if (index->points[mid].bit <= bit) {
+                        low = mid;
+                } else {
+                        high = mid;
+                }
+        }
+
+        return low;
+}
+
+void seek_index_free(seek_index_t *index)
+{
+        free(index->points);
+        index->points = NULL;
+        index->count = 0;
+}
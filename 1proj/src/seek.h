@@ -0,0 +1,94 @@
+/**
+ * \file seek.h
+ * \brief Seek index, payload bit offsets to sample offsets
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Payload symbols between two seek points are contiguous, one symbol_len
+ * apart, so any bit range is decoded from the points alone: the sample
+ * offset of its first symbol and the carrier time (phase reference) of that
+ * sample. Points are at every frame start of a framed transmission (see
+ * frame.h) and every SEEK_STEP symbols otherwise. Symbols carry the bits of
+ * the constellation, payload of the wider ones ends with the trailer symbol
+ * (see bits_reader_width()), which is not indexed.
+ *
+ * The sidecar file is text, "symbol_len=", "bits=" and "points=" lines
+ * followed by "bit sample time" lines.
+ */
+
+#ifndef SEEK_H
+#define SEEK_H
+
+#include <stddef.h>
+
+#include "qpsk.h"
+
+
+#define SEEK_STEP (1 << 20) //payload symbols between two unframed points
+
+
+typedef struct { //start of a contiguous run of payload symbols
+        size_t bit; //payload bit offset
+        size_t sample; //file sample of its symbol
+        size_t time; //carrier time of the sample
+} seek_point_t;
+
+typedef struct { //seek index of one file
+        size_t symbol_len; //in samples
+        size_t bits; //payload bits, padding of the last symbol included
+        seek_point_t *points; //ascending bit offsets
+        size_t count;
+} seek_index_t;
+
+
+/**
+ * \brief Index the layout of a transmission with the parameters.
+ *
+ * Its (first) sync sequence starts at the file sample origin, the file has
+ * samples samples. Incomplete last symbol carries no payload.
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+int seek_index_layout(seek_index_t *index, const qpsk_params_t *params,
+                size_t origin, size_t samples);
+
+/**
+ * \brief Write the index to the sidecar file.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int seek_index_save(const seek_index_t *index, const char *file_name);
+
+/**
+ * \brief Read the index from the sidecar file.
+ *
+ * \return 0 on success, -1 on error (errno is set, EINVAL if malformed).
+ */
+int seek_index_load(seek_index_t *index, const char *file_name);
+
+/**
+ * \brief Whether the index describes the file with the parameters and
+ *        samples samples.
+ *
+ * The layout of the parameters is compared with the index point by point,
+ * so an index left over from another transmission is told apart. Unknown
+ * symbol length (0) is taken from the index.
+ *
+ * \return 1 if it does, 0 if not, -1 on memory allocation failure.
+ */
+int seek_index_match(const seek_index_t *index, const qpsk_params_t *params,
+                size_t samples);
+
+/**
+ * \brief Point of the run containing the payload bit.
+ *
+ * \return Index of the last point at or before the bit.
+ */
+size_t seek_index_find(const seek_index_t *index, size_t bit);
+
+/**
+ * \brief Free the points.
+ */
+void seek_index_free(seek_index_t *index);
+
+#endif //SEEK_H
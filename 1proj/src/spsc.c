@@ -0,0 +1,138 @@
+/**
+ * \file spsc.c
+ * \brief Lock-free single-producer single-consumer ring of blocks
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <time.h>
+
+#include "spsc.h"
+
+
+#define SPSC_YIELDS 64 //waits by sched_yield() before sleeping
+#define SPSC_SLEEP_NS 50000 //sleep of one wait, after the yields
+
+
+/* Other side is busy: yield first, sleep if it takes long (e.g. I/O). */
+static void spsc_wait(unsigned *waits)
+{
+        if (++*waits < SPSC_YIELDS) {
+                sched_yield();
+        } else {
+                const struct timespec ts = { 0, SPSC_SLEEP_NS };
+
+                nanosleep(&ts, NULL);
+        }
+}
+
+
+int spsc_init(spsc_t *ring, size_t slots, size_t slot_size)
+{
+        assert(slots > 0 && (slots & (slots - 1)) == 0);
+
+        memset(ring, 0, sizeof (*ring));
+        ring->slots = slots;
+        ring->slot_size = slot_size;
+        ring->buf = malloc(slots * slot_size);
+        ring->lens = malloc(slots * sizeof (*ring->lens));
+        if (ring->buf == NULL || ring->lens == NULL) {
+                spsc_free(ring);
+                return -1;
+        }
+
+        return 0;
+}
+
+void spsc_free(spsc_t *ring)
+{
+        free(ring->lens);
+        free(ring->buf);
+        ring->lens = NULL;
+        ring->buf = NULL;
+}
+
+void * spsc_produce_begin(spsc_t *ring)
+{
+        const size_t head = ring->head; //only the producer writes it
+        unsigned waits = 0;
+
+
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+                        ring->slots)
+        {
+                if (spsc_aborted(ring)) {
+                        return NULL;
+                }
+                spsc_wait(&waits);
+        }
+        if (spsc_aborted(ring)) {
+                return NULL;
+        }
+
+        return ring->buf + (head & (ring->slots - 1)) * ring->slot_size;
+}
+
+void spsc_produce_end(spsc_t *ring, size_t len)
+{
+        const size_t head = ring->head;
+
+
+        assert(len <= ring->slot_size);
+        ring->lens[head & (ring->slots - 1)] = len;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void spsc_close(spsc_t *ring)
+{
+        __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+void * spsc_consume_begin(spsc_t *ring, size_t *len)
+{
+        const size_t tail = ring->tail; //only the consumer writes it
+        unsigned waits = 0;
+
+
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+                if (spsc_aborted(ring)) {
+                        return NULL;
+                }
+                /* Head is published before closing, check it once more. */
+                if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+                        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+                                        tail)
+                        {
+                                return NULL;
+                        }
+                        break;
+                }
+                spsc_wait(&waits);
+        }
+        if (spsc_aborted(ring)) {
+                return NULL;
+        }
+
+        *len = ring->lens[tail & (ring->slots - 1)];
+
+        return ring->buf + (tail & (ring->slots - 1)) * ring->slot_size;
+}
+
+void spsc_consume_end(spsc_t *ring)
+{
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+void spsc_abort(spsc_t *ring)
+{
+        __atomic_store_n(&ring->aborted, 1, __ATOMIC_RELEASE);
+}
+
+int spsc_aborted(const spsc_t *ring)
+{
+        return __atomic_load_n(&ring->aborted, __ATOMIC_ACQUIRE);
+}
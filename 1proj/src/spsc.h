@@ -0,0 +1,85 @@
+/**
+ * \file spsc.h
+ * \brief Lock-free single-producer single-consumer ring of blocks
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Ring has a fixed number of slots of fixed size. The producer fills the
+ * slot in place and publishes it, the consumer processes it in place and
+ * releases it, so nothing is copied. Full ring blocks the producer
+ * (backpressure), empty ring blocks the consumer. Only the two index
+ * counters are shared, no locks are taken.
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+
+
+typedef struct {
+        size_t slots; //number of slots, power of two
+        size_t slot_size; //bytes
+        unsigned char *buf; //slots * slot_size bytes
+        size_t *lens; //valid bytes in each slot
+
+        size_t head; //published slots, written by the producer, atomic
+        size_t tail; //released slots, written by the consumer, atomic
+        int closed; //producer has finished, atomic
+        int aborted; //one side has failed, atomic
+} spsc_t;
+
+
+/**
+ * \brief Allocate ring of slots (power of two) blocks, slot_size bytes each.
+ *
+ * \return 0 on success, -1 on memory allocation failure.
+ */
+int spsc_init(spsc_t *ring, size_t slots, size_t slot_size);
+
+/**
+ * \brief Free ring memory.
+ */
+void spsc_free(spsc_t *ring);
+
+/**
+ * \brief Producer: wait for a free slot.
+ *
+ * \return Slot of slot_size bytes or NULL if the ring was aborted.
+ */
+void * spsc_produce_begin(spsc_t *ring);
+
+/**
+ * \brief Producer: publish the slot from spsc_produce_begin() with len bytes.
+ */
+void spsc_produce_end(spsc_t *ring, size_t len);
+
+/**
+ * \brief Producer: no more slots will be published.
+ */
+void spsc_close(spsc_t *ring);
+
+/**
+ * \brief Consumer: wait for a published slot.
+ *
+ * \return Slot with len valid bytes or NULL if the ring is closed and empty
+ *         or it was aborted.
+ */
+void * spsc_consume_begin(spsc_t *ring, size_t *len);
+
+/**
+ * \brief Consumer: release the slot from spsc_consume_begin().
+ */
+void spsc_consume_end(spsc_t *ring);
+
+/**
+ * \brief Either side: give up, both sides stop waiting.
+ */
+void spsc_abort(spsc_t *ring);
+
+/**
+ * \brief Whether the ring was aborted.
+ */
+int spsc_aborted(const spsc_t *ring);
+
+#endif //SPSC_H
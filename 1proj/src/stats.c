@@ -0,0 +1,120 @@
+/**
+ * \file stats.c
+ * \brief Per-stage timing and counter instrumentation
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stats.h"
+
+
+static const char *stage_names[STATS_STAGES] = {
+        "read",
+        "sync",
+        "dsp",
+        "write",
+};
+
+static const struct {
+        const char *name;
+        uint64_t config;
+} hw_events[STATS_HW_COUNTERS] = {
+        { "cycles", PERF_COUNT_HW_CPU_CYCLES },
+        { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+        { "cache_misses", PERF_COUNT_HW_CACHE_MISSES },
+};
+
+
+/* Counter of the calling process and its future threads, user space only. */
+static int hw_open(uint64_t config)
+{
+        struct perf_event_attr attr;
+
+
+        memset(&attr, 0, sizeof (attr));
+        attr.size = sizeof (attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+void stats_init(stats_t *stats, int hw)
+{
+        int warned = 0;
+
+
+        memset(stats, 0, sizeof (*stats));
+        stats->start = batch_time();
+
+        for (size_t i = 0; i < STATS_HW_COUNTERS; ++i) {
+                stats->hw_fd[i] = hw ? hw_open(hw_events[i].config) : -1;
+                if (hw && stats->hw_fd[i] == -1 && !warned) {
+                        perror("warning: perf_event_open");
+                        warned = 1;
+                }
+        }
+}
+
+void stats_merge(stats_t *dst, const stats_t *src)
+{
+        for (size_t i = 0; i < STATS_STAGES; ++i) {
+                dst->seconds[i] += src->seconds[i];
+        }
+        dst->files += src->files;
+        dst->samples += src->samples;
+        dst->symbols += src->symbols;
+        dst->ties += src->ties;
+        dst->low_margin += src->low_margin;
+}
+
+void stats_print(stats_t *stats, FILE *out)
+{
+        const double wall = batch_time() - stats->start;
+        int hw = 0;
+
+
+        fprintf(out, "{\"wall_seconds\": %.6f, \"files\": %zu, "
+                        "\"stages\": {", wall, stats->files);
+        for (size_t i = 0; i < STATS_STAGES; ++i) {
+                fprintf(out, "%s\"%s\": %.6f", (i == 0) ? "" : ", ",
+                                stage_names[i], stats->seconds[i]);
+        }
+        fprintf(out, "}, \"samples\": %zu, \"symbols\": %zu, "
+                        "\"ties\": %zu, \"low_margin\": %zu, ",
+                        stats->samples, stats->symbols, stats->ties,
+                        stats->low_margin);
+        fprintf(out, "\"samples_per_s\": %.1f, \"hw\": ",
+                        (wall > 0.0) ? stats->samples / wall : 0.0);
+
+        /* Hardware counters, null if not available. */
+        for (size_t i = 0; i < STATS_HW_COUNTERS; ++i) {
+                uint64_t value;
+
+                if (stats->hw_fd[i] == -1) {
+                        continue;
+                }
+                fprintf(out, "%s\"%s\": ", hw ? ", " : "{",
+                                hw_events[i].name);
+                if (read(stats->hw_fd[i], &value, sizeof (value)) ==
+                                sizeof (value))
+                {
+                        fprintf(out, "%llu", (unsigned long long)value);
+                } else {
+                        fprintf(out, "null");
+                }
+                close(stats->hw_fd[i]);
+                stats->hw_fd[i] = -1;
+                hw = 1;
+        }
+        fprintf(out, "%s}\n", hw ? "}" : "null");
+}
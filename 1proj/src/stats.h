@@ -0,0 +1,84 @@
+/**
+ * \file stats.h
+ * \brief Per-stage timing and counter instrumentation
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch.h" //batch_time
+
+
+typedef enum { //measured stages
+        STATS_READ, //input read and parsing
+        STATS_SYNC, //synchronization sequence
+        STATS_DSP, //symbol decision (demodulator) or synthesis (modulator)
+        STATS_WRITE, //output formatting and write
+        STATS_STAGES, //number of stages
+} stats_stage_t;
+
+typedef enum { //hardware counters
+        STATS_HW_CYCLES,
+        STATS_HW_INSTRUCTIONS,
+        STATS_HW_CACHE_MISSES,
+        STATS_HW_COUNTERS, //number of counters
+} stats_hw_t;
+
+typedef struct {
+        double seconds[STATS_STAGES]; //time spent in the stages
+        size_t files; //processed files
+        size_t samples; //read (demodulator) or written (modulator)
+        size_t symbols; //decided (demodulator) or synthesized (modulator)
+        size_t ties; //decisions without a clear winner
+        size_t low_margin; //decisions with low margin (see qpsk.h)
+
+        double start; //wall clock time of stats_init()
+        int hw_fd[STATS_HW_COUNTERS]; //perf events, -1 if not available
+} stats_t;
+
+
+/**
+ * \brief Zero the statistics, optionally start hardware counters.
+ *
+ * Hardware counters are counted by perf_event_open() for the whole process,
+ * threads created afterwards included. If they are not available, warning
+ * is printed and they are reported as null.
+ */
+void stats_init(stats_t *stats, int hw);
+
+/**
+ * \brief Add times and counters of src (e.g. of a worker thread) to dst.
+ */
+void stats_merge(stats_t *dst, const stats_t *src);
+
+/**
+ * \brief Print the JSON summary and stop hardware counters.
+ */
+void stats_print(stats_t *stats, FILE *out);
+
+/**
+ * \brief Timestamp for stats_stop(), nothing is done without stats.
+ */
+static inline double stats_start(const stats_t *stats)
+{
+        return (stats == NULL) ? 0.0 : batch_time();
+}
+
+/**
+ * \brief Add time since the start to the stage.
+ */
+static inline void stats_stop(stats_t *stats, stats_stage_t stage,
+                double start)
+{
+        if (stats != NULL) {
+                stats->seconds[stage] += batch_time() - start;
+        }
+}
+
+#endif //STATS_H
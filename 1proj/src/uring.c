@@ -0,0 +1,342 @@
+/**
+ * \file uring.c
+ * \brief Sequential file reader on io_uring
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#define _GNU_SOURCE //syscall
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+
+#define URING_PENDING ((ssize_t)INT32_MIN - 1) //result of a read in flight
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *params)
+{
+        return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int ring_fd, unsigned to_submit, unsigned min_complete)
+{
+        return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                        min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static int sys_register(int ring_fd, unsigned opcode, void *arg,
+                unsigned count)
+{
+        return syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
+
+
+/* Queue reads into all free buffers and submit them. */
+static int submit_reads(uring_reader_t *reader)
+{
+        unsigned tail = *reader->sq_tail;
+
+
+        while (reader->submitted < reader->consumed + reader->depth) {
+                const size_t offset = reader->start +
+                        reader->submitted * reader->block_size;
+                const unsigned buf = reader->submitted % reader->depth;
+                const unsigned idx = tail & *reader->sq_mask;
+                struct io_uring_sqe *sqe =
+                        (struct io_uring_sqe *)reader->sqes + idx;
+
+                if (offset >= reader->end) {
+                        break;
+                }
+                reader->lens[buf] = (reader->end - offset < reader->block_size)
+                        ? reader->end - offset : reader->block_size;
+                reader->results[buf] = URING_PENDING;
+
+                memset(sqe, 0, sizeof (*sqe));
+                sqe->opcode = reader->fixed ? IORING_OP_READ_FIXED :
+                        IORING_OP_READ;
+                sqe->fd = reader->fd;
+                sqe->off = offset;
+                sqe->addr = (uintptr_t)(reader->buffers +
+                                buf * reader->block_size);
+                sqe->len = reader->lens[buf];
+                sqe->buf_index = buf;
+                sqe->user_data = buf;
+                reader->sq_array[idx] = idx;
+
+                tail++;
+                reader->queued++;
+                reader->submitted++;
+        }
+        __atomic_store_n(reader->sq_tail, tail, __ATOMIC_RELEASE);
+
+        while (reader->queued > 0) {
+                const int ret = sys_enter(reader->ring_fd, reader->queued, 0);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1; //queued reads go with the next enter
+                }
+                reader->in_flight += ret;
+                reader->queued -= ret;
+        }
+
+        return 0;
+}
+
+/* Move all available completions to the results. */
+static void reap_completions(uring_reader_t *reader)
+{
+        unsigned head = *reader->cq_head;
+
+
+        while (head != __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE)) {
+                const struct io_uring_cqe *cqe =
+                        (struct io_uring_cqe *)reader->cqes +
+                        (head & *reader->cq_mask);
+
+                reader->results[cqe->user_data] = cqe->res;
+                reader->in_flight--;
+                head++;
+        }
+        __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Block until at least one completion arrives. */
+static int wait_completion(uring_reader_t *reader)
+{
+        int ret;
+
+
+        while ((ret = sys_enter(reader->ring_fd, reader->queued, 1)) == -1) {
+                if (errno != EINTR) {
+                        return -1;
+                }
+        }
+        reader->in_flight += ret;
+        reader->queued -= ret;
+        reap_completions(reader);
+
+        return 0;
+}
+
+static int map_rings(uring_reader_t *reader, const struct io_uring_params *p)
+{
+        reader->sq_size = p->sq_off.array + p->sq_entries * sizeof (unsigned);
+        reader->cq_size = p->cq_off.cqes +
+                p->cq_entries * sizeof (struct io_uring_cqe);
+        if (p->features & IORING_FEAT_SINGLE_MMAP) {
+                if (reader->cq_size > reader->sq_size) {
+                        reader->sq_size = reader->cq_size;
+                }
+                reader->cq_size = reader->sq_size;
+        }
+        reader->sqes_size = p->sq_entries * sizeof (struct io_uring_sqe);
+
+        reader->sq_ptr = mmap(NULL, reader->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, reader->ring_fd,
+                        IORING_OFF_SQ_RING);
+        if (reader->sq_ptr == MAP_FAILED) {
+                reader->sq_ptr = NULL;
+                return -1;
+        }
+        if (p->features & IORING_FEAT_SINGLE_MMAP) {
+                reader->cq_ptr = reader->sq_ptr;
+        } else {
+                reader->cq_ptr = mmap(NULL, reader->cq_size,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, reader->ring_fd,
+                                IORING_OFF_CQ_RING);
+                if (reader->cq_ptr == MAP_FAILED) {
+                        reader->cq_ptr = NULL;
+                        return -1;
+                }
+        }
+        reader->sqes = mmap(NULL, reader->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, reader->ring_fd,
+                        IORING_OFF_SQES);
+        if (reader->sqes == MAP_FAILED) {
+                reader->sqes = NULL;
+                return -1;
+        }
+
+        reader->sq_head = (unsigned *)((char *)reader->sq_ptr +
+                        p->sq_off.head);
+        reader->sq_tail = (unsigned *)((char *)reader->sq_ptr +
+                        p->sq_off.tail);
+        reader->sq_mask = (unsigned *)((char *)reader->sq_ptr +
+                        p->sq_off.ring_mask);
+        reader->sq_array = (unsigned *)((char *)reader->sq_ptr +
+                        p->sq_off.array);
+        reader->cq_head = (unsigned *)((char *)reader->cq_ptr +
+                        p->cq_off.head);
+        reader->cq_tail = (unsigned *)((char *)reader->cq_ptr +
+                        p->cq_off.tail);
+        reader->cq_mask = (unsigned *)((char *)reader->cq_ptr +
+                        p->cq_off.ring_mask);
+        reader->cqes = (char *)reader->cq_ptr + p->cq_off.cqes;
+
+        return 0;
+}
+
+
+int uring_reader_init(uring_reader_t *reader, int fd, size_t offset,
+                size_t length, size_t block_size, unsigned depth)
+{
+        struct io_uring_params params;
+        struct iovec *iov;
+        int err;
+
+
+        memset(reader, 0, sizeof (*reader));
+        memset(&params, 0, sizeof (params));
+        reader->fd = fd;
+        reader->depth = depth;
+        reader->block_size = block_size;
+        reader->start = offset;
+        reader->end = (length > SIZE_MAX - offset) ? SIZE_MAX :
+                offset + length;
+
+        reader->ring_fd = sys_setup(depth, &params);
+        if (reader->ring_fd == -1) {
+                return -1;
+        }
+        if (map_rings(reader, &params) != 0) {
+                goto free_lab;
+        }
+
+        reader->buffers = aligned_alloc(4096, depth * block_size);
+        reader->results = malloc(depth * sizeof (*reader->results));
+        reader->lens = malloc(depth * sizeof (*reader->lens));
+        iov = malloc(depth * sizeof (*iov));
+        if (reader->buffers == NULL || reader->results == NULL ||
+                        reader->lens == NULL || iov == NULL)
+        {
+                free(iov);
+                errno = ENOMEM;
+                goto free_lab;
+        }
+
+        /* Registered buffers save page pinning on every read, optional. */
+        for (unsigned i = 0; i < depth; ++i) {
+                iov[i].iov_base = reader->buffers + i * block_size;
+                iov[i].iov_len = block_size;
+        }
+        reader->fixed = (sys_register(reader->ring_fd,
+                                IORING_REGISTER_BUFFERS, iov, depth) == 0);
+        free(iov);
+
+        if (submit_reads(reader) != 0) {
+                goto free_lab;
+        }
+
+        return 0;
+
+
+free_lab:
+        err = errno;
+        uring_reader_free(reader);
+        errno = err;
+
+        return -1;
+}
+
+int uring_reader_next(uring_reader_t *reader, const unsigned char **data,
+                size_t *len)
+{
+        const unsigned buf = reader->consumed % reader->depth;
+        unsigned char *ptr = reader->buffers + buf * reader->block_size;
+        ssize_t res;
+
+
+        if (reader->eof || reader->consumed == reader->submitted) {
+                return 0;
+        }
+        while (reader->results[buf] == URING_PENDING) {
+                if (wait_completion(reader) != 0) {
+                        return -1;
+                }
+        }
+
+        res = reader->results[buf];
+        if (res < 0) {
+                errno = -res;
+                return -1;
+        }
+
+        /* Short read before the end, finish the block synchronously. */
+        while ((size_t)res < reader->lens[buf]) {
+                const ssize_t ret = pread(reader->fd, ptr + res,
+                                reader->lens[buf] - res,
+                                reader->start + reader->consumed *
+                                reader->block_size + res);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                } else if (ret == 0) { //EOF, no blocks follow
+                        reader->eof = 1;
+                        break;
+                }
+                res += ret;
+        }
+        if (res == 0) {
+                return 0;
+        }
+
+        *data = ptr;
+        *len = res;
+
+        return 1;
+}
+
+void uring_reader_release(uring_reader_t *reader)
+{
+        reader->consumed++;
+        if (!reader->eof) {
+                submit_reads(reader); //error shows up on the next block
+        }
+}
+
+void uring_reader_free(uring_reader_t *reader)
+{
+        while ((reader->in_flight > 0 || reader->queued > 0) &&
+                        reader->cq_ptr != NULL)
+        {
+                if (wait_completion(reader) != 0) {
+                        break;
+                }
+        }
+
+        if (reader->sqes != NULL) {
+                munmap(reader->sqes, reader->sqes_size);
+        }
+        if (reader->cq_ptr != NULL && reader->cq_ptr != reader->sq_ptr) {
+                munmap(reader->cq_ptr, reader->cq_size);
+        }
+        if (reader->sq_ptr != NULL) {
+                munmap(reader->sq_ptr, reader->sq_size);
+        }
+        if (reader->ring_fd > 0) {
+                close(reader->ring_fd);
+        }
+        free(reader->lens);
+        free(reader->results);
+        free(reader->buffers);
+        memset(reader, 0, sizeof (*reader));
+        reader->ring_fd = -1;
+}
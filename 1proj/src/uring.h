@@ -0,0 +1,77 @@
+/**
+ * \file uring.h
+ * \brief Sequential file reader on io_uring
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ *
+ * Keeps depth reads of block_size bytes in flight, so the device queue never
+ * runs dry while the caller processes completed blocks. Buffers are
+ * registered with the kernel if the memlock limit allows it. Raw system
+ * calls are used, no liburing is needed.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/types.h> //ssize_t
+
+
+typedef struct { //reader of one file region
+        int ring_fd;
+        int fd; //file being read
+        unsigned depth; //number of buffers (and reads in flight)
+        size_t block_size; //bytes
+        int fixed; //buffers are registered
+
+        /* Rings shared with the kernel. */
+        void *sq_ptr, *cq_ptr, *sqes;
+        size_t sq_size, cq_size, sqes_size;
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        void *cqes;
+
+        unsigned char *buffers; //depth * block_size
+        ssize_t *results; //per buffer: bytes read, -errno or URING_PENDING
+        size_t *lens; //per buffer: bytes requested
+        size_t start; //file offset of the first block
+        size_t end; //file offset of the end of the region
+        size_t submitted; //blocks submitted
+        size_t consumed; //blocks returned to the caller
+        unsigned queued; //in the submission ring, not taken by the kernel
+        size_t in_flight; //taken by the kernel, not completed
+        int eof; //last block was returned
+} uring_reader_t;
+
+
+/**
+ * \brief Start reading length bytes (SIZE_MAX for up to EOF) at offset.
+ *
+ * \return 0 on success, -1 on error (errno is set, ENOSYS or EPERM if
+ *         io_uring is not available).
+ */
+int uring_reader_init(uring_reader_t *reader, int fd, size_t offset,
+                size_t length, size_t block_size, unsigned depth);
+
+/**
+ * \brief Wait for the next block in file order.
+ *
+ * Block is valid until uring_reader_release(). All blocks except the last one
+ * are full.
+ *
+ * \return 1 on success, 0 at the end of the region, -1 on error (errno).
+ */
+int uring_reader_next(uring_reader_t *reader, const unsigned char **data,
+                size_t *len);
+
+/**
+ * \brief Return the block from uring_reader_next(), its buffer is reused.
+ */
+void uring_reader_release(uring_reader_t *reader);
+
+/**
+ * \brief Wait for the reads in flight and free all resources.
+ */
+void uring_reader_free(uring_reader_t *reader);
+
+#endif //URING_H
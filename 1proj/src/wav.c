@@ -0,0 +1,783 @@
+/**
+ * \file wav.c
+ * \brief Native WAV (RIFF) container support
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#define _GNU_SOURCE //mremap
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wav.h"
+
+
+#define WAV_MAX_CHUNKS 64 //chunks skipped before giving up on data
+#define WAV_MAP_MIN (1 << 20) //initial size of the mapped output [B]
+#define WAV_FLOAT_SCALE 2147483648.0 //full scale of float samples
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WAV_NATIVE_LE 1 //32 bit PCM samples may be used in place
+#else
+#define WAV_NATIVE_LE 0
+#endif
+
+
+static void put_le16(unsigned char *p, uint16_t val)
+{
+        p[0] = val;
+        p[1] = val >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t val)
+{
+        p[0] = val;
+        p[1] = val >> 8;
+        p[2] = val >> 16;
+        p[3] = val >> 24;
+}
+
+static uint16_t get_le16(const unsigned char *p)
+{
+        return p[0] | p[1] << 8;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+        return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Read exactly size bytes at offset, EOF is an error. */
+static int pread_full(int fd, void *buf, size_t size, size_t offset)
+{
+        char *ptr = buf;
+
+
+        while (size > 0) {
+                const ssize_t ret = pread(fd, ptr, size, offset);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                } else if (ret == 0) {
+                        errno = EINVAL; //truncated header
+                        return -1;
+                }
+                ptr += ret;
+                size -= ret;
+                offset += ret;
+        }
+
+        return 0;
+}
+
+/* Read exactly size bytes from a stream, EOF is an error. */
+static int read_full(int fd, void *buf, size_t size)
+{
+        char *ptr = buf;
+
+
+        while (size > 0) {
+                const ssize_t ret = read(fd, ptr, size);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                } else if (ret == 0) {
+                        errno = EINVAL; //truncated header
+                        return -1;
+                }
+                ptr += ret;
+                size -= ret;
+        }
+
+        return 0;
+}
+
+/* Read and drop size bytes of a stream. */
+static int skip_full(int fd, size_t size)
+{
+        char buf[256];
+
+
+        while (size > 0) {
+                const size_t n = (size < sizeof (buf)) ? size : sizeof (buf);
+
+                if (read_full(fd, buf, n) != 0) {
+                        return -1;
+                }
+                size -= n;
+        }
+
+        return 0;
+}
+
+/* Parse the fmt chunk body (at least 16 bytes, 40 if extensible). */
+static int parse_fmt(wav_info_t *info, const unsigned char *buf, size_t size)
+{
+        info->format = get_le16(buf);
+        info->channels = get_le16(buf + 2);
+        info->sample_rate = get_le32(buf + 4);
+        info->bits = get_le16(buf + 14);
+        if (info->format == WAV_FORMAT_EXTENSIBLE) {
+                if (size < 40) {
+                        errno = EINVAL;
+                        return -1;
+                }
+                info->format = get_le16(buf + 24);
+        }
+
+        return 0;
+}
+
+/* Common checks of the parsed header. */
+static int check_header(const wav_info_t *info, int fmt_found)
+{
+        if (info->data_offset == 0 || !fmt_found) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        if ((info->format != WAV_FORMAT_PCM &&
+                                info->format != WAV_FORMAT_FLOAT) ||
+                        info->channels == 0 || info->bits == 0 ||
+                        info->bits % 8 != 0)
+        {
+                errno = ENOTSUP;
+                return -1;
+        }
+
+        return 0;
+}
+
+
+/* Header of wav_header_size(info) bytes, extra chunks included. */
+static void build_header(unsigned char *header, const wav_info_t *info,
+                uint32_t data_size)
+{
+        const unsigned block_align = info->channels * info->bits / 8;
+        const uint32_t riff_size = (data_size == WAV_UNKNOWN_SIZE) ?
+                WAV_UNKNOWN_SIZE : data_size + wav_header_size(info) - 8;
+
+
+        memcpy(header, "RIFF", 4);
+        put_le32(header + 4, riff_size);
+        memcpy(header + 8, "WAVE", 4);
+
+        memcpy(header + 12, "fmt ", 4);
+        put_le32(header + 16, 16); //fmt chunk size
+        put_le16(header + 20, info->format);
+        put_le16(header + 22, info->channels);
+        put_le32(header + 24, info->sample_rate);
+        put_le32(header + 28, info->sample_rate * block_align); //byte rate
+        put_le16(header + 32, block_align);
+        put_le16(header + 34, info->bits);
+
+        if (info->extra_size > 0) {
+                memcpy(header + 36, info->extra, info->extra_size);
+                header += info->extra_size;
+        }
+        memcpy(header + 36, "data", 4);
+        put_le32(header + 40, data_size);
+}
+
+/* Data size as written to the header, WAV_UNKNOWN_SIZE if too long. */
+static uint32_t header_data_size(const wav_info_t *info, uint64_t data_size)
+{
+        return (data_size >= WAV_UNKNOWN_SIZE - (wav_header_size(info) - 8)) ?
+                WAV_UNKNOWN_SIZE : data_size;
+}
+
+
+size_t wav_chunk(unsigned char *buf, const char id[4], const void *data,
+                size_t size)
+{
+        memcpy(buf, id, 4);
+        put_le32(buf + 4, size);
+        memcpy(buf + 8, data, size);
+        if (size & 1) { //chunks are word aligned
+                buf[8 + size++] = 0;
+        }
+
+        return 8 + size;
+}
+
+int wav_write_header(int fd, const wav_info_t *info, size_t frames)
+{
+        const uint64_t data_size = (uint64_t)frames * info->channels *
+                info->bits / 8;
+        unsigned char *header;
+        int ret;
+
+
+        if (header_data_size(info, data_size) == WAV_UNKNOWN_SIZE) {
+                errno = EFBIG; //RIFF sizes are 32 bit
+                return -1;
+        }
+        header = malloc(wav_header_size(info));
+        if (header == NULL) {
+                return -1;
+        }
+        build_header(header, info, data_size);
+        ret = wav_pwrite(fd, header, wav_header_size(info), 0);
+        free(header);
+
+        return ret;
+}
+
+int wav_write_stream_header(int fd, const wav_info_t *info)
+{
+        unsigned char *header = malloc(wav_header_size(info));
+        int ret;
+
+
+        if (header == NULL) {
+                return -1;
+        }
+        build_header(header, info, WAV_UNKNOWN_SIZE);
+        ret = wav_write(fd, header, wav_header_size(info));
+        free(header);
+
+        return ret;
+}
+
+int wav_read_header(int fd, wav_info_t *info)
+{
+        unsigned char buf[40]; //longest used part of a chunk (extensible fmt)
+        size_t offset = 12; //first chunk
+        int fmt_found = 0;
+
+
+        memset(info, 0, sizeof (*info));
+        if (pread_full(fd, buf, 12, 0) != 0) {
+                return -1;
+        }
+        if (memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        for (size_t i = 0; i < WAV_MAX_CHUNKS; ++i) {
+                uint32_t size;
+
+                if (pread_full(fd, buf, 8, offset) != 0) {
+                        return -1;
+                }
+                size = get_le32(buf + 4);
+
+                if (memcmp(buf, "fmt ", 4) == 0) {
+                        if (size < 16 || pread_full(fd, buf,
+                                                (size < 40) ? size : 40,
+                                                offset + 8) != 0 ||
+                                        parse_fmt(info, buf, size) != 0)
+                        {
+                                errno = EINVAL;
+                                return -1;
+                        }
+                        fmt_found = 1;
+                } else if (memcmp(buf, "data", 4) == 0) {
+                        if (!fmt_found) {
+                                errno = EINVAL;
+                                return -1;
+                        }
+                        info->data_offset = offset + 8;
+                        info->data_size = (size == WAV_UNKNOWN_SIZE ||
+                                        size == 0) ? SIZE_MAX : size;
+                        break;
+                }
+                offset += 8 + size + (size & 1); //chunks are word aligned
+        }
+
+        return check_header(info, fmt_found);
+}
+
+int wav_read_stream_header(int fd, wav_info_t *info, const char id[4],
+                void *chunk, size_t *chunk_size)
+{
+        unsigned char buf[40]; //longest used part of a chunk (extensible fmt)
+        size_t offset = 12; //first chunk
+        size_t found = SIZE_MAX; //bytes of the chunk id stored to chunk
+        int fmt_found = 0;
+
+
+        memset(info, 0, sizeof (*info));
+        if (read_full(fd, buf, 12) != 0) {
+                return -1;
+        }
+        if (memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+                errno = EINVAL;
+                return -1;
+        }
+
+        for (size_t i = 0; i < WAV_MAX_CHUNKS; ++i) {
+                void *dest = NULL; //chunk body to keep
+                size_t keep = 0;
+                uint32_t size;
+
+                if (read_full(fd, buf, 8) != 0) {
+                        return -1;
+                }
+                size = get_le32(buf + 4);
+
+                if (memcmp(buf, "data", 4) == 0) {
+                        if (!fmt_found) {
+                                errno = EINVAL;
+                                return -1;
+                        }
+                        info->data_offset = offset + 8;
+                        info->data_size = (size == WAV_UNKNOWN_SIZE ||
+                                        size == 0) ? SIZE_MAX : size;
+                        break;
+                } else if (memcmp(buf, "fmt ", 4) == 0) {
+                        if (size < 16) {
+                                errno = EINVAL;
+                                return -1;
+                        }
+                        dest = buf;
+                        keep = (size < 40) ? size : 40;
+                } else if (memcmp(buf, id, 4) == 0 && found == SIZE_MAX) {
+                        dest = chunk;
+                        keep = (size < *chunk_size) ? size : *chunk_size;
+                        found = keep;
+                }
+
+                if (keep > 0 && read_full(fd, dest, keep) != 0) {
+                        return -1;
+                } else if (skip_full(fd, size - keep + (size & 1)) != 0) {
+                        return -1;
+                }
+                if (dest == buf) {
+                        if (parse_fmt(info, buf, size) != 0) {
+                                return -1;
+                        }
+                        fmt_found = 1;
+                }
+                offset += 8 + size + (size & 1); //chunks are word aligned
+        }
+        *chunk_size = found;
+
+        return check_header(info, fmt_found);
+}
+
+ssize_t wav_read_chunk(int fd, const char id[4], void *buf, size_t size)
+{
+        unsigned char head[8];
+        size_t offset = 12; //first chunk
+
+
+        for (size_t i = 0; i < WAV_MAX_CHUNKS; ++i) {
+                uint32_t chunk_size;
+
+                if (pread_full(fd, head, sizeof (head), offset) != 0) {
+                        return -1;
+                }
+                chunk_size = get_le32(head + 4);
+
+                if (memcmp(head, id, 4) == 0) {
+                        if (size > chunk_size) {
+                                size = chunk_size;
+                        }
+                        if (pread_full(fd, buf, size, offset + 8) != 0) {
+                                return -1;
+                        }
+                        return size;
+                } else if (memcmp(head, "data", 4) == 0) {
+                        break;
+                }
+                offset += 8 + chunk_size + (chunk_size & 1);
+        }
+        errno = ENOENT;
+
+        return -1;
+}
+
+int wav_supported(const wav_info_t *info)
+{
+        if (info->channels != 1) {
+                return 0;
+        }
+        if (info->format == WAV_FORMAT_FLOAT) {
+                return info->bits == 32;
+        }
+
+        return info->format == WAV_FORMAT_PCM && info->bits >= 8 &&
+                info->bits <= 32 && info->bits % 8 == 0;
+}
+
+int wav_native(const wav_info_t *info)
+{
+        if (info->format != WAV_FORMAT_PCM || info->channels != 1) {
+                return 0;
+        }
+        if (info->bits == 8) {
+                return 1;
+        }
+
+        return WAV_NATIVE_LE && (info->bits == 16 || info->bits == 32) &&
+                info->data_offset % (info->bits / 8) == 0;
+}
+
+void wav_to_int(const wav_info_t *info, const unsigned char *data,
+                size_t count, int32_t *samples)
+{
+        if (info->format == WAV_FORMAT_FLOAT) {
+                for (size_t i = 0; i < count; ++i, data += 4) {
+                        const uint32_t bits = get_le32(data);
+                        float x;
+                        double y;
+
+                        memcpy(&x, &bits, sizeof (x));
+                        y = x * WAV_FLOAT_SCALE;
+                        if (!(y > INT32_MIN)) { //NaN too
+                                samples[i] = (y > 0.0) ? INT32_MAX : INT32_MIN;
+                        } else if (y >= INT32_MAX) {
+                                samples[i] = INT32_MAX;
+                        } else {
+                                samples[i] = lrint(y);
+                        }
+                }
+                return;
+        }
+
+        switch (info->bits) {
+        case 8: //unsigned
+                for (size_t i = 0; i < count; ++i) {
+                        samples[i] = (uint32_t)(data[i] ^ 0x80) << 24;
+                }
+                break;
+
+        case 16:
+                for (size_t i = 0; i < count; ++i, data += 2) {
+                        samples[i] = (uint32_t)get_le16(data) << 16;
+                }
+                break;
+
+        case 24:
+                for (size_t i = 0; i < count; ++i, data += 3) {
+                        samples[i] = (uint32_t)(data[0] | data[1] << 8 |
+                                        data[2] << 16) << 8;
+                }
+                break;
+
+        case 32:
+                memcpy(samples, data, count * sizeof (*samples));
+                wav_le32(samples, count);
+                break;
+        }
+}
+
+void wav_from_int(const wav_info_t *info, const int32_t *samples,
+                size_t count, unsigned char *data)
+{
+        if (info->format == WAV_FORMAT_FLOAT) {
+                for (size_t i = 0; i < count; ++i, data += 4) {
+                        const float x = samples[i] / WAV_FLOAT_SCALE;
+                        uint32_t bits;
+
+                        memcpy(&bits, &x, sizeof (bits));
+                        put_le32(data, bits);
+                }
+                return;
+        }
+
+        switch (info->bits) {
+        case 8: //unsigned, rounded to nearest
+                for (size_t i = 0; i < count; ++i) {
+                        const int32_t x = (samples[i] > INT32_MAX - 0x800000) ?
+                                INT32_MAX : samples[i] + 0x800000;
+
+                        data[i] = (x >> 24) ^ 0x80;
+                }
+                break;
+
+        case 16:
+                for (size_t i = 0; i < count; ++i, data += 2) {
+                        const int32_t x = (samples[i] > INT32_MAX - 0x8000) ?
+                                INT32_MAX : samples[i] + 0x8000;
+
+                        put_le16(data, x >> 16);
+                }
+                break;
+
+        case 24:
+                for (size_t i = 0; i < count; ++i, data += 3) {
+                        const int32_t x = (samples[i] > INT32_MAX - 0x80) ?
+                                INT32_MAX : samples[i] + 0x80;
+
+                        data[0] = x >> 8;
+                        data[1] = x >> 16;
+                        data[2] = x >> 24;
+                }
+                break;
+
+        case 32:
+                for (size_t i = 0; i < count; ++i, data += 4) {
+                        put_le32(data, samples[i]);
+                }
+                break;
+        }
+}
+
+void wav_le32(int32_t *samples, size_t count)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        for (size_t i = 0; i < count; ++i) {
+                samples[i] = __builtin_bswap32(samples[i]);
+        }
+#else
+        (void)samples; //already little endian
+        (void)count;
+#endif
+}
+
+int wav_pwrite(int fd, const void *buf, size_t size, size_t offset)
+{
+        const char *ptr = buf;
+
+
+        while (size > 0) {
+                const ssize_t ret = pwrite(fd, ptr, size, offset);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                }
+                ptr += ret;
+                size -= ret;
+                offset += ret;
+        }
+
+        return 0;
+}
+
+int wav_write(int fd, const void *buf, size_t size)
+{
+        const char *ptr = buf;
+
+
+        while (size > 0) {
+                const ssize_t ret = write(fd, ptr, size);
+
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                }
+                ptr += ret;
+                size -= ret;
+        }
+
+        return 0;
+}
+
+
+int wav_map_open(wav_map_t *wav, const char *file_name)
+{
+        struct stat st;
+        size_t width;
+        int err;
+
+
+        memset(wav, 0, sizeof (*wav));
+        wav->fd = open(file_name, O_RDONLY);
+        if (wav->fd == -1) {
+                return -1;
+        }
+        if (wav_read_header(wav->fd, &wav->info) != 0 ||
+                        fstat(wav->fd, &st) != 0)
+        {
+                goto close_lab;
+        }
+        if (!wav_supported(&wav->info)) {
+                errno = ENOTSUP;
+                goto close_lab;
+        }
+
+        /* Sizes of stream headers (and of truncated files) are wrong. */
+        width = wav->info.bits / 8;
+        if (wav->info.data_offset > (size_t)st.st_size) {
+                errno = EINVAL;
+                goto close_lab;
+        } else if (wav->info.data_size > st.st_size - wav->info.data_offset) {
+                wav->info.data_size = st.st_size - wav->info.data_offset;
+        }
+        wav->frames = wav->info.data_size / width;
+
+        wav->map_size = st.st_size;
+        wav->map = mmap(NULL, wav->map_size, PROT_READ, MAP_SHARED, wav->fd,
+                        0);
+        if (wav->map == MAP_FAILED) {
+                wav->map = NULL;
+                goto close_lab;
+        }
+        madvise(wav->map, wav->map_size, MADV_SEQUENTIAL);
+
+        return 0;
+
+
+close_lab:
+        err = errno;
+        close(wav->fd);
+        errno = err;
+
+        return -1;
+}
+
+int wav_map_create(wav_map_t *wav, const char *file_name,
+                const wav_info_t *info, size_t frames)
+{
+        int err;
+
+
+        memset(wav, 0, sizeof (*wav));
+        wav->info = *info;
+        wav->writable = 1;
+        wav->fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (wav->fd == -1) {
+                return -1;
+        }
+        if (wav_map_reserve(wav, frames) != 0) {
+                err = errno;
+                close(wav->fd);
+                unlink(file_name); //truncated anyway
+                errno = err;
+                return -1;
+        }
+
+        return 0;
+}
+
+int wav_map_reserve(wav_map_t *wav, size_t frames)
+{
+        const size_t width = wav->info.bits / 8;
+        const size_t needed = wav->info.data_offset + frames * width;
+        size_t size = (wav->map_size == 0) ? WAV_MAP_MIN : wav->map_size;
+        unsigned char *map;
+        int err;
+
+
+        if (frames > wav->frames) {
+                wav->frames = frames;
+        }
+        if (needed <= wav->map_size) {
+                return 0;
+        }
+
+        while (size < needed) {
+                size *= 2;
+        }
+        /* Real preallocation, full disk is an error here, not SIGBUS later. */
+        err = posix_fallocate(wav->fd, 0, size);
+        if (err != 0) {
+                errno = err;
+                return -1;
+        }
+
+        if (wav->map == NULL) {
+                map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                wav->fd, 0);
+        } else {
+                map = mremap(wav->map, wav->map_size, size, MREMAP_MAYMOVE);
+        }
+        if (map == MAP_FAILED) {
+                return -1;
+        }
+        wav->map = map;
+        wav->map_size = size;
+
+        return 0;
+}
+
+const int32_t * wav_map_read(const wav_map_t *wav, size_t frame,
+                size_t count, int32_t *buffer)
+{
+        const unsigned char *data = wav->map + wav->info.data_offset +
+                frame * (wav->info.bits / 8);
+
+
+        if (WAV_NATIVE_LE && wav->info.format == WAV_FORMAT_PCM &&
+                        wav->info.bits == 32 && (uintptr_t)data % 4 == 0)
+        {
+                return (const int32_t *)data; //zero copy
+        }
+        wav_to_int(&wav->info, data, count, buffer);
+
+        return buffer;
+}
+
+const unsigned char * wav_map_frame(const wav_map_t *wav, size_t frame)
+{
+        return wav->map + wav->info.data_offset +
+                frame * (wav->info.bits / 8);
+}
+
+int32_t * wav_map_samples(wav_map_t *wav, size_t frame, size_t count,
+                int32_t *buffer)
+{
+        unsigned char *data = wav->map + wav->info.data_offset +
+                frame * (wav->info.bits / 8);
+
+
+        (void)count;
+        if (WAV_NATIVE_LE && wav->info.format == WAV_FORMAT_PCM &&
+                        wav->info.bits == 32 && (uintptr_t)data % 4 == 0)
+        {
+                return (int32_t *)data; //zero copy
+        }
+
+        return buffer;
+}
+
+void wav_map_store(wav_map_t *wav, size_t frame, const int32_t *samples,
+                size_t count)
+{
+        unsigned char *data = wav->map + wav->info.data_offset +
+                frame * (wav->info.bits / 8);
+
+
+        if ((const unsigned char *)samples != data) { //not synthesized in place
+                wav_from_int(&wav->info, samples, count, data);
+        }
+}
+
+int wav_map_close(wav_map_t *wav)
+{
+        const size_t width = wav->info.bits / 8;
+        const uint64_t data_size = (uint64_t)wav->frames * width;
+        int ret = 0;
+
+
+        if (wav->writable && wav->info.data_offset != 0) {
+                build_header(wav->map, &wav->info,
+                                header_data_size(&wav->info, data_size));
+        }
+        if (wav->map != NULL && munmap(wav->map, wav->map_size) != 0) {
+                ret = -1;
+        }
+        if (wav->writable && ftruncate(wav->fd, wav->info.data_offset +
+                                data_size) != 0)
+        {
+                ret = -1;
+        }
+        if (close(wav->fd) != 0) {
+                ret = -1;
+        }
+        wav->map = NULL;
+
+        return ret;
+}
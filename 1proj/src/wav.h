@@ -0,0 +1,231 @@
+/**
+ * \file wav.h
+ * \brief Native WAV (RIFF) container support
+ * \author Jan Wrona, <xwrona00@stud.fit.vutbr.cz>
+ * \date 2015
+ */
+
+#ifndef WAV_H
+#define WAV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h> //ssize_t
+
+
+#define WAV_HEADER_SIZE 44 //canonical header, samples start right after it
+#define WAV_UNKNOWN_SIZE 0xFFFFFFFFu //RIFF and data size of endless streams
+
+#define WAV_FORMAT_PCM 1 //integer samples, unsigned if 8 bit
+#define WAV_FORMAT_FLOAT 3 //IEEE 754 samples
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE //real format is in the subformat GUID
+
+
+typedef struct { //parsed WAV header
+        unsigned format; //WAV_FORMAT_PCM or WAV_FORMAT_FLOAT
+        unsigned channels;
+        unsigned sample_rate;
+        unsigned bits; //per sample
+        size_t data_offset; //file offset of the first sample
+        size_t data_size; //bytes of samples, SIZE_MAX if unknown (stream)
+        const unsigned char *extra; //chunks written between fmt and data
+        size_t extra_size; //bytes of the extra chunks, 0 if none
+} wav_info_t;
+
+typedef struct { //memory mapped WAV file, samples used in place
+        wav_info_t info; //data_offset 0 for headerless samples
+        int fd;
+        int writable;
+        unsigned char *map; //whole file
+        size_t map_size; //mapped bytes
+        size_t frames; //frames in the file
+} wav_map_t;
+
+/**
+ * \brief Size of the header described by info, extra chunks included.
+ */
+static inline size_t wav_header_size(const wav_info_t *info)
+{
+        return WAV_HEADER_SIZE + info->extra_size;
+}
+
+/**
+ * \brief Store a chunk (header, data and padding) into buf.
+ *
+ * \return Bytes stored, 8 + size rounded up to even.
+ */
+size_t wav_chunk(unsigned char *buf, const char id[4], const void *data,
+                size_t size);
+
+/**
+ * \brief Write canonical WAV header to the beginning of the file.
+ *
+ * Header describes frames of info->channels samples, info->bits wide each,
+ * so the file may be preallocated and the samples written at
+ * wav_header_size() + offset in any order. Extra chunks of the info are
+ * written between the fmt and data chunks.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int wav_write_header(int fd, const wav_info_t *info, size_t frames);
+
+/**
+ * \brief Write canonical WAV header of unknown length to a stream.
+ *
+ * For pipes, where the header can't be updated at the end. RIFF and data
+ * sizes are WAV_UNKNOWN_SIZE, readers take samples up to the end of stream.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int wav_write_stream_header(int fd, const wav_info_t *info);
+
+/**
+ * \brief Parse the WAV header and find the samples.
+ *
+ * Chunks other than fmt and data are skipped, extensible format is resolved
+ * to its subformat.
+ *
+ * \return 0 on success, -1 on error (errno is set, EINVAL for not a WAV
+ *         file, ENOTSUP for a format other than PCM or float).
+ */
+int wav_read_header(int fd, wav_info_t *info);
+
+/**
+ * \brief Parse the WAV header of a stream, read up to the first sample.
+ *
+ * Same as wav_read_header(), but the header is consumed by read(), so pipes
+ * work too. Up to *chunk_size bytes of the first chunk with the id are
+ * stored to chunk, *chunk_size is set to their number (SIZE_MAX if there is
+ * no such chunk).
+ *
+ * \return 0 on success, -1 on error (errno is set as by wav_read_header()).
+ */
+int wav_read_stream_header(int fd, wav_info_t *info, const char id[4],
+                void *chunk, size_t *chunk_size);
+
+/**
+ * \brief Read up to size bytes of the first chunk with the id.
+ *
+ * \return Number of read bytes, -1 on error (errno is set, ENOENT if there
+ *         is no such chunk before the data chunk).
+ */
+ssize_t wav_read_chunk(int fd, const char id[4], void *buf, size_t size);
+
+/**
+ * \brief Whether the samples are handled natively (mono PCM 8 to 32 bits
+ *        or 32 bit float).
+ */
+int wav_supported(const wav_info_t *info);
+
+/**
+ * \brief Whether the PCM samples may be used in place as host integers of
+ *        their width (8 bit ones stay unsigned), without wav_to_int().
+ */
+int wav_native(const wav_info_t *info);
+
+/**
+ * \brief Convert samples in the info format to 32 bit integers.
+ *
+ * Samples are scaled to the full 32 bit range, like sf_read_int() does.
+ */
+void wav_to_int(const wav_info_t *info, const unsigned char *data,
+                size_t count, int32_t *samples);
+
+/**
+ * \brief Convert 32 bit integers to samples in the info format.
+ *
+ * Narrower samples are rounded, float samples are in [-1, 1).
+ */
+void wav_from_int(const wav_info_t *info, const int32_t *samples,
+                size_t count, unsigned char *data);
+
+/**
+ * \brief Convert 32 bit samples to little endian (WAV byte order) in place.
+ */
+void wav_le32(int32_t *samples, size_t count);
+
+/**
+ * \brief Write whole buffer at file offset, retry on partial writes.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int wav_pwrite(int fd, const void *buf, size_t size, size_t offset);
+
+/**
+ * \brief Write whole buffer at the current position, retry on partial writes.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int wav_write(int fd, const void *buf, size_t size);
+
+
+/**
+ * \brief Map the WAV file for reading.
+ *
+ * \return 0 on success, -1 on error (errno is set, ENOTSUP if the format is
+ *         not supported natively).
+ */
+int wav_map_open(wav_map_t *wav, const char *file_name);
+
+/**
+ * \brief Create the file and map it for writing, frames are preallocated.
+ *
+ * Header is written on wav_map_close(), info->data_offset is
+ * wav_header_size() for a WAV file or 0 for headerless samples. Extra
+ * chunks of the info have to stay valid until then.
+ *
+ * \return 0 on success, -1 on error (errno is set, the file is removed if
+ *         it was created).
+ */
+int wav_map_create(wav_map_t *wav, const char *file_name,
+                const wav_info_t *info, size_t frames);
+
+/**
+ * \brief Grow the written file to at least frames, the mapping may move.
+ *
+ * Space is really allocated, so a full disk fails here.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int wav_map_reserve(wav_map_t *wav, size_t frames);
+
+/**
+ * \brief Samples of the mapped input as 32 bit integers.
+ *
+ * \return Pointer into the mapping for native 32 bit PCM (zero copy),
+ *         otherwise buffer filled with the converted samples.
+ */
+const int32_t * wav_map_read(const wav_map_t *wav, size_t frame,
+                size_t count, int32_t *buffer);
+
+/**
+ * \brief Samples of the mapped input starting at frame, as they are stored.
+ */
+const unsigned char * wav_map_frame(const wav_map_t *wav, size_t frame);
+
+/**
+ * \brief Place for count samples of the written file starting at frame.
+ *
+ * \return Pointer into the mapping for native 32 bit PCM, so the samples may
+ *         be synthesized in place, buffer otherwise. Pass it to
+ *         wav_map_store() when the samples are complete.
+ */
+int32_t * wav_map_samples(wav_map_t *wav, size_t frame, size_t count,
+                int32_t *buffer);
+
+/**
+ * \brief Store samples to the written file at frame (converted if needed).
+ *
+ * The frames have to be reserved by wav_map_reserve().
+ */
+void wav_map_store(wav_map_t *wav, size_t frame, const int32_t *samples,
+                size_t count);
+
+/**
+ * \brief Unmap the file, written file gets its header and exact size.
+ *
+ * \return 0 on success, -1 on error (errno is set).
+ */
+int wav_map_close(wav_map_t *wav);
+
+#endif //WAV_H